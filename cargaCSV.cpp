@@ -4,176 +4,7118 @@
 #include <stdexcept>
 #include <limits>
 #include <cstdlib>
+#include <algorithm>
 #include <sstream>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <exception>
+#include <future>
+#include <cstdint>
+#include <string>
+#include <cctype>
+#include <cmath>
+#include <unordered_map>
+#include <numeric>
+#include <map>
+#include <set>
+#include <array>
+#include <deque>
+#include <cerrno>
+#include <cstdio>
+#include <memory_resource>
 
-class HojaCalculo {
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <filesystem>
+#endif
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+enum class Disposicion { PorFilas, PorColumnas };
+
+#ifndef _WIN32
+// Proyeccion en memoria de un archivo regular completo. Por defecto es de
+// solo lectura; con 'escribible' es una proyeccion privada en la que las
+// escrituras copian la pagina afectada y nunca llegan al archivo.
+// Si el archivo no es regular (una tuberia, por ejemplo) o no se pudo
+// proyectar, disponible() devuelve false y hay que leerlo como flujo.
+class ArchivoMapeado {
+private:
+    char* datos = nullptr;
+    size_t largo = 0;
+    bool regular = false;
+
+public:
+    explicit ArchivoMapeado(const std::string& nombreArchivo, bool escribible = false) {
+        int descriptor = open(nombreArchivo.c_str(), O_RDONLY);
+        if (descriptor < 0) {
+            return;
+        }
+        struct stat info;
+        if (fstat(descriptor, &info) == 0 && S_ISREG(info.st_mode)) {
+            regular = true;
+            largo = static_cast<size_t>(info.st_size);
+            if (largo > 0) {
+                int proteccion = escribible ? (PROT_READ | PROT_WRITE) : PROT_READ;
+                void* mapa = mmap(nullptr, largo, proteccion, MAP_PRIVATE, descriptor, 0);
+                if (mapa != MAP_FAILED) {
+                    if (!escribible) {
+                        madvise(mapa, largo, MADV_SEQUENTIAL);
+                    }
+                    datos = static_cast<char*>(mapa);
+                }
+            }
+        }
+        close(descriptor);
+    }
+
+    ~ArchivoMapeado() {
+        if (datos != nullptr) {
+            munmap(datos, largo);
+        }
+    }
+
+    ArchivoMapeado(const ArchivoMapeado&) = delete;
+    ArchivoMapeado& operator=(const ArchivoMapeado&) = delete;
+
+    bool disponible() const { return regular && (datos != nullptr || largo == 0); }
+    const char* inicio() const { return datos; }
+    char* inicio() { return datos; }
+    size_t tamano() const { return largo; }
+};
+#endif
+
+// Suma de verificacion de 64 bits para los archivos binarios. Recorre los
+// datos en palabras de 8 bytes repartidas en cuatro carriles independientes
+// (mezcla tipo FNV), asi que se puede calcular a varios GB/s y por partes.
+class SumaVerificacion {
+private:
+    uint64_t carriles[4] = {0xcbf29ce484222325ULL, 0x84222325cbf29ce4ULL, 0x9e3779b97f4a7c15ULL, 0x7f4a7c159e3779b9ULL};
+    unsigned char pendiente[32];
+    size_t usados = 0;
+    uint64_t total = 0;
+
+    void mezclar(const unsigned char* p) {
+        for (int k = 0; k < 4; ++k) {
+            uint64_t palabra;
+            std::memcpy(&palabra, p + 8 * k, 8);
+            carriles[k] = (carriles[k] ^ palabra) * 0x100000001b3ULL;
+            carriles[k] ^= carriles[k] >> 29;
+        }
+    }
+
+public:
+    void agregar(const void* datos, size_t n) {
+        const unsigned char* p = static_cast<const unsigned char*>(datos);
+        total += n;
+        if (usados > 0) {
+            size_t faltan = std::min(n, sizeof(pendiente) - usados);
+            std::memcpy(pendiente + usados, p, faltan);
+            usados += faltan;
+            p += faltan;
+            n -= faltan;
+            if (usados < sizeof(pendiente)) {
+                return;
+            }
+            mezclar(pendiente);
+            usados = 0;
+        }
+        for (; n >= sizeof(pendiente); p += sizeof(pendiente), n -= sizeof(pendiente)) {
+            mezclar(p);
+        }
+        std::memcpy(pendiente, p, n);
+        usados = n;
+    }
+
+    uint64_t valor() const {
+        uint64_t resultado = total;
+        for (uint64_t carril : carriles) {
+            resultado = (resultado ^ carril) * 0x100000001b3ULL;
+        }
+        for (size_t i = 0; i < usados; ++i) {
+            resultado = (resultado ^ pendiente[i]) * 0x100000001b3ULL;
+        }
+        return resultado ^ (resultado >> 32);
+    }
+};
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#error "El formato binario de HojaCalculo guarda los dobles en little-endian"
+#endif
+
+// Cabecera de 64 bytes del formato binario. Le siguen filas * columnas
+// dobles little-endian en la disposicion indicada, linea tras linea y sin
+// holgura, de modo que el bloque se puede usar tal cual desde la proyeccion.
+struct CabeceraBinaria {
+    char magia[8];
+    uint32_t version;
+    uint32_t disposicion;
+    uint64_t filas;
+    uint64_t columnas;
+    uint64_t suma;
+    // Numero del punto de control del registro de cambios; 0 en un guardado normal
+    uint64_t puntoControl;
+    unsigned char reserva[16];
+};
+static_assert(sizeof(CabeceraBinaria) == 64, "La cabecera binaria debe ocupar 64 bytes");
+
+const char magiaBinaria[8] = {'H', 'O', 'J', 'A', 'C', 'A', 'L', 'C'};
+const uint32_t versionBinaria = 1;
+
+// Reduce n valores contiguos con la operacion indicada ('+' suma, '*' producto).
+// Usa AVX (4 dobles por instruccion) o SSE2 (2 dobles) cuando el compilador
+// los habilita y un bucle escalar para el resto.
+template <char Operacion>
+double reducirContiguo(const double* datos, size_t n) {
+    size_t i = 0;
+    double total = (Operacion == '+') ? 0.0 : 1.0;
+#if defined(__AVX__)
+    __m256d a = _mm256_set1_pd(total);
+    __m256d b = a;
+    for (; i + 8 <= n; i += 8) {
+        __m256d x = _mm256_loadu_pd(datos + i);
+        __m256d y = _mm256_loadu_pd(datos + i + 4);
+        if constexpr (Operacion == '+') {
+            a = _mm256_add_pd(a, x);
+            b = _mm256_add_pd(b, y);
+        } else {
+            a = _mm256_mul_pd(a, x);
+            b = _mm256_mul_pd(b, y);
+        }
+    }
+    alignas(32) double carriles[8];
+    _mm256_store_pd(carriles, a);
+    _mm256_store_pd(carriles + 4, b);
+#elif defined(__SSE2__)
+    __m128d a = _mm_set1_pd(total);
+    __m128d b = a;
+    for (; i + 4 <= n; i += 4) {
+        __m128d x = _mm_loadu_pd(datos + i);
+        __m128d y = _mm_loadu_pd(datos + i + 2);
+        if constexpr (Operacion == '+') {
+            a = _mm_add_pd(a, x);
+            b = _mm_add_pd(b, y);
+        } else {
+            a = _mm_mul_pd(a, x);
+            b = _mm_mul_pd(b, y);
+        }
+    }
+    alignas(16) double carriles[4];
+    _mm_store_pd(carriles, a);
+    _mm_store_pd(carriles + 2, b);
+#endif
+#if defined(__AVX__) || defined(__SSE2__)
+    // Las sumas (o productos) parciales de cada carril se combinan al final
+    for (double carril : carriles) {
+        if constexpr (Operacion == '+') total += carril;
+        else total *= carril;
+    }
+#endif
+    for (; i < n; ++i) {
+        if constexpr (Operacion == '+') {
+            total += datos[i];
+        } else {
+            total *= datos[i];
+        }
+    }
+    return total;
+}
+
+template <char Operacion>
+double reducirTramo(const double* datos, size_t n, size_t salto) {
+    if (salto == 1) {
+        return reducirContiguo<Operacion>(datos, n);
+    }
+    double total = (Operacion == '+') ? 0.0 : 1.0;
+    for (size_t i = 0; i < n; ++i, datos += salto) {
+        if constexpr (Operacion == '+') {
+            total += *datos;
+        } else {
+            total *= *datos;
+        }
+    }
+    return total;
+}
+
+// El cociente se divide de a un valor, en orden: multiplicar por el producto
+// de los reciprocos se va a 0 o a infinito antes que la division sucesiva.
+double dividirTramo(double total, const double* datos, size_t n, size_t salto) {
+    for (size_t i = 0; i < n; ++i, datos += salto) {
+        if (*datos == 0) throw std::invalid_argument("Error: Division por cero.");
+        total /= *datos;
+    }
+    return total;
+}
+
+// Aplica la operacion a n valores separados por 'salto' posiciones:
+// el primero es el valor inicial y los demas se suman, restan, multiplican o dividen.
+double reducir(const double* datos, size_t n, size_t salto, char operacion) {
+    double primero = datos[0];
+    const double* resto = datos + salto;
+    switch (operacion) {
+        case '+': return primero + reducirTramo<'+'>(resto, n - 1, salto);
+        case '-': return primero - reducirTramo<'+'>(resto, n - 1, salto);
+        case '*': return primero * reducirTramo<'*'>(resto, n - 1, salto);
+        case '/': return dividirTramo(primero, resto, n - 1, salto);
+        default: throw std::invalid_argument("Error: Operacion no valida.");
+    }
+}
+
+// Resumen de un tramo de celdas para las estadisticas de rango: cuenta, suma
+// con su termino de compensacion, extremos y suma de los cuadrados de las
+// desviaciones respecto de la media del propio tramo. Dos resumenes se unen
+// con la formula de Chan, asi la desviacion no pierde precision al juntar
+// tramos y no hace falta volver a recorrer la memoria.
+struct Acumulado {
+    size_t cuenta = 0;
+    double suma = 0.0;
+    double compensacion = 0.0;
+    double minimo = std::numeric_limits<double>::infinity();
+    double maximo = -std::numeric_limits<double>::infinity();
+    double cuadrados = 0.0;
+
+    double total() const {
+        return suma + compensacion;
+    }
+
+    // Suma de Neumaier: 'compensacion' guarda lo que se pierde al redondear
+    void sumar(double valor) {
+        double t = suma + valor;
+        compensacion += (std::fabs(suma) >= std::fabs(valor)) ? (suma - t) + valor : (valor - t) + suma;
+        suma = t;
+    }
+
+    void unir(const Acumulado& otro) {
+        if (otro.cuenta == 0) {
+            return;
+        }
+        if (cuenta == 0) {
+            *this = otro;
+            return;
+        }
+        double delta = otro.total() / otro.cuenta - total() / cuenta;
+        double n = static_cast<double>(cuenta) + otro.cuenta;
+        cuadrados += otro.cuadrados + delta * delta * (static_cast<double>(cuenta) * otro.cuenta / n);
+        sumar(otro.suma);
+        compensacion += otro.compensacion;
+        cuenta += otro.cuenta;
+        minimo = std::min(minimo, otro.minimo);
+        maximo = std::max(maximo, otro.maximo);
+    }
+};
+
+// Acumula n valores contiguos en bloques de 1024 (8 KB): la primera vuelta
+// suma con Kahan en cada carril y saca los extremos, la segunda suma los
+// cuadrados de las desviaciones mientras el bloque sigue en la cache.
+Acumulado acumularContiguo(const double* datos, size_t n) {
+    const size_t bloque = 1024;
+    Acumulado total;
+    for (size_t inicio = 0; inicio < n; inicio += bloque) {
+        const double* x = datos + inicio;
+        size_t largo = std::min(bloque, n - inicio);
+        Acumulado parte;
+        parte.cuenta = largo;
+        size_t i = 0;
+#if defined(__AVX__)
+        __m256d s = _mm256_setzero_pd();
+        __m256d c = _mm256_setzero_pd();
+        __m256d menor = _mm256_set1_pd(parte.minimo);
+        __m256d mayor = _mm256_set1_pd(parte.maximo);
+        for (; i + 4 <= largo; i += 4) {
+            __m256d v = _mm256_loadu_pd(x + i);
+            __m256d y = _mm256_sub_pd(v, c);
+            __m256d t = _mm256_add_pd(s, y);
+            c = _mm256_sub_pd(_mm256_sub_pd(t, s), y);
+            s = t;
+            menor = _mm256_min_pd(menor, v);
+            mayor = _mm256_max_pd(mayor, v);
+        }
+        const size_t carriles = 4;
+        alignas(32) double sumas[carriles], errores[carriles], menores[carriles], mayores[carriles];
+        _mm256_store_pd(sumas, s);
+        _mm256_store_pd(errores, c);
+        _mm256_store_pd(menores, menor);
+        _mm256_store_pd(mayores, mayor);
+#elif defined(__SSE2__)
+        __m128d s = _mm_setzero_pd();
+        __m128d c = _mm_setzero_pd();
+        __m128d menor = _mm_set1_pd(parte.minimo);
+        __m128d mayor = _mm_set1_pd(parte.maximo);
+        for (; i + 2 <= largo; i += 2) {
+            __m128d v = _mm_loadu_pd(x + i);
+            __m128d y = _mm_sub_pd(v, c);
+            __m128d t = _mm_add_pd(s, y);
+            c = _mm_sub_pd(_mm_sub_pd(t, s), y);
+            s = t;
+            menor = _mm_min_pd(menor, v);
+            mayor = _mm_max_pd(mayor, v);
+        }
+        const size_t carriles = 2;
+        alignas(16) double sumas[carriles], errores[carriles], menores[carriles], mayores[carriles];
+        _mm_store_pd(sumas, s);
+        _mm_store_pd(errores, c);
+        _mm_store_pd(menores, menor);
+        _mm_store_pd(mayores, mayor);
+#endif
+#if defined(__AVX__) || defined(__SSE2__)
+        for (size_t k = 0; k < carriles; ++k) {
+            parte.sumar(sumas[k]);
+            parte.compensacion -= errores[k];
+            parte.minimo = std::min(parte.minimo, menores[k]);
+            parte.maximo = std::max(parte.maximo, mayores[k]);
+        }
+#endif
+        for (; i < largo; ++i) {
+            parte.sumar(x[i]);
+            parte.minimo = std::min(parte.minimo, x[i]);
+            parte.maximo = std::max(parte.maximo, x[i]);
+        }
+
+        double media = parte.total() / largo;
+        i = 0;
+#if defined(__AVX__)
+        __m256d m = _mm256_set1_pd(media);
+        __m256d q = _mm256_setzero_pd();
+        for (; i + 4 <= largo; i += 4) {
+            __m256d d = _mm256_sub_pd(_mm256_loadu_pd(x + i), m);
+            q = _mm256_add_pd(q, _mm256_mul_pd(d, d));
+        }
+        _mm256_store_pd(sumas, q);
+#elif defined(__SSE2__)
+        __m128d m = _mm_set1_pd(media);
+        __m128d q = _mm_setzero_pd();
+        for (; i + 2 <= largo; i += 2) {
+            __m128d d = _mm_sub_pd(_mm_loadu_pd(x + i), m);
+            q = _mm_add_pd(q, _mm_mul_pd(d, d));
+        }
+        _mm_store_pd(sumas, q);
+#endif
+#if defined(__AVX__) || defined(__SSE2__)
+        for (size_t k = 0; k < carriles; ++k) {
+            parte.cuadrados += sumas[k];
+        }
+#endif
+        for (; i < largo; ++i) {
+            double d = x[i] - media;
+            parte.cuadrados += d * d;
+        }
+        total.unir(parte);
+    }
+    return total;
+}
+
+// Grupo fijo de hilos trabajadores. ejecutar(n, tarea) reparte las tareas
+// 0..n-1 entre los trabajadores y el hilo que llama, y vuelve cuando todas
+// terminaron; si alguna lanza una excepcion, se relanza la primera.
+// Cada participante empieza con un tramo contiguo de tareas que consume por
+// delante; cuando se le acaba, roba la mitad final del tramo de otro. Los
+// tramos son pares [inicio, fin) empaquetados en un entero atomico, asi que
+// tomar y robar son un solo compare-exchange, sin cerrojos.
+// No es reentrante: una tarea no debe llamar a ejecutar sobre el mismo grupo.
+class GrupoHilos {
+private:
+    struct alignas(64) Tramo {
+        std::atomic<uint64_t> limites{0};
+    };
+
+    std::vector<std::thread> trabajadores;
+    std::unique_ptr<Tramo[]> tramos;
+    std::mutex mutex;
+    std::condition_variable avisoTrabajo;
+    std::condition_variable avisoFin;
+    std::function<void(size_t)> tarea;
+    size_t lote = 0;
+    size_t pendientes = 0;
+    bool salir = false;
+    std::exception_ptr error;
+    std::atomic<size_t> robos{0};
+
+    static uint64_t empaquetar(uint64_t inicio, uint64_t fin) {
+        return (inicio << 32) | fin;
+    }
+
+    bool tomarPropia(size_t yo, size_t& indice) {
+        uint64_t actual = tramos[yo].limites.load();
+        while (true) {
+            uint64_t inicio = actual >> 32;
+            uint64_t fin = actual & 0xffffffffu;
+            if (inicio >= fin) {
+                return false;
+            }
+            if (tramos[yo].limites.compare_exchange_weak(actual, empaquetar(inicio + 1, fin))) {
+                indice = static_cast<size_t>(inicio);
+                return true;
+            }
+        }
+    }
+
+    bool robar(size_t yo, size_t& indice) {
+        size_t participantes = cantidad();
+        for (size_t k = 1; k < participantes; ++k) {
+            Tramo& victima = tramos[(yo + k) % participantes];
+            uint64_t actual = victima.limites.load();
+            while (true) {
+                uint64_t inicio = actual >> 32;
+                uint64_t fin = actual & 0xffffffffu;
+                if (inicio >= fin) {
+                    break;
+                }
+                uint64_t mitad = inicio + (fin - inicio) / 2;
+                if (victima.limites.compare_exchange_weak(actual, empaquetar(inicio, mitad))) {
+                    // La primera robada se ejecuta ya; el resto pasa a ser el tramo propio
+                    indice = static_cast<size_t>(mitad);
+                    tramos[yo].limites.store(empaquetar(mitad + 1, fin));
+                    robos.fetch_add(1, std::memory_order_relaxed);
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    void procesar(size_t yo) {
+        size_t i;
+        while (tomarPropia(yo, i) || robar(yo, i)) {
+            try {
+                tarea(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> bloqueo(mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+        }
+    }
+
+    void bucle(size_t yo) {
+        size_t visto = 0;
+        std::unique_lock<std::mutex> bloqueo(mutex);
+        while (true) {
+            avisoTrabajo.wait(bloqueo, [&] { return salir || lote != visto; });
+            if (salir) {
+                return;
+            }
+            visto = lote;
+            bloqueo.unlock();
+            procesar(yo);
+            bloqueo.lock();
+            if (--pendientes == 0) {
+                avisoFin.notify_all();
+            }
+        }
+    }
+
+public:
+    explicit GrupoHilos(size_t cantidad) : tramos(new Tramo[std::max<size_t>(cantidad, 1)]) {
+        for (size_t i = 1; i < cantidad; ++i) {
+            trabajadores.emplace_back([this, i] { bucle(i - 1); });
+        }
+    }
+
+    ~GrupoHilos() {
+        {
+            std::lock_guard<std::mutex> bloqueo(mutex);
+            salir = true;
+        }
+        avisoTrabajo.notify_all();
+        for (auto& hilo : trabajadores) {
+            hilo.join();
+        }
+    }
+
+    GrupoHilos(const GrupoHilos&) = delete;
+    GrupoHilos& operator=(const GrupoHilos&) = delete;
+
+    size_t cantidad() const {
+        return trabajadores.size() + 1;
+    }
+
+    // Cuantas veces un participante tuvo que robar trabajo desde que se creo el grupo
+    size_t robosRealizados() const {
+        return robos.load();
+    }
+
+    void ejecutar(size_t tareas, std::function<void(size_t)> nueva) {
+        if (tareas > 0xffffffffu) {
+            throw std::length_error("Demasiadas tareas para un solo lote");
+        }
+        {
+            std::lock_guard<std::mutex> bloqueo(mutex);
+            tarea = std::move(nueva);
+            size_t participantes = cantidad();
+            for (size_t p = 0; p < participantes; ++p) {
+                tramos[p].limites.store(empaquetar(tareas * p / participantes, tareas * (p + 1) / participantes));
+            }
+            error = nullptr;
+            pendientes = trabajadores.size();
+            ++lote;
+        }
+        avisoTrabajo.notify_all();
+        procesar(trabajadores.size());
+        std::unique_lock<std::mutex> bloqueo(mutex);
+        avisoFin.wait(bloqueo, [&] { return pendientes == 0; });
+        tarea = nullptr;
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+};
+
+// Celda o rango referenciado por una formula. Una celda suelta es un rango
+// de un solo elemento. Si la fila o columna referenciada se elimina, la
+// referencia queda invalida y la formula vale NaN.
+struct Rango {
+    size_t fila1;
+    size_t columna1;
+    size_t fila2;
+    size_t columna2;
+
+    static const size_t invalida = std::numeric_limits<size_t>::max();
+
+    bool valido() const { return fila1 != invalida && columna1 != invalida; }
+    bool esCelda() const { return fila1 == fila2 && columna1 == columna2; }
+    bool contiene(size_t fila, size_t columna) const {
+        return valido() && fila >= fila1 && fila <= fila2 && columna >= columna1 && columna <= columna2;
+    }
+    size_t cantidad() const { return (fila2 - fila1 + 1) * (columna2 - columna1 + 1); }
+};
+
+enum class FuncionRango : unsigned char { Suma, Minimo, Maximo, Promedio, Contar };
+
+// Una formula se compila a notacion postfija: cada instruccion apila o combina
+// valores parciales, y las funciones de rango juntan los parciales de sus argumentos.
+struct Instruccion {
+    enum class Tipo : unsigned char { Numero, Referencia, Suma, Resta, Producto, Cociente, Negacion, Funcion };
+    Tipo tipo;
+    FuncionRango funcion;
+    unsigned argumentos;
+    double numero;
+    Rango rango;
+};
+
+struct Formula {
+    std::string texto;
+    std::vector<Instruccion> codigo;
+};
+
+// Resumen del ultimo recalculo: formulas evaluadas, niveles del grafo
+// (longitud de la ruta critica) y aceleracion obtenida, medida como el
+// tiempo de evaluacion sumado de todos los hilos sobre el tiempo real.
+struct EstadisticasRecalculo {
+    size_t tareas = 0;
+    size_t niveles = 0;
+    double milisegundos = 0.0;
+    double aceleracion = 1.0;
+};
+
+// Resultado de estadisticasRango. La desviacion es la muestral (n - 1).
+struct EstadisticasRango {
+    double suma;
+    double minimo;
+    double maximo;
+    double promedio;
+    size_t cuenta;
+    double desviacion;
+};
+
+// Uso de la cache de reducciones de una hoja
+struct EstadisticasCache {
+    size_t aciertos;
+    size_t fallos;
+    size_t entradas;
+};
+
+// Estado del diario de deshacer / rehacer
+struct EstadisticasDiario {
+    size_t deshacibles;
+    size_t rehacibles;
+    size_t bytes;
+    size_t presupuesto;
+};
+
+// Estado del registro de cambios (abrirRegistro)
+struct EstadisticasRegistro {
+    bool activo;
+    size_t registros;
+    size_t lotes;
+    size_t pendientes;
+    size_t bytes;
+    size_t puntosControl;
+    size_t recuperados;
+    double milisegundosSincronizando;
+};
+
+// Filas encontradas por buscar / filtrar, en orden, y si se uso un indice
+// de columna para encontrarlas o se recorrio la columna entera
+struct ResultadoBusqueda {
+    std::vector<size_t> filas;
+    bool conIndice;
+};
+
+enum class TipoIndiceColumna { Hash, Ordenado };
+
+// Un indice de columna de una hoja (ver HojaCalculo::crearIndiceColumna)
+struct EstadisticasIndiceColumna {
+    size_t columna;
+    TipoIndiceColumna tipo;
+    size_t bytes;
+};
+
+// Como se guarda una columna comprimida (ver ColumnaComprimida)
+enum class CodificacionColumna { Cruda, Diccionario, Referencia, Xor };
+
+// Una columna de una hoja comprimida (ver HojaCalculo::establecerCompresion)
+struct EstadisticasColumnaComprimida {
+    size_t columna;
+    CodificacionColumna codificacion;
+    size_t bytes;
+    size_t bytesCrudos;
+    double razon;
+};
+
+// Un cambio de actualizarCeldas
+struct Actualizacion {
+    size_t fila;
+    size_t columna;
+    double valor;
+};
+
+// Columna por la que ordenar las filas (ver HojaCalculo::ordenar)
+struct ClaveOrden {
+    size_t columna;
+    bool descendente = false;
+};
+
+// Columna de valores que agrupar resume en cada grupo, y con que funcion
+struct Agregacion {
+    size_t columna;
+    FuncionRango funcion;
+};
+
+// Analizador descendente recursivo de formulas como "=F0C1 * 2 + SUMA(F0C0:F9C0)".
+// Las referencias son FxCy con indices desde 0, igual que en el menu.
+// Funciones: SUMA, MIN, MAX, PROMEDIO y CONTAR; sus argumentos pueden ser
+// rangos o expresiones.
+class LectorFormula {
 private:
-    std::vector<std::vector<double>> celdas;
+    const std::string& texto;
+    size_t pos = 0;
+    std::vector<Instruccion> codigo;
+
+    [[noreturn]] void error(const std::string& motivo) const {
+        throw std::invalid_argument("Formula no valida (" + motivo + ") en la posicion " + std::to_string(pos));
+    }
+
+    void saltarEspacios() {
+        while (pos < texto.size() && (texto[pos] == ' ' || texto[pos] == '\t')) {
+            ++pos;
+        }
+    }
+
+    bool aceptar(char c) {
+        saltarEspacios();
+        if (pos < texto.size() && texto[pos] == c) {
+            ++pos;
+            return true;
+        }
+        return false;
+    }
+
+    void emitir(Instruccion::Tipo tipo) {
+        Instruccion instruccion = {};
+        instruccion.tipo = tipo;
+        codigo.push_back(instruccion);
+    }
+
+    size_t leerIndice() {
+        size_t inicio = pos;
+        size_t valor = 0;
+        auto [fin, fallo] = std::from_chars(texto.data() + pos, texto.data() + texto.size(), valor);
+        if (fallo != std::errc()) {
+            error("se esperaba un indice");
+        }
+        pos = inicio + (fin - (texto.data() + inicio));
+        return valor;
+    }
+
+    bool leerReferencia(size_t& fila, size_t& columna) {
+        saltarEspacios();
+        if (pos + 1 >= texto.size() || std::toupper(static_cast<unsigned char>(texto[pos])) != 'F' ||
+            !std::isdigit(static_cast<unsigned char>(texto[pos + 1]))) {
+            return false;
+        }
+        ++pos;
+        fila = leerIndice();
+        if (pos >= texto.size() || std::toupper(static_cast<unsigned char>(texto[pos])) != 'C') {
+            error("se esperaba C en la referencia");
+        }
+        ++pos;
+        columna = leerIndice();
+        return true;
+    }
+
+    // Referencia a celda o, si se permite, a rango "FaCb:FcCd"
+    bool referencia(bool permitirRango) {
+        size_t guardada = pos;
+        Rango rango;
+        if (!leerReferencia(rango.fila1, rango.columna1)) {
+            pos = guardada;
+            return false;
+        }
+        rango.fila2 = rango.fila1;
+        rango.columna2 = rango.columna1;
+        if (aceptar(':')) {
+            if (!permitirRango) {
+                error("los rangos solo pueden ser argumentos de una funcion");
+            }
+            if (!leerReferencia(rango.fila2, rango.columna2)) {
+                error("rango incompleto");
+            }
+            if (rango.fila2 < rango.fila1) std::swap(rango.fila1, rango.fila2);
+            if (rango.columna2 < rango.columna1) std::swap(rango.columna1, rango.columna2);
+        }
+        emitir(Instruccion::Tipo::Referencia);
+        codigo.back().rango = rango;
+        return true;
+    }
+
+    bool funcion() {
+        saltarEspacios();
+        size_t inicio = pos;
+        std::string nombre;
+        while (pos < texto.size() && std::isalpha(static_cast<unsigned char>(texto[pos]))) {
+            nombre += static_cast<char>(std::toupper(static_cast<unsigned char>(texto[pos])));
+            ++pos;
+        }
+        FuncionRango tipo;
+        if (nombre == "SUMA") tipo = FuncionRango::Suma;
+        else if (nombre == "MIN") tipo = FuncionRango::Minimo;
+        else if (nombre == "MAX") tipo = FuncionRango::Maximo;
+        else if (nombre == "PROMEDIO") tipo = FuncionRango::Promedio;
+        else if (nombre == "CONTAR") tipo = FuncionRango::Contar;
+        else {
+            pos = inicio;
+            return false;
+        }
+        if (!aceptar('(')) {
+            error("se esperaba ( despues de " + nombre);
+        }
+        unsigned argumentos = 0;
+        do {
+            if (!referencia(true)) {
+                expresion();
+            }
+            ++argumentos;
+        } while (aceptar(','));
+        if (!aceptar(')')) {
+            error("se esperaba )");
+        }
+        emitir(Instruccion::Tipo::Funcion);
+        codigo.back().funcion = tipo;
+        codigo.back().argumentos = argumentos;
+        return true;
+    }
+
+    void factor() {
+        if (aceptar('(')) {
+            expresion();
+            if (!aceptar(')')) {
+                error("se esperaba )");
+            }
+            return;
+        }
+        if (aceptar('-')) {
+            factor();
+            emitir(Instruccion::Tipo::Negacion);
+            return;
+        }
+        if (aceptar('+')) {
+            factor();
+            return;
+        }
+        if (referencia(false) || funcion()) {
+            return;
+        }
+        saltarEspacios();
+        double numero;
+        auto [fin, fallo] = std::from_chars(texto.data() + pos, texto.data() + texto.size(), numero);
+        if (fallo != std::errc()) {
+            error("se esperaba un numero, una referencia o una funcion");
+        }
+        pos = fin - texto.data();
+        emitir(Instruccion::Tipo::Numero);
+        codigo.back().numero = numero;
+    }
+
+    void termino() {
+        factor();
+        while (true) {
+            if (aceptar('*')) {
+                factor();
+                emitir(Instruccion::Tipo::Producto);
+            } else if (aceptar('/')) {
+                factor();
+                emitir(Instruccion::Tipo::Cociente);
+            } else {
+                return;
+            }
+        }
+    }
+
+    void expresion() {
+        termino();
+        while (true) {
+            if (aceptar('+')) {
+                termino();
+                emitir(Instruccion::Tipo::Suma);
+            } else if (aceptar('-')) {
+                termino();
+                emitir(Instruccion::Tipo::Resta);
+            } else {
+                return;
+            }
+        }
+    }
+
+public:
+    explicit LectorFormula(const std::string& texto) : texto(texto) {}
+
+    std::vector<Instruccion> compilar() {
+        aceptar('=');
+        expresion();
+        saltarEspacios();
+        if (pos != texto.size()) {
+            error("caracteres de sobra");
+        }
+        return std::move(codigo);
+    }
+};
+
+// Reconstruye el texto de una formula desde su codigo, con las referencias al dia
+std::string describirFormula(const std::vector<Instruccion>& codigo) {
+    static const char* nombres[] = {"SUMA", "MIN", "MAX", "PROMEDIO", "CONTAR"};
+    // Cada elemento guarda su texto y la precedencia de su operador principal
+    std::vector<std::pair<std::string, int>> pila;
+    auto celda = [](size_t fila, size_t columna) {
+        return "F" + std::to_string(fila) + "C" + std::to_string(columna);
+    };
+    auto envolver = [](const std::pair<std::string, int>& operando, int minima) {
+        return operando.second < minima ? "(" + operando.first + ")" : operando.first;
+    };
+    for (const auto& instruccion : codigo) {
+        switch (instruccion.tipo) {
+            case Instruccion::Tipo::Numero: {
+                char bufer[32];
+                char* fin = std::to_chars(bufer, bufer + sizeof(bufer), instruccion.numero).ptr;
+                pila.push_back({std::string(bufer, fin), 3});
+                break;
+            }
+            case Instruccion::Tipo::Referencia: {
+                const Rango& rango = instruccion.rango;
+                std::string texto = !rango.valido() ? "#REF" : rango.esCelda() ? celda(rango.fila1, rango.columna1)
+                    : celda(rango.fila1, rango.columna1) + ":" + celda(rango.fila2, rango.columna2);
+                pila.push_back({texto, 3});
+                break;
+            }
+            case Instruccion::Tipo::Negacion:
+                pila.back() = {"-" + envolver(pila.back(), 3), 3};
+                break;
+            case Instruccion::Tipo::Funcion: {
+                std::string texto;
+                for (size_t i = pila.size() - instruccion.argumentos; i < pila.size(); ++i) {
+                    texto += (texto.empty() ? "" : ", ") + pila[i].first;
+                }
+                pila.resize(pila.size() - instruccion.argumentos);
+                pila.push_back({std::string(nombres[static_cast<int>(instruccion.funcion)]) + "(" + texto + ")", 3});
+                break;
+            }
+            default: {
+                auto derecho = pila.back();
+                pila.pop_back();
+                bool aditivo = instruccion.tipo == Instruccion::Tipo::Suma || instruccion.tipo == Instruccion::Tipo::Resta;
+                int precedencia = aditivo ? 1 : 2;
+                const char* simbolo = instruccion.tipo == Instruccion::Tipo::Suma ? " + "
+                    : instruccion.tipo == Instruccion::Tipo::Resta ? " - "
+                    : instruccion.tipo == Instruccion::Tipo::Producto ? " * " : " / ";
+                // El operando derecho de - y / necesita parentesis si tiene la misma precedencia
+                bool estricto = instruccion.tipo == Instruccion::Tipo::Resta || instruccion.tipo == Instruccion::Tipo::Cociente;
+                pila.back() = {envolver(pila.back(), precedencia) + simbolo + envolver(derecho, precedencia + (estricto ? 1 : 0)), precedencia};
+                break;
+            }
+        }
+    }
+    return "=" + (pila.empty() ? std::string() : pila.back().first);
+}
+
+// Celdas de una hoja casi vacia: se guardan en bloques de lado x lado que
+// solo existen mientras tienen alguna celda distinta de cero, asi que la
+// memoria depende de las celdas ocupadas y no del tamano de la hoja. Una
+// celda sin bloque vale 0.
+class AlmacenDisperso {
+public:
+    static const size_t lado = 16;
+
+    explicit AlmacenDisperso(std::pmr::memory_resource* memoria = std::pmr::get_default_resource())
+        : memoria(memoria), bloques(memoria) {}
+
+    double leer(size_t fila, size_t columna) const {
+        auto it = bloques.find(claveBloque(fila, columna));
+        return it == bloques.end() ? 0.0 : it->second.valores[indice(fila, columna)];
+    }
+
+    void escribir(size_t fila, size_t columna, double valor) {
+        uint64_t clave = claveBloque(fila, columna);
+        auto it = bloques.find(clave);
+        if (it == bloques.end()) {
+            if (vacia(valor)) {
+                return;
+            }
+            it = bloques.emplace(clave, Bloque{std::pmr::vector<double>(lado * lado, 0.0, memoria), 0}).first;
+        }
+        double& celda = it->second.valores[indice(fila, columna)];
+        it->second.ocupadas += static_cast<size_t>(!vacia(valor)) - static_cast<size_t>(!vacia(celda));
+        celda = valor;
+        if (it->second.ocupadas == 0) {
+            bloques.erase(it);
+        }
+    }
+
+    // Copia a destino 'largo' celdas seguidas de una fila, desde 'columna'.
+    // Se busca un bloque por cada tramo de 'lado' celdas, no uno por celda.
+    void copiarFila(size_t fila, size_t columna, size_t largo, double* destino) const {
+        while (largo > 0) {
+            size_t dentro = columna % lado;
+            size_t tramo = std::min(largo, lado - dentro);
+            auto it = bloques.find(claveBloque(fila, columna));
+            if (it == bloques.end()) {
+                std::fill_n(destino, tramo, 0.0);
+            } else {
+                std::copy_n(it->second.valores.data() + indice(fila, columna), tramo, destino);
+            }
+            destino += tramo;
+            columna += tramo;
+            largo -= tramo;
+        }
+    }
+
+    void copiarColumna(size_t fila, size_t columna, size_t largo, double* destino) const {
+        while (largo > 0) {
+            size_t tramo = std::min(largo, lado - fila % lado);
+            auto it = bloques.find(claveBloque(fila, columna));
+            if (it == bloques.end()) {
+                std::fill_n(destino, tramo, 0.0);
+            } else {
+                const double* origen = it->second.valores.data() + indice(fila, columna);
+                for (size_t i = 0; i < tramo; ++i) {
+                    destino[i] = origen[i * lado];
+                }
+            }
+            destino += tramo;
+            fila += tramo;
+            largo -= tramo;
+        }
+    }
+
+    // Recorre las celdas ocupadas: accion(fila, columna, valor)
+    template <typename Accion>
+    void recorrer(Accion accion) const {
+        for (const auto& entrada : bloques) {
+            size_t fila0 = (entrada.first >> 32) * lado;
+            size_t columna0 = (entrada.first & 0xffffffffu) * lado;
+            for (size_t i = 0; i < lado * lado; ++i) {
+                if (!vacia(entrada.second.valores[i])) {
+                    accion(fila0 + i / lado, columna0 + i % lado, entrada.second.valores[i]);
+                }
+            }
+        }
+    }
+
+    // Quita la fila o columna 'index' y corre una posicion las siguientes.
+    // Los bloques anteriores a 'index' no se tocan; las celdas de los demas
+    // se vuelven a escribir en su nueva posicion.
+    void eliminar(bool esFila, size_t index) {
+        std::vector<std::pair<uint64_t, double>> movidas;
+        for (auto it = bloques.begin(); it != bloques.end();) {
+            size_t inicio = (esFila ? (it->first >> 32) : (it->first & 0xffffffffu)) * lado;
+            if (inicio + lado <= index) {
+                ++it;
+                continue;
+            }
+            size_t fila0 = (it->first >> 32) * lado;
+            size_t columna0 = (it->first & 0xffffffffu) * lado;
+            for (size_t i = 0; i < lado * lado; ++i) {
+                double valor = it->second.valores[i];
+                size_t fila = fila0 + i / lado;
+                size_t columna = columna0 + i % lado;
+                size_t& corrida = esFila ? fila : columna;
+                if (vacia(valor) || corrida == index) {
+                    continue;
+                }
+                if (corrida > index) {
+                    --corrida;
+                }
+                movidas.push_back({static_cast<uint64_t>(fila) << 32 | columna, valor});
+            }
+            it = bloques.erase(it);
+        }
+        for (const auto& movida : movidas) {
+            escribir(movida.first >> 32, movida.first & 0xffffffffu, movida.second);
+        }
+    }
+
+    // Corre una fila (o columna) vacia a la posicion 'index'; lo inverso de eliminar
+    void insertar(bool esFila, size_t index) {
+        std::vector<std::pair<uint64_t, double>> movidas;
+        for (auto it = bloques.begin(); it != bloques.end();) {
+            size_t inicio = (esFila ? (it->first >> 32) : (it->first & 0xffffffffu)) * lado;
+            if (inicio + lado <= index) {
+                ++it;
+                continue;
+            }
+            size_t fila0 = (it->first >> 32) * lado;
+            size_t columna0 = (it->first & 0xffffffffu) * lado;
+            for (size_t i = 0; i < lado * lado; ++i) {
+                double valor = it->second.valores[i];
+                size_t fila = fila0 + i / lado;
+                size_t columna = columna0 + i % lado;
+                size_t& corrida = esFila ? fila : columna;
+                if (vacia(valor)) {
+                    continue;
+                }
+                if (corrida >= index) {
+                    ++corrida;
+                }
+                movidas.push_back({static_cast<uint64_t>(fila) << 32 | columna, valor});
+            }
+            it = bloques.erase(it);
+        }
+        for (const auto& movida : movidas) {
+            escribir(movida.first >> 32, movida.first & 0xffffffffu, movida.second);
+        }
+    }
+
+    // Mueve cada fila a destino[fila]; destino es una permutacion de las filas
+    void permutarFilas(const std::vector<uint32_t>& destino) {
+        std::vector<std::pair<uint64_t, double>> movidas;
+        recorrer([&](size_t fila, size_t columna, double valor) {
+            movidas.push_back({static_cast<uint64_t>(destino[fila]) << 32 | columna, valor});
+        });
+        bloques.clear();
+        for (const auto& movida : movidas) {
+            escribir(movida.first >> 32, movida.first & 0xffffffffu, movida.second);
+        }
+    }
+
+    void limpiar() {
+        bloques.clear();
+    }
+
+    size_t cantidadBloques() const {
+        return bloques.size();
+    }
+
+    size_t bytes() const {
+        return bloques.size() * (sizeof(Bloque) + sizeof(uint64_t) + lado * lado * sizeof(double));
+    }
+
+private:
+    struct Bloque {
+        std::pmr::vector<double> valores;
+        size_t ocupadas;
+    };
+    std::pmr::memory_resource* memoria;
+    std::pmr::unordered_map<uint64_t, Bloque> bloques;
+
+    // -0.0 cuenta como ocupada para que se vuelva a escribir igual
+    static bool vacia(double valor) {
+        return valor == 0.0 && !std::signbit(valor);
+    }
+
+    static uint64_t claveBloque(size_t fila, size_t columna) {
+        return static_cast<uint64_t>(fila / lado) << 32 | (columna / lado);
+    }
+
+    static size_t indice(size_t fila, size_t columna) {
+        return (fila % lado) * lado + columna % lado;
+    }
+};
+
+enum class TipoIndiceSumas { Ninguno, Tabla, Fenwick };
+
+// Indice de sumas sobre las posiciones logicas de la hoja, con cada columna
+// por separado: un rectangulo es la suma, columna por columna, de la
+// diferencia de dos prefijos. Asi una columna de valores enormes (marcas de
+// tiempo, un 1e300) no se come los decimales de las demas. Cada prefijo
+// lleva su termino de compensacion (suma de Neumaier, como Acumulado) para
+// que la diferencia de dos prefijos grandes conserve lo que sumaron las
+// celdas chicas de la misma columna. La tabla de prefijos responde un
+// rectangulo en O(columnas) pero un cambio obliga a reconstruirla; el arbol
+// de Fenwick responde en O(columnas log n) y absorbe cada cambio de celda
+// en O(log n). Los valores no finitos (NaN de una formula con error,
+// infinitos) se guardan como 0 y se cuentan, para que quien consulte sepa
+// que no puede fiarse del indice.
+//
+// Como el bloque de la hoja, el indice guarda las filas en ranuras y lleva
+// un indice logico -> ranura: una fila eliminada se resta y deja su ranura
+// en 0 (un hueco), una agregada ocupa una ranura nueva al final y al
+// deshacer una eliminacion la fila vuelve a su hueco. Las columnas tambien
+// van en ranuras, pero sin orden entre ellas: eliminar una solo la saca del
+// indice logico y devolverla arma una ranura nueva con sus valores.
+class IndiceSumas {
+public:
+    // leerFila(fila, destino) copia las 'columnas' celdas de la fila
+    template <typename LeerFila>
+    void construir(TipoIndiceSumas nuevo, size_t filas, size_t columnas, LeerFila leerFila) {
+        tipo = nuevo;
+        numFilas = filas;
+        numColumnas = columnas;
+        noFinitas = 0;
+        alto = filas + 1;
+        ranurasFilas.resize(filas);
+        std::iota(ranurasFilas.begin(), ranurasFilas.end(), size_t(0));
+        ranurasColumnas.resize(columnas);
+        std::iota(ranurasColumnas.begin(), ranurasColumnas.end(), size_t(0));
+        sumas.assign(columnas * alto, 0.0);
+        compensaciones.assign(columnas * alto, 0.0);
+        std::vector<double> linea(columnas);
+        for (size_t fila = 0; fila < filas; ++fila) {
+            leerFila(fila, linea.data());
+            for (size_t col = 0; col < columnas; ++col) {
+                sumas[col * alto + fila + 1] = limpiar(linea[col]);
+            }
+        }
+        for (size_t col = 0; col < columnas; ++col) {
+            acumularColumna(col * alto);
+        }
+    }
+
+    // Solo para el arbol de Fenwick: la celda paso de 'anterior' a 'nuevo'.
+    // Se resta uno y se suma el otro: la diferencia entre los dos podria
+    // perder al mas chico.
+    void cambiar(size_t fila, size_t columna, double anterior, double nuevo) {
+        double viejo = desecharNoFinita(anterior);
+        double valor = limpiar(nuevo);
+        if (viejo == valor) {
+            return;
+        }
+        size_t base = ranurasColumnas[columna] * alto;
+        size_t ranura = ranurasFilas[fila];
+        if (viejo != 0.0) {
+            sumarDesde(base, ranura, -viejo);
+        }
+        if (valor != 0.0) {
+            sumarDesde(base, ranura, valor);
+        }
+    }
+
+    // Una fila de ceros al final: las sumas no cambian
+    void agregarFila() {
+        size_t i = ++numFilas;
+        if (i >= alto) {
+            // Se deja lugar para las filas que vengan despues
+            size_t nuevoAlto = std::max<size_t>(2 * alto, i + 1);
+            for (std::vector<double>* datos : {&sumas, &compensaciones}) {
+                std::vector<double> nuevos(numColumnas * nuevoAlto, 0.0);
+                for (size_t col = 0; col < numColumnas; ++col) {
+                    std::copy_n(datos->data() + col * alto, i, nuevos.data() + col * nuevoAlto);
+                }
+                datos->swap(nuevos);
+            }
+            alto = nuevoAlto;
+        }
+        for (size_t base = 0; base < numColumnas * alto; base += alto) {
+            sumas[base + i] = 0.0;
+            compensaciones[base + i] = 0.0;
+            if (tipo == TipoIndiceSumas::Tabla) {
+                sumas[base + i] = sumas[base + i - 1];
+                compensaciones[base + i] = compensaciones[base + i - 1];
+            } else {
+                // El nodo nuevo es la suma de sus hijos, que ya estan en el arbol
+                for (size_t k = i - 1; k > i - (i & (~i + 1)); k -= k & (~k + 1)) {
+                    sumar(base + i, sumas[base + k]);
+                    compensaciones[base + i] += compensaciones[base + k];
+                }
+            }
+        }
+        ranurasFilas.push_back(i - 1);
+    }
+
+    // Una columna de ceros: una ranura nueva, toda en 0
+    void agregarColumna() {
+        ranurasColumnas.push_back(numColumnas++);
+        sumas.resize(numColumnas * alto, 0.0);
+        compensaciones.resize(numColumnas * alto, 0.0);
+    }
+
+    // 'linea' son las celdas de la fila que se va. Devuelve falso cuando
+    // los huecos ya superan a las filas: conviene reconstruir el indice.
+    bool eliminarFila(size_t fila, const double* linea) {
+        size_t ranura = ranurasFilas[fila];
+        for (size_t col = 0; col < ranurasColumnas.size(); ++col) {
+            double valor = desecharNoFinita(linea[col]);
+            if (valor != 0.0) {
+                sumarDesde(ranurasColumnas[col] * alto, ranura, -valor);
+            }
+        }
+        ranurasFilas.erase(ranurasFilas.begin() + fila);
+        return numFilas - ranurasFilas.size() <= ranurasFilas.size();
+    }
+
+    // La ranura de la columna queda sin usar; solo se descuentan sus no finitos
+    bool eliminarColumna(size_t columna, const double* linea) {
+        for (size_t fila = 0; fila < ranurasFilas.size(); ++fila) {
+            desecharNoFinita(linea[fila]);
+        }
+        ranurasColumnas.erase(ranurasColumnas.begin() + columna);
+        return numColumnas - ranurasColumnas.size() <= ranurasColumnas.size();
+    }
+
+    // Devuelve una fila eliminada a 'fila'. Falso si entre sus vecinas ya
+    // no queda un hueco donde ponerla (el indice se reconstruyo despues).
+    bool insertarFila(size_t fila, const double* linea) {
+        size_t siguiente = fila < ranurasFilas.size() ? ranurasFilas[fila] : numFilas;
+        size_t anterior = fila > 0 ? ranurasFilas[fila - 1] + 1 : 0;
+        if (siguiente == anterior) {
+            return false;
+        }
+        ranurasFilas.insert(ranurasFilas.begin() + fila, siguiente - 1);
+        for (size_t col = 0; col < ranurasColumnas.size(); ++col) {
+            double valor = limpiar(linea[col]);
+            if (valor != 0.0) {
+                sumarDesde(ranurasColumnas[col] * alto, siguiente - 1, valor);
+            }
+        }
+        return true;
+    }
+
+    // Devuelve una columna eliminada a 'columna', en una ranura nueva
+    void insertarColumna(size_t columna, const double* linea) {
+        size_t base = numColumnas * alto;
+        agregarColumna();
+        ranurasColumnas.pop_back();
+        ranurasColumnas.insert(ranurasColumnas.begin() + columna, numColumnas - 1);
+        for (size_t fila = 0; fila < ranurasFilas.size(); ++fila) {
+            sumas[base + ranurasFilas[fila] + 1] = limpiar(linea[fila]);
+        }
+        acumularColumna(base);
+    }
+
+    // Suma del rectangulo, con las esquinas ya ordenadas y dentro de la hoja.
+    // Las ranuras intermedias que no estan en la hoja son huecos en 0.
+    double suma(size_t fila1, size_t columna1, size_t fila2, size_t columna2) const {
+        size_t desde = ranurasFilas[fila1];
+        size_t hasta = ranurasFilas[fila2] + 1;
+        double total = 0.0;
+        double compensacion = 0.0;
+        for (size_t col = columna1; col <= columna2; ++col) {
+            size_t base = ranurasColumnas[col] * alto;
+            double arriba = 0.0;
+            double restoArriba = 0.0;
+            double abajo = 0.0;
+            double restoAbajo = 0.0;
+            prefijo(base, desde, arriba, restoArriba);
+            prefijo(base, hasta, abajo, restoAbajo);
+            sumarNeumaier(total, compensacion, abajo);
+            sumarNeumaier(total, compensacion, -arriba);
+            compensacion += restoAbajo - restoArriba;
+        }
+        return total + compensacion;
+    }
+
+    size_t cantidadNoFinitas() const {
+        return noFinitas;
+    }
+
+    size_t bytes() const {
+        return (sumas.capacity() + compensaciones.capacity()) * sizeof(double)
+             + (ranurasFilas.capacity() + ranurasColumnas.capacity()) * sizeof(size_t);
+    }
+
+private:
+    TipoIndiceSumas tipo = TipoIndiceSumas::Ninguno;
+    size_t numFilas = 0;    // ranuras, contando los huecos
+    size_t numColumnas = 0;
+    size_t alto = 1;        // posiciones por columna: las ranuras mas el 0 y la holgura
+    size_t noFinitas = 0;
+    // Por columnas: el prefijo (o nodo) i de la ranura c esta en c * alto + i
+    std::vector<double> sumas;
+    std::vector<double> compensaciones;
+    std::vector<size_t> ranurasFilas;    // logica -> ranura, en orden creciente
+    std::vector<size_t> ranurasColumnas; // logica -> ranura, en cualquier orden
+
+    static void sumarNeumaier(double& suma, double& compensacion, double valor) {
+        double t = suma + valor;
+        compensacion += (std::fabs(suma) >= std::fabs(valor)) ? (suma - t) + valor : (valor - t) + suma;
+        suma = t;
+    }
+
+    void sumar(size_t posicion, double valor) {
+        sumarNeumaier(sumas[posicion], compensaciones[posicion], valor);
+    }
+
+    // Con los valores de la columna en sumas[base + 1 ...] arma sus prefijos
+    // o, en el arbol, sus nodos (cada uno le pasa su total a su padre)
+    void acumularColumna(size_t base) {
+        for (size_t i = 1; i <= numFilas; ++i) {
+            if (tipo == TipoIndiceSumas::Tabla) {
+                double valor = sumas[base + i];
+                sumas[base + i] = sumas[base + i - 1];
+                compensaciones[base + i] = compensaciones[base + i - 1];
+                sumar(base + i, valor);
+            } else {
+                size_t padre = i + (i & (~i + 1));
+                if (padre <= numFilas) {
+                    sumar(base + padre, sumas[base + i]);
+                    compensaciones[base + padre] += compensaciones[base + i];
+                }
+            }
+        }
+    }
+
+    // Suma 'valor' a la celda de la ranura de fila 'ranura' en la columna 'base'
+    void sumarDesde(size_t base, size_t ranura, double valor) {
+        if (tipo == TipoIndiceSumas::Tabla) {
+            for (size_t i = ranura + 1; i <= numFilas; ++i) {
+                sumar(base + i, valor);
+            }
+            return;
+        }
+        for (size_t i = ranura + 1; i <= numFilas; i += i & (~i + 1)) {
+            sumar(base + i, valor);
+        }
+    }
+
+    double limpiar(double valor) {
+        if (std::isfinite(valor)) {
+            return valor;
+        }
+        ++noFinitas;
+        return 0.0;
+    }
+
+    double desecharNoFinita(double valor) {
+        if (std::isfinite(valor)) {
+            return valor;
+        }
+        --noFinitas;
+        return 0.0;
+    }
+
+    // Suma de las celdas de la columna en las ranuras < filas
+    void prefijo(size_t base, size_t filas, double& suma, double& compensacion) const {
+        if (tipo == TipoIndiceSumas::Tabla) {
+            suma = sumas[base + filas];
+            compensacion = compensaciones[base + filas];
+            return;
+        }
+        for (size_t i = filas; i > 0; i -= i & (~i + 1)) {
+            sumarNeumaier(suma, compensacion, sumas[base + i]);
+            compensacion += compensaciones[base + i];
+        }
+    }
+};
+
+// Indice secundario de una columna: que filas tienen cada valor. El de hash
+// responde igualdades en O(1) por fila encontrada; el ordenado responde
+// igualdades y rangos en O(log n) mas las filas encontradas. Los NaN no se
+// guardan (nunca son iguales a nada ni caen en un rango) y -0.0 se guarda
+// como 0.0. Cada cambio de celda se absorbe en O(1) (hash) u O(log n)
+// (ordenado); agregar o quitar una fila corre las siguientes en O(n).
+class IndiceColumna {
+public:
+    explicit IndiceColumna(TipoIndiceColumna tipo = TipoIndiceColumna::Hash) : tipo(tipo) {}
+
+    TipoIndiceColumna obtenerTipo() const {
+        return tipo;
+    }
+
+    // leerColumna(desde, largo, destino) copia 'largo' celdas de la columna
+    template <typename LeerColumna>
+    void construir(size_t filas, LeerColumna leerColumna) {
+        primera.clear();
+        ordenado.clear();
+        cantidadFilas = filas;
+        bool hash = tipo == TipoIndiceColumna::Hash;
+        siguiente.assign(hash ? filas : 0, ninguna);
+        anterior.assign(hash ? filas : 0, ninguna);
+        if (hash) {
+            primera.reserve(filas / 2);
+        }
+        std::vector<Par> pares;
+        std::vector<double> tramo(std::min<size_t>(filas, 4096));
+        for (size_t desde = 0; desde < filas; desde += tramo.size()) {
+            size_t largo = std::min(tramo.size(), filas - desde);
+            leerColumna(desde, largo, tramo.data());
+            for (size_t i = 0; i < largo; ++i) {
+                if (hash) {
+                    agregar(desde + i, tramo[i]);
+                } else if (tramo[i] == tramo[i]) {
+                    pares.push_back({tramo[i] + 0.0, static_cast<uint32_t>(desde + i)});
+                }
+            }
+        }
+        // Con la entrada ya ordenada el conjunto se arma en tiempo lineal
+        std::sort(pares.begin(), pares.end());
+        ordenado.insert(pares.begin(), pares.end());
+    }
+
+    void cambiar(size_t fila, double previo, double nuevo) {
+        if (previo == nuevo || (previo != previo && nuevo != nuevo)) {
+            return;
+        }
+        quitar(fila, previo);
+        agregar(fila, nuevo);
+    }
+
+    // Una fila nueva en 'index' con 'valor'; las siguientes se corren una
+    // posicion. Al final no hay nada que correr.
+    void insertarFila(size_t index, double valor) {
+        if (tipo == TipoIndiceColumna::Hash) {
+            if (index < cantidadFilas) {
+                correr(index, 1);
+            }
+            siguiente.insert(siguiente.begin() + index, ninguna);
+            anterior.insert(anterior.begin() + index, ninguna);
+        } else if (index < cantidadFilas) {
+            std::set<Par> corrido;
+            for (const Par& par : ordenado) {
+                corrido.emplace_hint(corrido.end(), par.first, par.second + (par.second >= index));
+            }
+            ordenado.swap(corrido);
+        }
+        ++cantidadFilas;
+        agregar(index, valor);
+    }
+
+    // Quita la fila 'index', que tenia 'valor', y corre las siguientes
+    void eliminarFila(size_t index, double valor) {
+        quitar(index, valor);
+        --cantidadFilas;
+        if (tipo == TipoIndiceColumna::Hash) {
+            siguiente.erase(siguiente.begin() + index);
+            anterior.erase(anterior.begin() + index);
+            if (index < cantidadFilas) {
+                correr(index + 1, -1);
+            }
+        } else if (index < cantidadFilas) {
+            std::set<Par> corrido;
+            for (const Par& par : ordenado) {
+                corrido.emplace_hint(corrido.end(), par.first, par.second - (par.second > index));
+            }
+            ordenado.swap(corrido);
+        }
+    }
+
+    // La fila f paso a ser la fila destino[f]
+    void permutar(const std::vector<uint32_t>& destino) {
+        if (tipo == TipoIndiceColumna::Hash) {
+            auto mover = [&](uint32_t fila) { return fila == ninguna ? ninguna : destino[fila]; };
+            std::vector<uint32_t> nuevaSiguiente(cantidadFilas);
+            std::vector<uint32_t> nuevaAnterior(cantidadFilas);
+            for (size_t fila = 0; fila < cantidadFilas; ++fila) {
+                nuevaSiguiente[destino[fila]] = mover(siguiente[fila]);
+                nuevaAnterior[destino[fila]] = mover(anterior[fila]);
+            }
+            siguiente.swap(nuevaSiguiente);
+            anterior.swap(nuevaAnterior);
+            for (auto& entrada : primera) {
+                entrada.second = destino[entrada.second];
+            }
+        } else {
+            std::vector<Par> pares;
+            pares.reserve(ordenado.size());
+            for (const Par& par : ordenado) {
+                pares.push_back({par.first, destino[par.second]});
+            }
+            std::sort(pares.begin(), pares.end());
+            ordenado = std::set<Par>(pares.begin(), pares.end());
+        }
+    }
+
+    // Agrega a 'filas' las que tienen exactamente 'valor', sin un orden en particular
+    void buscar(double valor, std::vector<size_t>& filas) const {
+        if (valor != valor) {
+            return;
+        }
+        valor += 0.0;
+        if (tipo == TipoIndiceColumna::Hash) {
+            auto encontrada = primera.find(valor);
+            for (uint32_t fila = encontrada == primera.end() ? ninguna : encontrada->second; fila != ninguna; fila = siguiente[fila]) {
+                filas.push_back(fila);
+            }
+        } else {
+            for (auto it = ordenado.lower_bound({valor, 0}); it != ordenado.end() && it->first == valor; ++it) {
+                filas.push_back(it->second);
+            }
+        }
+    }
+
+    // Solo el ordenado: agrega las filas con desde <= valor <= hasta
+    void buscarEntre(double desde, double hasta, std::vector<size_t>& filas) const {
+        if (!(desde <= hasta)) {
+            return;
+        }
+        for (auto it = ordenado.lower_bound({desde + 0.0, 0}); it != ordenado.end() && it->first <= hasta; ++it) {
+            filas.push_back(it->second);
+        }
+    }
+
+    // Aproximados: cada nodo de las tablas se cuenta con dos o cuatro punteros de mas
+    size_t bytes() const {
+        if (tipo == TipoIndiceColumna::Ordenado) {
+            return ordenado.size() * (sizeof(Par) + 4 * sizeof(void*));
+        }
+        return primera.bucket_count() * sizeof(void*) + primera.size() * (sizeof(Par) + 2 * sizeof(void*)) +
+               (siguiente.capacity() + anterior.capacity()) * sizeof(uint32_t);
+    }
+
+private:
+    using Par = std::pair<double, uint32_t>;
+    static constexpr uint32_t ninguna = std::numeric_limits<uint32_t>::max();
+    TipoIndiceColumna tipo;
+    size_t cantidadFilas = 0;
+    // Hash: la primera fila de cada valor y una lista doble por valor
+    // enlazada a traves de las filas, asi agregar y quitar una fila no piden
+    // memoria por fila
+    std::unordered_map<double, uint32_t> primera;
+    std::vector<uint32_t> siguiente;
+    std::vector<uint32_t> anterior;
+    // Ordenado: (valor, fila)
+    std::set<Par> ordenado;
+
+    void agregar(size_t fila, double valor) {
+        if (valor != valor) {
+            return;
+        }
+        uint32_t propia = static_cast<uint32_t>(fila);
+        if (tipo == TipoIndiceColumna::Hash) {
+            auto [entrada, nueva] = primera.try_emplace(valor + 0.0, propia);
+            anterior[fila] = ninguna;
+            siguiente[fila] = nueva ? ninguna : entrada->second;
+            if (!nueva) {
+                anterior[entrada->second] = propia;
+                entrada->second = propia;
+            }
+        } else {
+            ordenado.emplace(valor + 0.0, propia);
+        }
+    }
+
+    void quitar(size_t fila, double valor) {
+        if (valor != valor) {
+            return;
+        }
+        if (tipo == TipoIndiceColumna::Hash) {
+            uint32_t antes = anterior[fila];
+            uint32_t despues = siguiente[fila];
+            if (antes != ninguna) {
+                siguiente[antes] = despues;
+            } else if (despues != ninguna) {
+                primera[valor + 0.0] = despues;
+            } else {
+                primera.erase(valor + 0.0);
+            }
+            if (despues != ninguna) {
+                anterior[despues] = antes;
+            }
+        } else {
+            ordenado.erase({valor + 0.0, static_cast<uint32_t>(fila)});
+        }
+    }
+
+    // Suma 'delta' a todas las referencias a filas >= desde
+    void correr(size_t desde, int delta) {
+        auto ajustar = [&](uint32_t& fila) {
+            if (fila != ninguna && fila >= desde) {
+                fila += delta;
+            }
+        };
+        std::for_each(siguiente.begin(), siguiente.end(), ajustar);
+        std::for_each(anterior.begin(), anterior.end(), ajustar);
+        for (auto& entrada : primera) {
+            ajustar(entrada.second);
+        }
+    }
+};
+
+// Tabla de hash de claves compuestas (varias columnas) a grupos numerados
+// en orden de aparicion, con direccionamiento abierto. Las claves son los
+// bits de los valores: 0.0 y -0.0 son la misma, y todos los NaN tambien.
+class TablaGrupos {
+public:
+    explicit TablaGrupos(size_t ancho) : ancho(ancho), casillas(64, 0) {}
+
+    static uint64_t bits(double valor) {
+        if (valor != valor) {
+            return 0x7ff8000000000000ULL;
+        }
+        valor += 0.0;
+        uint64_t resultado;
+        std::memcpy(&resultado, &valor, sizeof(resultado));
+        return resultado;
+    }
+
+    static double valor(uint64_t bits) {
+        double resultado;
+        std::memcpy(&resultado, &bits, sizeof(resultado));
+        return resultado;
+    }
+
+    // Los bits bajos de un double suelen ser ceros (enteros, valores
+    // redondeados): cada valor pasa por el mezclador de splitmix64, asi
+    // todos sus bits llegan a los bajos, que eligen la casilla
+    uint64_t hashDe(const uint64_t* clave) const {
+        uint64_t h = 0;
+        for (size_t i = 0; i < ancho; ++i) {
+            h = h * 0x9E3779B97F4A7C15ULL ^ clave[i];
+            h ^= h >> 30;
+            h *= 0xBF58476D1CE4E5B9ULL;
+            h ^= h >> 27;
+            h *= 0x94D049BB133111EBULL;
+            h ^= h >> 31;
+        }
+        return h;
+    }
+
+    // El grupo de la clave; si no estaba se agrega con el numero siguiente
+    size_t grupo(const uint64_t* clave, uint64_t hash) {
+        size_t mascara = casillas.size() - 1;
+        for (size_t i = hash & mascara;; i = (i + 1) & mascara) {
+            uint32_t casilla = casillas[i];
+            if (casilla == 0) {
+                // Se agranda al llegar a la mitad, asi las busquedas son cortas
+                if (2 * (hashes.size() + 1) > casillas.size()) {
+                    agrandar();
+                    return grupo(clave, hash);
+                }
+                casillas[i] = static_cast<uint32_t>(hashes.size() + 1);
+                hashes.push_back(hash);
+                claves.insert(claves.end(), clave, clave + ancho);
+                return hashes.size() - 1;
+            }
+            size_t encontrado = casilla - 1;
+            if (hashes[encontrado] == hash && std::equal(clave, clave + ancho, claves.data() + encontrado * ancho)) {
+                return encontrado;
+            }
+        }
+    }
+
+    size_t cantidad() const {
+        return hashes.size();
+    }
+
+    const uint64_t* clave(size_t grupo) const {
+        return claves.data() + grupo * ancho;
+    }
+
+    uint64_t hash(size_t grupo) const {
+        return hashes[grupo];
+    }
+
+private:
+    size_t ancho;
+    // Numero de grupo + 1 por casilla; 0 es una casilla libre
+    std::vector<uint32_t> casillas;
+    std::vector<uint64_t> hashes;
+    std::vector<uint64_t> claves;
+
+    void agrandar() {
+        casillas.assign(casillas.size() * 2, 0);
+        size_t mascara = casillas.size() - 1;
+        for (size_t g = 0; g < hashes.size(); ++g) {
+            size_t i = hashes[g] & mascara;
+            while (casillas[i] != 0) {
+                i = (i + 1) & mascara;
+            }
+            casillas[i] = static_cast<uint32_t>(g + 1);
+        }
+    }
+};
+
+// Una columna de la hoja guardada con la codificacion que ocupe menos:
+//  - Diccionario: hasta 64K valores distintos, cada celda es un codigo de
+//    los bits justos para el diccionario.
+//  - Referencia: enteros exactos (|v| < 2^53). Cada bloque guarda su minimo
+//    y los desplazamientos, o el primer valor y las diferencias con el
+//    anterior menos la menor (lo que de menos bits); asi una columna que solo
+//    crece, como una marca de tiempo, ocupa unos pocos bits por celda.
+//  - Xor: cada valor se guarda como el xor con el anterior, sin los ceros de
+//    los extremos (como en Gorilla); sirve para medidas que cambian poco.
+//  - Cruda: los double tal cual, si nada de lo anterior ocupa menos.
+// Todas son sin perdida, bit a bit. Cada bloque de 512 filas lleva ademas
+// su Acumulado, asi las estadisticas de rango usan los bloques enteros sin
+// descomprimirlos. Escribir una celda deja la columna cruda y marca viejo
+// el resumen de su bloque, que se vuelve a calcular al pedirlo. Referencia
+// con diferencias y Xor se leen en orden: los bloques leidos quedan en una
+// cache por hilo (ver bloqueEnCache) con lugar para al menos dos bloques por
+// columna de la hoja mas ancha que se leyo.
+class ColumnaComprimida {
+public:
+    static constexpr size_t bloque = 512;
+
+    ColumnaComprimida() = default;
+
+    // 'columnas' es la cantidad de columnas de la hoja, para dimensionar la cache de bloques
+    ColumnaComprimida(const double* valores, size_t filas, size_t columnas)
+        : filas(filas), id(++siguienteId), columnasHoja(columnas) {
+        size_t bloques = (filas + bloque - 1) / bloque;
+        resumenes.resize(bloques);
+        for (size_t b = 0; b < bloques; ++b) {
+            resumenes[b] = acumularContiguo(valores + b * bloque, std::min(bloque, filas - b * bloque));
+        }
+        // Se prueban todas y queda la mas chica
+        size_t mejor = filas * sizeof(double);
+        ColumnaComprimida candidata;
+        if (codificarDiccionario(valores, candidata) && candidata.bytesDatos() < mejor) {
+            mejor = candidata.bytesDatos();
+            tomarDatos(candidata);
+        }
+        candidata = ColumnaComprimida();
+        if (codificarReferencia(valores, candidata) && candidata.bytesDatos() < mejor) {
+            mejor = candidata.bytesDatos();
+            tomarDatos(candidata);
+        }
+        candidata = ColumnaComprimida();
+        codificarXor(valores, candidata);
+        if (candidata.bytesDatos() < mejor) {
+            tomarDatos(candidata);
+        }
+        if (codificacion == CodificacionColumna::Cruda) {
+            crudos.assign(valores, valores + filas);
+        }
+    }
+
+    CodificacionColumna obtenerCodificacion() const {
+        return codificacion;
+    }
+
+    size_t cantidad() const {
+        return filas;
+    }
+
+    bool escrita() const {
+        return !viejos.empty();
+    }
+
+    size_t bytes() const {
+        return bytesDatos() + resumenes.size() * sizeof(Acumulado);
+    }
+
+    double leer(size_t fila) const {
+        size_t b = fila / bloque;
+        switch (codificacion) {
+            case CodificacionColumna::Cruda:
+                return crudos[fila];
+            case CodificacionColumna::Diccionario:
+                return diccionario[leerBits(fila * ancho, ancho)];
+            case CodificacionColumna::Referencia:
+                if (!bloques[b].diferencias) {
+                    return static_cast<double>(bloques[b].base + static_cast<int64_t>(leerBits(bloques[b].inicio + (fila % bloque) * bloques[b].ancho, bloques[b].ancho)));
+                }
+                break;
+            case CodificacionColumna::Xor:
+                break;
+        }
+        return bloqueEnCache(b)[fila % bloque];
+    }
+
+    // Copia las filas [desde, desde + largo) a 'destino'
+    void copiar(size_t desde, size_t largo, double* destino) const {
+        size_t hasta = desde + largo;
+        while (desde < hasta) {
+            size_t b = desde / bloque;
+            size_t inicio = b * bloque;
+            size_t fin = std::min({inicio + bloque, filas, hasta});
+            if (codificacion == CodificacionColumna::Cruda) {
+                std::copy(crudos.begin() + desde, crudos.begin() + fin, destino);
+            } else if (desde == inicio && fin == std::min(inicio + bloque, filas)) {
+                decodificar(b, destino);
+            } else {
+                const double* valores = bloqueEnCache(b);
+                std::copy(valores + (desde - inicio), valores + (fin - inicio), destino);
+            }
+            destino += fin - desde;
+            desde = fin;
+        }
+    }
+
+    // Pasa la columna a cruda si no lo estaba y cambia el valor de la fila
+    void escribir(size_t fila, double valor) {
+        if (codificacion != CodificacionColumna::Cruda) {
+            std::vector<double> valores(filas);
+            copiar(0, filas, valores.data());
+            crudos.swap(valores);
+            codificacion = CodificacionColumna::Cruda;
+            std::vector<uint64_t>().swap(bits);
+            std::vector<double>().swap(diccionario);
+            std::vector<Bloque>().swap(bloques);
+        }
+        crudos[fila] = valor;
+        if (viejos.empty()) {
+            viejos.resize(resumenes.size());
+        }
+        viejos[fila / bloque] = true;
+    }
+
+    // Resumen de las filas [desde, hasta): los bloques enteros ya lo tienen
+    Acumulado acumular(size_t desde, size_t hasta) const {
+        Acumulado total;
+        std::array<double, bloque> valores;
+        while (desde < hasta) {
+            size_t b = desde / bloque;
+            size_t inicio = b * bloque;
+            size_t finBloque = std::min(inicio + bloque, filas);
+            size_t fin = std::min(finBloque, hasta);
+            if (desde == inicio && fin == finBloque && (viejos.empty() || !viejos[b])) {
+                total.unir(resumenes[b]);
+            } else {
+                copiar(desde, fin - desde, valores.data());
+                total.unir(acumularContiguo(valores.data(), fin - desde));
+            }
+            desde = fin;
+        }
+        return total;
+    }
+
+private:
+    struct Bloque {
+        uint64_t inicio = 0;
+        // Referencia: minimo, o menor diferencia si 'diferencias'
+        int64_t base = 0;
+        int64_t primero = 0;
+        unsigned char ancho = 0;
+        bool diferencias = false;
+    };
+
+    static inline std::atomic<uint64_t> siguienteId{0};
+    // Cache de bloques: conjuntos de 4 vias de 4 KB por entrada. Crece hasta
+    // 4096 conjuntos (64 MB por hilo); con hojas mas anchas, leer por filas
+    // vuelve a decodificar algunos bloques.
+    static const size_t viasCache = 4;
+    static const size_t maximoConjuntos = 4096;
+
+    CodificacionColumna codificacion = CodificacionColumna::Cruda;
+    size_t filas = 0;
+    uint64_t id = 0;
+    size_t columnasHoja = 0;
+    // Ancho de los codigos del diccionario
+    unsigned ancho = 0;
+    // Flujo de bits, con una palabra de sobra al final para leer de a dos
+    std::vector<uint64_t> bits;
+    std::vector<double> diccionario;
+    std::vector<Bloque> bloques;
+    std::vector<double> crudos;
+    std::vector<Acumulado> resumenes;
+    // Bloques con alguna celda escrita despues de comprimir
+    std::vector<bool> viejos;
+
+    size_t bytesDatos() const {
+        return bits.size() * sizeof(uint64_t) + diccionario.size() * sizeof(double) +
+               bloques.size() * sizeof(Bloque) + crudos.size() * sizeof(double);
+    }
+
+    void tomarDatos(ColumnaComprimida& otra) {
+        codificacion = otra.codificacion;
+        ancho = otra.ancho;
+        bits.swap(otra.bits);
+        diccionario.swap(otra.diccionario);
+        bloques.swap(otra.bloques);
+    }
+
+    // Ceros a la izquierda y a la derecha de un valor distinto de cero
+    static unsigned cerosIzquierda(uint64_t valor) {
+#if defined(__GNUC__)
+        return static_cast<unsigned>(__builtin_clzll(valor));
+#else
+        unsigned ceros = 0;
+        while (!(valor & (uint64_t(1) << 63))) {
+            valor <<= 1;
+            ++ceros;
+        }
+        return ceros;
+#endif
+    }
+
+    static unsigned cerosDerecha(uint64_t valor) {
+#if defined(__GNUC__)
+        return static_cast<unsigned>(__builtin_ctzll(valor));
+#else
+        unsigned ceros = 0;
+        while (!(valor & 1)) {
+            valor >>= 1;
+            ++ceros;
+        }
+        return ceros;
+#endif
+    }
+
+    static unsigned bitsPara(uint64_t valor) {
+        return valor == 0 ? 0 : 64 - cerosIzquierda(valor);
+    }
+
+    static void ponerBits(std::vector<uint64_t>& destino, uint64_t& posicion, uint64_t valor, unsigned cuantos) {
+        if (cuantos == 0) {
+            return;
+        }
+        size_t palabra = posicion >> 6;
+        unsigned corrimiento = posicion & 63;
+        if (palabra + 2 > destino.size()) {
+            destino.resize(std::max(palabra + 2, destino.size() * 2), 0);
+        }
+        destino[palabra] |= valor << corrimiento;
+        if (corrimiento + cuantos > 64) {
+            destino[palabra + 1] |= valor >> (64 - corrimiento);
+        }
+        posicion += cuantos;
+    }
+
+    static void cerrarBits(std::vector<uint64_t>& destino, uint64_t posicion) {
+        destino.resize((posicion + 63) / 64 + 1, 0);
+        destino.shrink_to_fit();
+    }
+
+    uint64_t leerBits(uint64_t posicion, unsigned cuantos) const {
+        if (cuantos == 0) {
+            return 0;
+        }
+        size_t palabra = posicion >> 6;
+        unsigned corrimiento = posicion & 63;
+        uint64_t valor = bits[palabra] >> corrimiento;
+        if (corrimiento + cuantos > 64) {
+            valor |= bits[palabra + 1] << (64 - corrimiento);
+        }
+        return cuantos == 64 ? valor : valor & ((uint64_t(1) << cuantos) - 1);
+    }
+
+    bool codificarDiccionario(const double* valores, ColumnaComprimida& destino) const {
+        const size_t maximo = 1 << 16;
+        std::unordered_map<uint64_t, uint32_t> codigos;
+        std::vector<uint32_t> asignados(filas);
+        for (size_t i = 0; i < filas; ++i) {
+            uint64_t clave;
+            std::memcpy(&clave, &valores[i], sizeof(clave));
+            auto [it, nuevo] = codigos.emplace(clave, static_cast<uint32_t>(codigos.size()));
+            if (nuevo) {
+                if (codigos.size() > maximo) {
+                    return false;
+                }
+                destino.diccionario.push_back(valores[i]);
+            }
+            asignados[i] = it->second;
+        }
+        destino.codificacion = CodificacionColumna::Diccionario;
+        destino.ancho = bitsPara(codigos.size() - (codigos.empty() ? 0 : 1));
+        uint64_t posicion = 0;
+        for (size_t i = 0; i < filas; ++i) {
+            ponerBits(destino.bits, posicion, asignados[i], destino.ancho);
+        }
+        cerrarBits(destino.bits, posicion);
+        return true;
+    }
+
+    bool codificarReferencia(const double* valores, ColumnaComprimida& destino) const {
+        const double limite = 9007199254740992.0;
+        std::vector<int64_t> enteros(filas);
+        for (size_t i = 0; i < filas; ++i) {
+            double valor = valores[i];
+            // -0.0 se perderia al pasar a entero
+            if (!(std::fabs(valor) < limite) || valor != std::trunc(valor) || (valor == 0.0 && std::signbit(valor))) {
+                return false;
+            }
+            enteros[i] = static_cast<int64_t>(valor);
+        }
+        destino.codificacion = CodificacionColumna::Referencia;
+        uint64_t posicion = 0;
+        for (size_t inicio = 0; inicio < filas; inicio += bloque) {
+            size_t fin = std::min(inicio + bloque, filas);
+            Bloque datos;
+            datos.inicio = posicion;
+            datos.primero = enteros[inicio];
+            auto [menor, mayor] = std::minmax_element(enteros.begin() + inicio, enteros.begin() + fin);
+            int64_t menorDiferencia = 0;
+            int64_t mayorDiferencia = 0;
+            for (size_t i = inicio + 1; i < fin; ++i) {
+                int64_t diferencia = enteros[i] - enteros[i - 1];
+                menorDiferencia = i == inicio + 1 ? diferencia : std::min(menorDiferencia, diferencia);
+                mayorDiferencia = i == inicio + 1 ? diferencia : std::max(mayorDiferencia, diferencia);
+            }
+            unsigned anchoValores = bitsPara(static_cast<uint64_t>(*mayor - *menor));
+            unsigned anchoDiferencias = bitsPara(static_cast<uint64_t>(mayorDiferencia - menorDiferencia));
+            datos.diferencias = anchoDiferencias < anchoValores;
+            if (datos.diferencias) {
+                datos.base = menorDiferencia;
+                datos.ancho = static_cast<unsigned char>(anchoDiferencias);
+                for (size_t i = inicio + 1; i < fin; ++i) {
+                    ponerBits(destino.bits, posicion, static_cast<uint64_t>(enteros[i] - enteros[i - 1] - menorDiferencia), datos.ancho);
+                }
+            } else {
+                datos.base = *menor;
+                datos.ancho = static_cast<unsigned char>(anchoValores);
+                for (size_t i = inicio; i < fin; ++i) {
+                    ponerBits(destino.bits, posicion, static_cast<uint64_t>(enteros[i] - *menor), datos.ancho);
+                }
+            }
+            destino.bloques.push_back(datos);
+        }
+        cerrarBits(destino.bits, posicion);
+        return true;
+    }
+
+    // Por cada valor: 0 si es igual al anterior; 10 y los bits significativos
+    // si caben en la ventana del anterior; 11, 5 bits de ceros a la izquierda,
+    // 6 del largo menos uno y los bits, si no.
+    void codificarXor(const double* valores, ColumnaComprimida& destino) const {
+        destino.codificacion = CodificacionColumna::Xor;
+        uint64_t posicion = 0;
+        for (size_t inicio = 0; inicio < filas; inicio += bloque) {
+            size_t fin = std::min(inicio + bloque, filas);
+            Bloque datos;
+            datos.inicio = posicion;
+            uint64_t anterior;
+            std::memcpy(&anterior, &valores[inicio], sizeof(anterior));
+            ponerBits(destino.bits, posicion, anterior, 64);
+            unsigned izquierda = 64;
+            unsigned derecha = 0;
+            for (size_t i = inicio + 1; i < fin; ++i) {
+                uint64_t actual;
+                std::memcpy(&actual, &valores[i], sizeof(actual));
+                uint64_t diferencia = actual ^ anterior;
+                anterior = actual;
+                if (diferencia == 0) {
+                    ponerBits(destino.bits, posicion, 0, 1);
+                    continue;
+                }
+                unsigned ceros = std::min(31u, cerosIzquierda(diferencia));
+                unsigned finales = cerosDerecha(diferencia);
+                if (izquierda < 64 && ceros >= izquierda && finales >= derecha) {
+                    ponerBits(destino.bits, posicion, 1, 2);
+                    ponerBits(destino.bits, posicion, diferencia >> derecha, 64 - izquierda - derecha);
+                } else {
+                    unsigned largo = 64 - ceros - finales;
+                    ponerBits(destino.bits, posicion, 3, 2);
+                    ponerBits(destino.bits, posicion, ceros, 5);
+                    ponerBits(destino.bits, posicion, largo - 1, 6);
+                    ponerBits(destino.bits, posicion, diferencia >> finales, largo);
+                    izquierda = ceros;
+                    derecha = finales;
+                }
+            }
+            destino.bloques.push_back(datos);
+        }
+        cerrarBits(destino.bits, posicion);
+    }
+
+    // Escribe las filas del bloque b en 'destino'
+    void decodificar(size_t b, double* destino) const {
+        size_t inicio = b * bloque;
+        size_t largo = std::min(bloque, filas - inicio);
+        switch (codificacion) {
+            case CodificacionColumna::Cruda:
+                std::copy_n(crudos.begin() + inicio, largo, destino);
+                break;
+            case CodificacionColumna::Diccionario:
+                for (size_t i = 0; i < largo; ++i) {
+                    destino[i] = diccionario[leerBits((inicio + i) * ancho, ancho)];
+                }
+                break;
+            case CodificacionColumna::Referencia: {
+                const Bloque& datos = bloques[b];
+                uint64_t posicion = datos.inicio;
+                if (datos.diferencias) {
+                    int64_t valor = datos.primero;
+                    destino[0] = static_cast<double>(valor);
+                    for (size_t i = 1; i < largo; ++i, posicion += datos.ancho) {
+                        valor += datos.base + static_cast<int64_t>(leerBits(posicion, datos.ancho));
+                        destino[i] = static_cast<double>(valor);
+                    }
+                } else {
+                    for (size_t i = 0; i < largo; ++i, posicion += datos.ancho) {
+                        destino[i] = static_cast<double>(datos.base + static_cast<int64_t>(leerBits(posicion, datos.ancho)));
+                    }
+                }
+                break;
+            }
+            case CodificacionColumna::Xor: {
+                uint64_t posicion = bloques[b].inicio;
+                uint64_t anterior = leerBits(posicion, 64);
+                posicion += 64;
+                std::memcpy(&destino[0], &anterior, sizeof(anterior));
+                unsigned izquierda = 0;
+                unsigned largoVentana = 0;
+                for (size_t i = 1; i < largo; ++i) {
+                    if (leerBits(posicion++, 1) != 0) {
+                        if (leerBits(posicion++, 1) != 0) {
+                            izquierda = static_cast<unsigned>(leerBits(posicion, 5));
+                            largoVentana = static_cast<unsigned>(leerBits(posicion + 5, 6)) + 1;
+                            posicion += 11;
+                        }
+                        anterior ^= leerBits(posicion, largoVentana) << (64 - izquierda - largoVentana);
+                        posicion += largoVentana;
+                    }
+                    std::memcpy(&destino[i], &anterior, sizeof(anterior));
+                }
+                break;
+            }
+        }
+    }
+
+    // El bloque b decodificado, desde la cache del hilo si ya estaba. Cada
+    // entrada se identifica por (id, bloque), asi no se confunden columnas
+    // de hojas distintas. Leer por filas pasa por todas las columnas antes de
+    // volver a la primera, asi que la cache crece hasta dos entradas por
+    // columna de la hoja: con menos, cada celda decodificaba un bloque entero.
+    // Los ids de una hoja son seguidos y van a conjuntos seguidos.
+    const double* bloqueEnCache(size_t b) const {
+        struct Entrada {
+            uint64_t id = 0;
+            size_t bloque = 0;
+            uint64_t uso = 0;
+            std::array<double, ColumnaComprimida::bloque> valores;
+        };
+        struct Cache {
+            std::vector<Entrada> entradas;
+            uint64_t reloj = 0;
+        };
+        thread_local Cache cache;
+        size_t conjuntos = 1;
+        while (conjuntos * viasCache < 2 * columnasHoja && conjuntos < maximoConjuntos) {
+            conjuntos *= 2;
+        }
+        if (cache.entradas.size() < conjuntos * viasCache) {
+            // Al crecer se empieza de cero: las entradas cambian de conjunto
+            cache.entradas.assign(conjuntos * viasCache, Entrada());
+        }
+        size_t mascara = cache.entradas.size() / viasCache - 1;
+        Entrada* conjunto = &cache.entradas[((id + b * 0x9e3779b1u) & mascara) * viasCache];
+        Entrada* elegida = conjunto;
+        for (size_t via = 0; via < viasCache; ++via) {
+            if (conjunto[via].id == id && conjunto[via].bloque == b) {
+                conjunto[via].uso = ++cache.reloj;
+                return conjunto[via].valores.data();
+            }
+            if (conjunto[via].uso < elegida->uso) {
+                elegida = &conjunto[via];
+            }
+        }
+        decodificar(b, elegida->valores.data());
+        elegida->id = id;
+        elegida->bloque = b;
+        elegida->uso = ++cache.reloj;
+        return elegida->valores.data();
+    }
+};
+
+// Operaciones publicas de HojaCalculo que lleva la instrumentacion
+enum class Operacion {
+    CargarCSV,
+    GuardarCSV,
+    GuardarCSVEnSegundoPlano,
+    GuardarBinario,
+    AbrirBinario,
+    PuntoDeControl,
+    AgregarFila,
+    EliminarFila,
+    AgregarColumna,
+    EliminarColumna,
+    Ordenar,
+    ActualizarCelda,
+    ActualizarCeldas,
+    ActualizarBloque,
+    ActualizarDesdeArchivo,
+    EstablecerFormula,
+    ObtenerCelda,
+    OperarCeldas,
+    OperarFila,
+    OperarColumna,
+    EstadisticasRango,
+    SumaRango,
+    Buscar,
+    Filtrar,
+    Agrupar,
+    Comprimir,
+    Mostrar,
+    Cantidad
+};
+
+// Cuenta llamadas, celdas tocadas y bytes leidos / escritos, y guarda un
+// histograma de latencias por operacion. Las operaciones de una celda se
+// cronometran una vez cada 'muestreo' llamadas (las llamadas se cuentan
+// todas), asi el reloj no cuesta mas que la propia operacion.
+// Compilando con HOJA_SIN_INSTRUMENTACION todo queda vacio y no cuesta nada.
+#ifdef HOJA_SIN_INSTRUMENTACION
+class Instrumentacion {
+public:
+    class Medicion {
+    public:
+        Medicion(Instrumentacion&, Operacion, size_t = 0, unsigned = 1) {}
+        void celdas(size_t) {}
+    };
+
+    void leidos(size_t) {}
+    void escritos(size_t) {}
+    void reiniciar() {}
+    void volcarJSON(std::ostream& salida) const {
+        salida << "{\"instrumentacion\":false}\n";
+    }
+};
+#else
+class Instrumentacion {
+private:
+    // Histograma logaritmico con 8 cubetas por cada potencia de 2, o sea un
+    // error relativo de a lo sumo 12.5% en los percentiles
+    static const size_t subdivisiones = 8;
+    static const size_t cubetas = 62 * subdivisiones;
+
+    static size_t cubeta(uint64_t ns) {
+        if (ns < 2 * subdivisiones) {
+            return static_cast<size_t>(ns);
+        }
+#if defined(__GNUC__)
+        size_t exponente = 63 - static_cast<size_t>(__builtin_clzll(ns));
+#else
+        size_t exponente = 0;
+        while (ns >> (exponente + 1)) {
+            ++exponente;
+        }
+#endif
+        size_t fraccion = static_cast<size_t>(ns >> (exponente - 3)) & (subdivisiones - 1);
+        return (exponente - 2) * subdivisiones + fraccion;
+    }
+
+    // Mayor valor que cae en la cubeta
+    static uint64_t techo(size_t indice) {
+        if (indice < 2 * subdivisiones) {
+            return indice;
+        }
+        size_t exponente = indice / subdivisiones + 2;
+        uint64_t base = static_cast<uint64_t>(subdivisiones + indice % subdivisiones) << (exponente - 3);
+        return base + (uint64_t(1) << (exponente - 3)) - 1;
+    }
+
+    struct Contadores {
+        uint64_t llamadas = 0;
+        uint64_t medidas = 0;
+        uint64_t celdas = 0;
+        uint64_t totalNs = 0;
+        uint64_t maximoNs = 0;
+        std::array<uint64_t, cubetas> histograma{};
+
+        void registrar(uint64_t ns) {
+            ++medidas;
+            totalNs += ns;
+            maximoNs = std::max(maximoNs, ns);
+            ++histograma[cubeta(ns)];
+        }
+
+        uint64_t percentil(double p) const {
+            uint64_t objetivo = static_cast<uint64_t>(std::ceil(p * medidas));
+            uint64_t acumuladas = 0;
+            for (size_t i = 0; i < cubetas; ++i) {
+                acumuladas += histograma[i];
+                if (acumuladas >= objetivo && acumuladas > 0) {
+                    return std::min(techo(i), maximoNs);
+                }
+            }
+            return 0;
+        }
+    };
+
+    std::array<Contadores, static_cast<size_t>(Operacion::Cantidad)> porOperacion;
+    uint64_t bytesLeidos = 0;
+    uint64_t bytesEscritos = 0;
+
+public:
+    class Medicion {
+    public:
+        // 'muestreo' tiene que ser potencia de 2
+        Medicion(Instrumentacion& destino, Operacion operacion, size_t celdas = 0, unsigned muestreo = 1)
+            : contadores(destino.porOperacion[static_cast<size_t>(operacion)]) {
+            contadores.celdas += celdas;
+            medir = (contadores.llamadas++ & (muestreo - 1)) == 0;
+            if (medir) {
+                inicio = std::chrono::steady_clock::now();
+            }
+        }
+
+        ~Medicion() {
+            if (medir) {
+                auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - inicio).count();
+                contadores.registrar(static_cast<uint64_t>(ns));
+            }
+        }
+
+        Medicion(const Medicion&) = delete;
+        Medicion& operator=(const Medicion&) = delete;
+
+        void celdas(size_t cantidad) {
+            contadores.celdas += cantidad;
+        }
+
+    private:
+        Contadores& contadores;
+        std::chrono::steady_clock::time_point inicio;
+        bool medir;
+    };
+
+    void leidos(size_t bytes) {
+        bytesLeidos += bytes;
+    }
+
+    void escritos(size_t bytes) {
+        bytesEscritos += bytes;
+    }
+
+    void reiniciar() {
+        *this = Instrumentacion();
+    }
+
+    // Un objeto JSON con los totales y, por cada operacion usada, llamadas,
+    // medidas, celdas y latencias en nanosegundos
+    void volcarJSON(std::ostream& salida) const {
+        static const char* const nombres[] = {
+            "cargarCSV", "guardarCSV", "guardarCSVEnSegundoPlano", "guardarBinario", "abrirBinario",
+            "puntoDeControl", "agregarFila", "eliminarFila", "agregarColumna", "eliminarColumna", "ordenar", "actualizarCelda",
+            "actualizarCeldas", "actualizarBloque", "actualizarDesdeArchivo", "establecerFormula",
+            "obtenerCelda", "operarCeldas", "operarFila", "operarColumna", "estadisticasRango",
+            "sumaRango", "buscar", "filtrar", "agrupar", "comprimir", "mostrar"};
+        static_assert(sizeof(nombres) / sizeof(nombres[0]) == static_cast<size_t>(Operacion::Cantidad),
+                      "falta el nombre de una operacion");
+        std::string texto = "{\"bytesLeidos\":" + std::to_string(bytesLeidos) +
+                            ",\"bytesEscritos\":" + std::to_string(bytesEscritos) + ",\"operaciones\":{";
+        bool primera = true;
+        for (size_t i = 0; i < porOperacion.size(); ++i) {
+            const Contadores& c = porOperacion[i];
+            if (c.llamadas == 0) {
+                continue;
+            }
+            texto += primera ? "\"" : ",\"";
+            primera = false;
+            texto += nombres[i];
+            texto += "\":{\"llamadas\":" + std::to_string(c.llamadas) + ",\"medidas\":" + std::to_string(c.medidas) +
+                     ",\"celdas\":" + std::to_string(c.celdas) + ",\"totalNs\":" + std::to_string(c.totalNs) +
+                     ",\"p50Ns\":" + std::to_string(c.percentil(0.50)) + ",\"p99Ns\":" + std::to_string(c.percentil(0.99)) +
+                     ",\"maximoNs\":" + std::to_string(c.maximoNs) + "}";
+        }
+        texto += "}}\n";
+        salida << texto;
+    }
+};
+#endif
+
+// Registro de escritura anticipada de una hoja: cada cambio se agrega al
+// final del archivo como un registro binario pequeno y lo ya escrito no se
+// vuelve a tocar. Los registros se juntan en lotes (confirmacion en grupo):
+// un lote sale con una sola escritura y una sola sincronizacion con el disco
+// cuando llega a 'loteBytes' o cuando su primer registro lleva 'demora'
+// esperando, asi que un corte pierde como mucho el lote sin confirmar. El
+// plazo lo vigila un hilo aparte: si no llegan mas cambios el lote igual
+// sale a tiempo.
+//
+// El archivo empieza con una cabecera de 32 bytes que dice sobre que punto
+// de control (la foto guardada con guardarBinario) se aplican los registros.
+// Cada lote lleva delante su largo, cuantos registros trae y la suma de
+// verificacion del contenido; al recorrerlo, el primer lote incompleto o con
+// la suma mal marca el final de lo que llego al disco.
+struct CabeceraRegistro {
+    char magia[8];
+    uint32_t version;
+    uint32_t reserva0;
+    uint64_t puntoControl;
+    uint64_t reserva;
+};
+static_assert(sizeof(CabeceraRegistro) == 32, "La cabecera del registro debe ocupar 32 bytes");
+
+struct CabeceraLote {
+    uint64_t bytes;
+    uint32_t registros;
+    uint32_t reserva;
+    uint64_t suma;
+};
+
+const char magiaRegistro[8] = {'H', 'O', 'J', 'A', 'R', 'E', 'G', '1'};
+const uint32_t versionRegistro = 1;
+
+class RegistroEscritura {
+public:
+    enum class Tipo : uint8_t {
+        Celda, Celdas, Bloque, AgregarFila, EliminarFila, AgregarColumna, EliminarColumna,
+        InsertarFila, InsertarColumna, Formula, EliminarFormula, Formulas, OrdenFilas
+    };
+
+    // Lee los campos de un lote ya verificado, en el orden en que se pusieron
+    class Lector {
+    private:
+        const char* p;
+        const char* fin;
+
+    public:
+        Lector(const char* inicio, const char* fin) : p(inicio), fin(fin) {}
+
+        bool quedan() const { return p < fin; }
+
+        void bytes(void* destino, size_t n) {
+            if (n > static_cast<size_t>(fin - p)) {
+                throw std::runtime_error("Registro incompleto en el lote");
+            }
+            std::memcpy(destino, p, n);
+            p += n;
+        }
+        Tipo tipo() {
+            uint8_t valor;
+            bytes(&valor, 1);
+            return static_cast<Tipo>(valor);
+        }
+        uint64_t entero() {
+            uint64_t valor;
+            bytes(&valor, sizeof(valor));
+            return valor;
+        }
+        double real() {
+            double valor;
+            bytes(&valor, sizeof(valor));
+            return valor;
+        }
+    };
+
+private:
+#ifndef _WIN32
+    int descriptor = -1;
+#else
+    FILE* archivo = nullptr;
+#endif
+    std::string nombre;
+    uint64_t puntoControl = 0;
+    // El registro que se esta armando; solo lo toca quien hace los cambios
+    std::string actual;
+    // Todo lo de aqui abajo se comparte con el hilo que vigila el plazo y se
+    // protege con 'cerrojo'. 'escrituraArchivo' ordena las escrituras al
+    // disco, que se hacen sin 'cerrojo' para no frenar a quien registra.
+    mutable std::mutex cerrojo;
+    std::mutex escrituraArchivo;
+    std::condition_variable aviso;
+    std::thread vigilante;
+    bool terminando = false;
+    bool fallido = false;
+    std::string pendiente;
+    size_t registrosPendientes = 0;
+    std::chrono::steady_clock::time_point primero;
+    size_t loteBytes = 256 << 10;
+    std::chrono::microseconds demora{5000};
+    size_t bytesArchivo = 0;
+    size_t registros = 0;
+    size_t lotes = 0;
+    double milisegundosSincronizando = 0.0;
+
+    RegistroEscritura() = default;
+
+    bool escribir(const void* datos, size_t n) {
+#ifndef _WIN32
+        const char* p = static_cast<const char*>(datos);
+        while (n > 0) {
+            ssize_t escritos = ::write(descriptor, p, n);
+            if (escritos < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            p += escritos;
+            n -= static_cast<size_t>(escritos);
+        }
+        return true;
+#else
+        return std::fwrite(datos, 1, n, archivo) == n;
+#endif
+    }
+
+    bool sincronizar() {
+        auto inicio = std::chrono::steady_clock::now();
+#if defined(_WIN32)
+        bool correcto = std::fflush(archivo) == 0;
+#elif defined(__APPLE__)
+        bool correcto = ::fsync(descriptor) == 0;
+#else
+        bool correcto = ::fdatasync(descriptor) == 0;
+#endif
+        double milisegundos = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - inicio).count();
+        std::lock_guard<std::mutex> bloqueo(cerrojo);
+        milisegundosSincronizando += milisegundos;
+        return correcto;
+    }
+
+    // Abre el archivo para agregar; con 'nuevo' lo vacia y escribe la cabecera
+    static std::unique_ptr<RegistroEscritura> abrir(const std::string& nombre, uint64_t puntoControl, bool nuevo, size_t largo) {
+        std::unique_ptr<RegistroEscritura> registro(new RegistroEscritura());
+        registro->nombre = nombre;
+        registro->puntoControl = puntoControl;
+#ifndef _WIN32
+        registro->descriptor = ::open(nombre.c_str(), O_WRONLY | O_CREAT | (nuevo ? O_TRUNC : 0), 0644);
+        if (registro->descriptor < 0 || (!nuevo && (::ftruncate(registro->descriptor, static_cast<off_t>(largo)) != 0 ||
+                                                    ::lseek(registro->descriptor, 0, SEEK_END) < 0))) {
+            return nullptr;
+        }
+#else
+        if (!nuevo) {
+            std::filesystem::resize_file(nombre, largo);
+        }
+        registro->archivo = std::fopen(nombre.c_str(), nuevo ? "wb" : "ab");
+        if (registro->archivo == nullptr) {
+            return nullptr;
+        }
+#endif
+        if (nuevo) {
+            CabeceraRegistro cabecera = {};
+            std::memcpy(cabecera.magia, magiaRegistro, sizeof(magiaRegistro));
+            cabecera.version = versionRegistro;
+            cabecera.puntoControl = puntoControl;
+            if (!registro->escribir(&cabecera, sizeof(cabecera)) || !registro->sincronizar()) {
+                return nullptr;
+            }
+            largo = sizeof(cabecera);
+        }
+        registro->bytesArchivo = largo;
+        registro->vigilante = std::thread(&RegistroEscritura::vigilar, registro.get());
+        return registro;
+    }
+
+    // Confirma el lote cuando su primer registro cumple la demora aunque no
+    // lleguen mas cambios. Tras un fallo reintenta con la misma demora.
+    void vigilar() {
+        std::unique_lock<std::mutex> bloqueo(cerrojo);
+        while (!terminando) {
+            if (registrosPendientes == 0) {
+                aviso.wait(bloqueo);
+            } else if (std::chrono::steady_clock::now() - primero < demora) {
+                aviso.wait_until(bloqueo, primero + demora);
+            } else {
+                bloqueo.unlock();
+                confirmar();
+                bloqueo.lock();
+            }
+        }
+    }
+
+    // Deja el archivo como estaba antes del lote que no se pudo escribir, asi
+    // el siguiente intento no queda detras de un lote a medias
+    bool volverAlUltimoLote() {
+#ifndef _WIN32
+        return ::ftruncate(descriptor, static_cast<off_t>(bytesArchivo)) == 0 && ::lseek(descriptor, 0, SEEK_END) >= 0;
+#else
+        std::fclose(archivo);
+        std::error_code error;
+        std::filesystem::resize_file(nombre, bytesArchivo, error);
+        archivo = std::fopen(nombre.c_str(), "ab");
+        return !error && archivo != nullptr;
+#endif
+    }
+
+public:
+    ~RegistroEscritura() {
+        if (vigilante.joinable()) {
+            {
+                std::lock_guard<std::mutex> bloqueo(cerrojo);
+                terminando = true;
+            }
+            aviso.notify_one();
+            vigilante.join();
+        }
+        confirmar();
+#ifndef _WIN32
+        if (descriptor >= 0) {
+            ::close(descriptor);
+        }
+#else
+        if (archivo != nullptr) {
+            std::fclose(archivo);
+        }
+#endif
+    }
+
+    RegistroEscritura(const RegistroEscritura&) = delete;
+    RegistroEscritura& operator=(const RegistroEscritura&) = delete;
+
+    // Crea (o vacia) el archivo con su cabecera, ya sincronizada
+    static std::unique_ptr<RegistroEscritura> crear(const std::string& nombre, uint64_t puntoControl) {
+        return abrir(nombre, puntoControl, true, 0);
+    }
+
+    // Sigue agregando a un archivo existente; lo que haya despues de 'largo'
+    // (un lote cortado a medias) se descarta
+    static std::unique_ptr<RegistroEscritura> continuar(const std::string& nombre, uint64_t puntoControl, size_t largo) {
+        return abrir(nombre, puntoControl, false, largo);
+    }
+
+    static bool leerCabecera(const std::string& nombre, uint64_t& puntoControl) {
+        std::ifstream archivo(nombre, std::ios::binary);
+        CabeceraRegistro cabecera;
+        if (!archivo.read(reinterpret_cast<char*>(&cabecera), sizeof(cabecera)) ||
+            std::memcmp(cabecera.magia, magiaRegistro, sizeof(magiaRegistro)) != 0 || cabecera.version != versionRegistro) {
+            return false;
+        }
+        puntoControl = cabecera.puntoControl;
+        return true;
+    }
+
+    // Llama a 'aplicar' con cada registro de los lotes completos, en orden, y
+    // devuelve el largo del archivo hasta el ultimo lote valido
+    static size_t recorrer(const std::string& nombre, const std::function<void(Lector&)>& aplicar) {
+        std::ifstream archivo(nombre, std::ios::binary);
+        archivo.seekg(sizeof(CabeceraRegistro));
+        size_t largo = sizeof(CabeceraRegistro);
+        std::vector<char> contenido;
+        CabeceraLote lote;
+        while (archivo.read(reinterpret_cast<char*>(&lote), sizeof(lote))) {
+            if (lote.bytes > (size_t(1) << 40)) {
+                break;
+            }
+            contenido.resize(lote.bytes);
+            if (!archivo.read(contenido.data(), static_cast<std::streamsize>(lote.bytes))) {
+                break;
+            }
+            SumaVerificacion suma;
+            suma.agregar(contenido.data(), contenido.size());
+            if (suma.valor() != lote.suma) {
+                break;
+            }
+            Lector lector(contenido.data(), contenido.data() + contenido.size());
+            for (uint32_t i = 0; i < lote.registros; ++i) {
+                aplicar(lector);
+            }
+            largo += sizeof(lote) + lote.bytes;
+        }
+        return largo;
+    }
+
+    void establecerLote(size_t bytes, std::chrono::microseconds espera) {
+        bool lleno;
+        {
+            std::lock_guard<std::mutex> bloqueo(cerrojo);
+            loteBytes = bytes;
+            demora = espera;
+            lleno = pendiente.size() >= loteBytes;
+        }
+        aviso.notify_one();
+        if (lleno) {
+            confirmar();
+        }
+    }
+
+    void empezar(Tipo tipo) {
+        actual.clear();
+        actual.push_back(static_cast<char>(tipo));
+    }
+    void ponerBytes(const void* datos, size_t n) {
+        actual.append(static_cast<const char*>(datos), n);
+    }
+    void ponerEntero(uint64_t valor) {
+        ponerBytes(&valor, sizeof(valor));
+    }
+    void ponerReal(double valor) {
+        ponerBytes(&valor, sizeof(valor));
+    }
+
+    // Pasa el registro empezado al lote y devuelve cuanto pesa el archivo con
+    // lo pendiente. Si el lote se lleno se confirma aqui mismo; el plazo lo
+    // cuida el hilo vigilante.
+    size_t terminar() {
+        bool lleno;
+        bool avisar;
+        size_t total;
+        {
+            std::lock_guard<std::mutex> bloqueo(cerrojo);
+            avisar = registrosPendientes == 0;
+            if (avisar) {
+                primero = std::chrono::steady_clock::now();
+            }
+            if (pendiente.empty()) {
+                pendiente.swap(actual);
+            } else {
+                pendiente.append(actual);
+            }
+            ++registrosPendientes;
+            ++registros;
+            lleno = pendiente.size() >= loteBytes;
+            total = bytesArchivo + pendiente.size();
+        }
+        actual.clear();
+        if (avisar) {
+            aviso.notify_one();
+        }
+        if (lleno) {
+            confirmar();
+        }
+        return total;
+    }
+
+    // Escribe el lote pendiente y espera a que este en el disco. Si falla, el
+    // archivo vuelve al ultimo lote bueno y el lote sigue pendiente (delante
+    // de lo que llego mientras tanto) para el proximo intento.
+    bool confirmar() {
+        std::lock_guard<std::mutex> turno(escrituraArchivo);
+        std::string lote;
+        size_t cantidad;
+        {
+            std::lock_guard<std::mutex> bloqueo(cerrojo);
+            if (registrosPendientes == 0) {
+                return true;
+            }
+            lote.swap(pendiente);
+            cantidad = registrosPendientes;
+            registrosPendientes = 0;
+        }
+        CabeceraLote cabecera = {};
+        cabecera.bytes = lote.size();
+        cabecera.registros = static_cast<uint32_t>(cantidad);
+        SumaVerificacion suma;
+        suma.agregar(lote.data(), lote.size());
+        cabecera.suma = suma.valor();
+        bool correcto = escribir(&cabecera, sizeof(cabecera)) && escribir(lote.data(), lote.size()) && sincronizar();
+        if (!correcto) {
+            volverAlUltimoLote();
+        }
+        std::lock_guard<std::mutex> bloqueo(cerrojo);
+        if (correcto) {
+            bytesArchivo += sizeof(cabecera) + lote.size();
+            ++lotes;
+            fallido = false;
+            return true;
+        }
+        if (!fallido) {
+            std::cerr << "Error al escribir el registro de cambios." << std::endl;
+            fallido = true;
+        }
+        lote.append(pendiente);
+        pendiente.swap(lote);
+        registrosPendientes += cantidad;
+        primero = std::chrono::steady_clock::now();
+        return false;
+    }
+
+    // Olvida el lote pendiente (sus cambios ya estan en un punto de control nuevo)
+    void descartar() {
+        std::lock_guard<std::mutex> bloqueo(cerrojo);
+        pendiente.clear();
+        registrosPendientes = 0;
+    }
+
+    uint64_t obtenerPuntoControl() const { return puntoControl; }
+    size_t bytes() const {
+        std::lock_guard<std::mutex> bloqueo(cerrojo);
+        return bytesArchivo + pendiente.size();
+    }
+    size_t obtenerLoteBytes() const {
+        std::lock_guard<std::mutex> bloqueo(cerrojo);
+        return loteBytes;
+    }
+    std::chrono::microseconds obtenerDemora() const {
+        std::lock_guard<std::mutex> bloqueo(cerrojo);
+        return demora;
+    }
+    size_t cantidadRegistros() const {
+        std::lock_guard<std::mutex> bloqueo(cerrojo);
+        return registros;
+    }
+    size_t cantidadLotes() const {
+        std::lock_guard<std::mutex> bloqueo(cerrojo);
+        return lotes;
+    }
+    size_t pendientes() const {
+        std::lock_guard<std::mutex> bloqueo(cerrojo);
+        return registrosPendientes;
+    }
+    double tiempoSincronizando() const {
+        std::lock_guard<std::mutex> bloqueo(cerrojo);
+        return milisegundosSincronizando;
+    }
+
+    // Lleva al disco un archivo ya escrito y cerrado
+    static bool asegurarArchivo(const std::string& nombre) {
+#ifndef _WIN32
+        int archivo = ::open(nombre.c_str(), O_RDONLY);
+        if (archivo < 0) {
+            return false;
+        }
+        bool correcto = ::fsync(archivo) == 0;
+        ::close(archivo);
+        return correcto;
+#else
+        return std::ifstream(nombre).is_open();
+#endif
+    }
+
+    // Pone 'origen' en lugar de 'destino' de una vez y asegura el directorio,
+    // asi tras un corte se ve uno u otro completo
+    static bool reemplazar(const std::string& origen, const std::string& destino) {
+#ifndef _WIN32
+        if (std::rename(origen.c_str(), destino.c_str()) != 0) {
+            return false;
+        }
+        size_t barra = destino.find_last_of('/');
+        std::string directorio = barra == std::string::npos ? "." : barra == 0 ? "/" : destino.substr(0, barra);
+        int archivo = ::open(directorio.c_str(), O_RDONLY);
+        if (archivo >= 0) {
+            ::fsync(archivo);
+            ::close(archivo);
+        }
+        return true;
+#else
+        std::error_code error;
+        std::filesystem::rename(origen, destino, error);
+        return !error;
+#endif
+    }
+};
+
+class HojaCalculo {
+private:
+    // Todas las celdas viven en un unico bloque contiguo. Por defecto se
+    // ordena por filas: la celda (fila, columna) esta en celdas[fila * paso + columna].
+    // En la disposicion por columnas el bloque guarda columnas enteras seguidas
+    // y la celda esta en celdas[columna * paso + fila], de modo que operarColumna
+    // recorre memoria contigua.
+    // Cada "linea" (fila o columna segun la disposicion) ocupa 'paso' posiciones;
+    // las de holgura siempre valen 0.0 para poder crecer sin mover datos.
+    // Al abrir un archivo binario el bloque no se copia: se usa directamente
+    // la proyeccion del archivo (bloqueMapeado) y celdas queda vacio. Las
+    // ediciones de celdas escriben en esa proyeccion privada y el sistema copia
+    // solo las paginas tocadas; los cambios de estructura copian el bloque
+    // entero a celdas antes de modificarlo.
+    // En el modo disperso celdas queda vacio y las celdas viven en 'disperso'.
+    // Ambos toman su memoria de 'memoria' (ver LibroCalculo).
+    // Con la compresion (establecerCompresion) celdas tambien queda vacio y
+    // cada columna fisica vive en 'comprimidas'. Se lee sin descomprimir;
+    // escribir una celda deja cruda solo su columna, y agregar filas o
+    // columnas o el recalculo en paralelo descomprimen la hoja entera, como
+    // con la proyeccion. Las filas y columnas eliminadas quedan como huecos
+    // en las columnas comprimidas. Las columnas se comprimen en paralelo,
+    // asi que usan la memoria general y no la de 'memoria'.
+    // Eliminar una fila o columna no mueve el bloque: se saca del indice
+    // logico -> fisico (indiceFilas / indiceColumnas) y su linea queda como
+    // hueco hasta que compactar() vuelve a escribir el bloque. Un indice vacio
+    // es la identidad; filasAlmacenadas y columnasAlmacenadas solo cuentan
+    // mientras el indice esta en uso.
+    std::pmr::memory_resource* memoria;
+    std::pmr::vector<double> celdas;
+#ifndef _WIN32
+    std::unique_ptr<ArchivoMapeado> mapa;
+#endif
+    double* bloqueMapeado = nullptr;
+    std::vector<ColumnaComprimida> comprimidas;
+    bool compresion = false;
+    size_t numFilas = 0;
+    size_t numColumnas = 0;
+    size_t paso = 0;
+    Disposicion disposicion = Disposicion::PorFilas;
+    bool dispersa = false;
+    AlmacenDisperso disperso;
+    std::vector<size_t> indiceFilas;
+    std::vector<size_t> indiceColumnas;
+    size_t filasAlmacenadas = 0;
+    size_t columnasAlmacenadas = 0;
+    // Indice de sumas opcional. Se reconstruye en la primera consulta despues
+    // de un cambio que no pudo absorber (cualquiera en la tabla; lotes,
+    // cambios de estructura y cargas en el arbol de Fenwick).
+    TipoIndiceSumas tipoIndiceSumas = TipoIndiceSumas::Ninguno;
+    mutable IndiceSumas indiceSumas;
+    mutable bool indiceSumasAlDia = false;
+    // Indices secundarios por columna logica (crearIndiceColumna). Cada
+    // escritura de celda y cada cambio de estructura los corrige al momento;
+    // las cargas y el recalculo en paralelo los dejan para reconstruir en la
+    // proxima busqueda.
+    mutable std::map<size_t, IndiceColumna> indicesColumnas;
+    mutable bool indicesColumnasAlDia = true;
+    // Cache de operarFila / operarColumna. Cada fila y columna logica lleva
+    // una version sacada de 'reloj', que nunca se repite, asi que la version
+    // identifica el contenido aunque la linea cambie de indice. El resultado
+    // de una fila depende ademas de que columnas hay (epocaColumnas) y el de
+    // una columna de que filas hay (epocaFilas); los cambios de disposicion
+    // suben las dos epocas porque cambian el orden de la reduccion.
+    struct ClaveReduccion {
+        uint64_t version;
+        uint64_t epoca;
+        char eje;
+        char operacion;
+
+        bool operator==(const ClaveReduccion& otra) const {
+            return version == otra.version && epoca == otra.epoca && eje == otra.eje && operacion == otra.operacion;
+        }
+    };
+    struct HashReduccion {
+        size_t operator()(const ClaveReduccion& c) const {
+            uint64_t h = c.version * 0x9E3779B97F4A7C15ULL ^ c.epoca * 0xC2B2AE3D27D4EB4FULL;
+            return static_cast<size_t>(h ^ (h >> 29) ^ (static_cast<uint64_t>(c.eje) << 8 | static_cast<unsigned char>(c.operacion)));
+        }
+    };
+    static const size_t maximoReducciones = 1 << 16;
+    uint64_t reloj = 0;
+    std::vector<uint64_t> versionFilas;
+    std::vector<uint64_t> versionColumnas;
+    uint64_t epocaFilas = 0;
+    uint64_t epocaColumnas = 0;
+    mutable std::unordered_map<ClaveReduccion, double, HashReduccion> reducciones;
+    mutable size_t aciertosCache = 0;
+    mutable size_t fallosCache = 0;
+    // Hilos para las operaciones que se reparten (ver repartir): la carga de
+    // CSV, el recalculo de formulas, ordenar, agrupar, las estadisticas de
+    // rango, la compresion y los recorridos de columnas
+    size_t hilos = 1;
+    std::shared_ptr<GrupoHilos> grupo;
+    // Resultado del guardado en segundo plano, si hay uno en curso
+    std::future<bool> guardado;
+    // Mensajes informativos (no los de error) en std::cout
+    bool avisos = true;
+    // Ventana que dibuja mostrar(): primera fila y columna visibles y tamano
+    size_t vistaFila = 0;
+    size_t vistaColumna = 0;
+    size_t vistaFilas = 20;
+    size_t vistaColumnas = 8;
+    // Llamadas, latencias, celdas y bytes de las operaciones publicas
+    mutable Instrumentacion instrumentacion;
+    using Medicion = Instrumentacion::Medicion;
+
+    // Diario de deshacer / rehacer. Cada entrada guarda solo lo que cambio:
+    // los valores anteriores (y los nuevos, para rehacer) de las celdas
+    // escritas, o la linea eliminada. Las formulas que un cambio borra se
+    // guardan como texto. Eliminar una fila o columna guarda las formulas de
+    // la linea eliminada y las que reubicarFormulas reescribio; ordenar, las
+    // que permutarFilas reescribio. Al deshacer, devolverFormulas o
+    // restaurarFormulas las vuelven a poner. Deshacer repite la operacion
+    // inversa con el diario en pausa, asi cuesta lo que el cambio.
+    // Cuando el diario pasa del presupuesto se olvidan las entradas mas viejas.
+    // Lo que no entra en una entrada chica: las celdas de un lote o bloque,
+    // la linea eliminada y las formulas
+    struct DetalleDiario {
+        // Celdas: los cambios aplicados; anteriores va en el mismo orden
+        std::vector<Actualizacion> cambios;
+        // Valores previos (Celdas, Bloque) o la linea eliminada
+        std::vector<double> anteriores;
+        // Bloque: los valores escritos
+        std::vector<double> nuevos;
+        // Formula: el texto escrito, vacio si se quito la formula
+        std::string texto;
+        // Formulas que el cambio quito o reescribio, como estaban antes
+        std::vector<std::pair<uint64_t, Formula>> formulas;
+        // Ordenar: la fila i quedo con lo que tenia la fila orden[i]
+        std::vector<uint32_t> orden;
+        // Tamano del bloque
+        size_t filas = 0;
+        size_t columnas = 0;
+        // Linea fisica que quedo como hueco al eliminar, valida mientras
+        // generacionIndices no cambie
+        size_t fisica = 0;
+        size_t generacion = std::numeric_limits<size_t>::max();
+    };
+    // 32 bytes: un cambio de una celda sin formula no pide memoria aparte.
+    // Los indices entran en 32 bits, como en las claves de las formulas:
+    // la hoja no pasa de maximoLineas filas ni columnas.
+    struct EntradaDiario {
+        enum class Tipo : uint8_t { Celda, Celdas, Bloque, Formula, AgregarFila, EliminarFila, AgregarColumna, EliminarColumna, Ordenar };
+        Tipo tipo;
+        // Celda, esquina del bloque o linea eliminada
+        uint32_t fila = 0;
+        uint32_t columna = 0;
+        // Celda y Formula
+        double anterior = 0.0;
+        double nuevo = 0.0;
+        std::unique_ptr<DetalleDiario> detalle;
+
+        DetalleDiario& ampliar() {
+            if (!detalle) {
+                detalle = std::make_unique<DetalleDiario>();
+            }
+            return *detalle;
+        }
+
+        size_t bytes() const {
+            size_t total = sizeof(EntradaDiario);
+            if (!detalle) {
+                return total;
+            }
+            total += sizeof(DetalleDiario) + detalle->cambios.capacity() * sizeof(Actualizacion) +
+                     (detalle->anteriores.capacity() + detalle->nuevos.capacity()) * sizeof(double) +
+                     detalle->orden.capacity() * sizeof(uint32_t) + detalle->texto.capacity() +
+                     detalle->formulas.capacity() * sizeof(detalle->formulas[0]);
+            for (const auto& formula : detalle->formulas) {
+                total += formula.second.codigo.capacity() * sizeof(Instruccion) + formula.second.texto.capacity();
+            }
+            return total;
+        }
+    };
+    std::deque<EntradaDiario> deshacibles;
+    std::vector<EntradaDiario> rehacibles;
+    size_t bytesDiario = 0;
+    size_t presupuestoDiario = 64 << 20;
+    // En falso mientras se deshace o rehace, para no anotar la inversa
+    bool anotando = true;
+    // Sube cada vez que se olvidan los indices y con ellos los huecos
+    size_t generacionIndices = 0;
+
+    // Registro de cambios (abrirRegistro). La foto del ultimo punto de
+    // control esta en baseRegistro + ".hoja" y los cambios hechos desde
+    // entonces en baseRegistro + ".registro". Cada cambio se registra despues
+    // de aplicarse, y el punto de control se hace al terminar un registro,
+    // asi la foto nunca queda a mitad de un cambio.
+    std::unique_ptr<RegistroEscritura> registro;
+    std::string baseRegistro;
+    size_t minimoPuntoControl = 64 << 20;
+    size_t puntosControl = 0;
+    size_t recuperados = 0;
+    // En falso mientras un cambio compuesto se registra entero desde afuera
+    bool registrando = true;
+
+    // Suspende el registro mientras existe
+    struct SinRegistro {
+        bool& bandera;
+        bool antes;
+        explicit SinRegistro(bool& bandera) : bandera(bandera), antes(bandera) { bandera = false; }
+        ~SinRegistro() { bandera = antes; }
+    };
+
+    // Formulas por celda (clave fila << 32 | columna) y grafo de dependencias:
+    // para cada celda, las formulas que la leen. Los rangos de mas de
+    // maximoExpandido celdas no se expanden celda por celda, se anotan en
+    // cada columna que cubren. El valor de una formula se guarda en su celda,
+    // asi que leerla cuesta lo mismo que leer un numero.
+    std::unordered_map<uint64_t, Formula> formulas;
+    std::unordered_map<uint64_t, std::vector<uint64_t>> dependientes;
+    std::unordered_map<size_t, std::vector<std::pair<Rango, uint64_t>>> rangosPorColumna;
+    EstadisticasRecalculo recalculo;
+    static const size_t maximoExpandido = 64;
+    // Filas y columnas como mucho: las claves de las formulas, el diario, el
+    // orden y los indices de columna guardan los indices en 32 bits. Lo
+    // comprueban agregarFila, agregarColumna y las cargas.
+    static constexpr size_t maximoLineas = std::numeric_limits<uint32_t>::max();
+    // Un nivel se reparte entre hilos solo si tiene al menos esta cantidad de formulas
+    static const size_t minimoParalelo = 128;
+
+    // Parcial que se apila al evaluar: un valor suelto o el resumen de un rango
+    struct Parcial {
+        double suma;
+        double minimo;
+        double maximo;
+        size_t cuenta;
+    };
+
+    // Ejecuta f(0..n-1) en el grupo de hilos si lo hay, o en este hilo si no
+    void repartir(size_t n, const std::function<void(size_t)>& f) const {
+        if (grupo && n > 1) {
+            grupo->ejecutar(n, f);
+        } else {
+            for (size_t i = 0; i < n; ++i) {
+                f(i);
+            }
+        }
+    }
+
+    // Quien va a escribir pide los datos sin const: si la hoja esta
+    // comprimida, se descomprime antes
+    double* datos() {
+        descomprimir();
+        return bloqueMapeado ? bloqueMapeado : celdas.data();
+    }
+
+    const double* datos() const {
+        return bloqueMapeado ? bloqueMapeado : celdas.data();
+    }
+
+    // Suelta lo que no esta en celdas: la proyeccion y las columnas comprimidas
+    void soltarMapeo() {
+        comprimidas.clear();
+        bloqueMapeado = nullptr;
+#ifndef _WIN32
+        mapa.reset();
+#endif
+    }
+
+    // Pasa el bloque proyectado o comprimido a memoria propia antes de un cambio de estructura
+    void materializar() {
+        if (bloqueMapeado) {
+            celdas.assign(bloqueMapeado, bloqueMapeado + lineas() * paso);
+            soltarMapeo();
+        }
+        descomprimir();
+    }
+
+    bool comprimida() const {
+        return !comprimidas.empty();
+    }
+
+    // Vuelve a armar el bloque con las columnas comprimidas, por tramos de filas
+    void descomprimir() {
+        if (!comprimida()) {
+            return;
+        }
+        size_t filas = filasFisicas();
+        size_t columnas = comprimidas.size();
+        bool porFilas = disposicion == Disposicion::PorFilas;
+        paso = largoLinea();
+        celdas.assign(lineas() * paso, 0.0);
+        size_t tramos = tramosPara(filas, 4096);
+        repartir(tramos, [&](size_t t) {
+            size_t desde = filas * t / tramos;
+            size_t largo = filas * (t + 1) / tramos - desde;
+            std::vector<double> columna(porFilas ? largo : 0);
+            for (size_t c = 0; c < columnas; ++c) {
+                if (!porFilas) {
+                    comprimidas[c].copiar(desde, largo, celdas.data() + c * paso + desde);
+                    continue;
+                }
+                comprimidas[c].copiar(desde, largo, columna.data());
+                for (size_t i = 0; i < largo; ++i) {
+                    celdas[(desde + i) * paso + c] = columna[i];
+                }
+            }
+        });
+        comprimidas.clear();
+        comprimidas.shrink_to_fit();
+    }
+
+    void comprimirColumnas() {
+        Medicion medicion(instrumentacion, Operacion::Comprimir, numFilas * numColumnas);
+        if (dispersa || numFilas == 0) {
+            return;
+        }
+        if (comprimida()) {
+            // Solo quedan por comprimir las columnas que se pasaron a crudas al escribirlas
+            repartir(comprimidas.size(), [&](size_t c) {
+                if (comprimidas[c].escrita()) {
+                    std::vector<double> valores(comprimidas[c].cantidad());
+                    comprimidas[c].copiar(0, valores.size(), valores.data());
+                    comprimidas[c] = ColumnaComprimida(valores.data(), valores.size(), comprimidas.size());
+                }
+            });
+            return;
+        }
+        quitarHuecos();
+        std::vector<ColumnaComprimida> columnas(numColumnas);
+        repartir(numColumnas, [&](size_t c) {
+            std::vector<double> valores(numFilas);
+            copiarColumna(0, c, numFilas, valores.data());
+            columnas[c] = ColumnaComprimida(valores.data(), numFilas, numColumnas);
+        });
+        soltarMapeo();
+        comprimidas.swap(columnas);
+        celdas.clear();
+        celdas.shrink_to_fit();
+        paso = 0;
+    }
+
+    double leerComprimida(size_t fila, size_t columna) const {
+        return comprimidas[indiceColumnas.empty() ? columna : indiceColumnas[columna]].leer(indiceFilas.empty() ? fila : indiceFilas[fila]);
+    }
+
+    // Solo la columna escrita deja de estar comprimida; las demas siguen igual
+    void escribirComprimida(size_t fila, size_t columna, double valor) {
+        comprimidas[indiceColumnas.empty() ? columna : indiceColumnas[columna]].escribir(indiceFilas.empty() ? fila : indiceFilas[fila], valor);
+    }
+
+    double leerCelda(size_t fila, size_t columna) const {
+        if (comprimida()) {
+            return leerComprimida(fila, columna);
+        }
+        return dispersa ? disperso.leer(fila, columna) : datos()[posicion(fila, columna)];
+    }
+
+    // 'versionar' en falso deja las versiones quietas; lo usa el recalculo en
+    // paralelo, que despues invalida la cache entera.
+    void escribirCelda(size_t fila, size_t columna, double valor, bool versionar = true) {
+        if (versionar) {
+            tocarCelda(fila, columna);
+            if (indexando()) {
+                cambioEnIndices(fila, columna, leerCelda(fila, columna), valor);
+            }
+        }
+        if (indiceSumasAlDia) {
+            if (tipoIndiceSumas == TipoIndiceSumas::Fenwick) {
+                indiceSumas.cambiar(fila, columna, leerCelda(fila, columna), valor);
+            } else {
+                indiceSumasAlDia = false;
+            }
+        }
+        if (dispersa) {
+            disperso.escribir(fila, columna, valor);
+        } else if (comprimida()) {
+            escribirComprimida(fila, columna, valor);
+        } else {
+            datos()[posicion(fila, columna)] = valor;
+        }
+    }
+
+    bool indexando() const {
+        return indicesColumnasAlDia && !indicesColumnas.empty();
+    }
+
+    void cambioEnIndices(size_t fila, size_t columna, double anterior, double nuevo) {
+        auto indice = indicesColumnas.find(columna);
+        if (indice != indicesColumnas.end()) {
+            indice->second.cambiar(fila, anterior, nuevo);
+        }
+    }
+
+    // Corre una posicion los indices de las columnas desde 'index'
+    void correrIndicesColumnas(size_t index, bool agregar) {
+        std::map<size_t, IndiceColumna> corridos;
+        for (auto& [columna, indice] : indicesColumnas) {
+            corridos.emplace(columna < index ? columna : (agregar ? columna + 1 : columna - 1), std::move(indice));
+        }
+        indicesColumnas.swap(corridos);
+    }
+
+    void construirIndice(size_t columna, IndiceColumna& indice) const {
+        indice.construir(numFilas, [&](size_t desde, size_t largo, double* destino) {
+            copiarColumna(desde, columna, largo, destino);
+        });
+    }
+
+    // Reconstruye los indices de columna despues de una carga; los de
+    // columnas que ya no existen se descartan
+    void asegurarIndicesColumnas() const {
+        if (indicesColumnasAlDia) {
+            return;
+        }
+        for (auto it = indicesColumnas.begin(); it != indicesColumnas.end();) {
+            if (it->first >= numColumnas) {
+                it = indicesColumnas.erase(it);
+            } else {
+                construirIndice(it->first, it->second);
+                ++it;
+            }
+        }
+        indicesColumnasAlDia = true;
+    }
+
+    // Filas de la columna cuyo valor cumple la condicion, recorriendola en
+    // tramos repartidos entre los hilos
+    template <typename Condicion>
+    std::vector<size_t> recorrerColumna(size_t columna, Condicion condicion) const {
+        size_t tramos = tramosPara(numFilas, 1 << 16);
+        std::vector<std::vector<size_t>> partes(tramos);
+        repartir(tramos, [&](size_t t) {
+            std::vector<double> valores(4096);
+            size_t hasta = numFilas * (t + 1) / tramos;
+            for (size_t desde = numFilas * t / tramos; desde < hasta; desde += valores.size()) {
+                size_t largo = std::min(valores.size(), hasta - desde);
+                copiarColumna(desde, columna, largo, valores.data());
+                for (size_t i = 0; i < largo; ++i) {
+                    if (condicion(valores[i])) {
+                        partes[t].push_back(desde + i);
+                    }
+                }
+            }
+        });
+        std::vector<size_t> filas;
+        for (const auto& parte : partes) {
+            filas.insert(filas.end(), parte.begin(), parte.end());
+        }
+        return filas;
+    }
+
+    void tocarCelda(size_t fila, size_t columna) {
+        versionFilas[fila] = ++reloj;
+        versionColumnas[columna] = ++reloj;
+    }
+
+    // Da versiones nuevas a todas las filas y columnas (despues de una carga)
+    void renovarVersiones() {
+        versionFilas.resize(numFilas);
+        for (auto& version : versionFilas) {
+            version = ++reloj;
+        }
+        versionColumnas.resize(numColumnas);
+        for (auto& version : versionColumnas) {
+            version = ++reloj;
+        }
+        invalidarReducciones();
+    }
+
+    void invalidarReducciones() {
+        epocaFilas = ++reloj;
+        epocaColumnas = ++reloj;
+        reducciones.clear();
+    }
+
+    template <typename Calculo>
+    double recordarReduccion(const ClaveReduccion& buscada, const Calculo& calcular) const {
+        auto encontrada = reducciones.find(buscada);
+        if (encontrada != reducciones.end()) {
+            ++aciertosCache;
+            return encontrada->second;
+        }
+        ++fallosCache;
+        double resultado = calcular();
+        if (reducciones.size() >= maximoReducciones) {
+            reducciones.clear();
+        }
+        reducciones.emplace(buscada, resultado);
+        return resultado;
+    }
+
+    size_t posicion(size_t fila, size_t columna) const {
+        if (!indiceFilas.empty()) {
+            fila = indiceFilas[fila];
+        }
+        if (!indiceColumnas.empty()) {
+            columna = indiceColumnas[columna];
+        }
+        return disposicion == Disposicion::PorFilas ? fila * paso + columna : columna * paso + fila;
+    }
+
+    size_t filasFisicas() const {
+        return indiceFilas.empty() ? numFilas : filasAlmacenadas;
+    }
+
+    size_t columnasFisicas() const {
+        return indiceColumnas.empty() ? numColumnas : columnasAlmacenadas;
+    }
+
+    size_t lineas() const {
+        return disposicion == Disposicion::PorFilas ? filasFisicas() : columnasFisicas();
+    }
+
+    size_t largoLinea() const {
+        return disposicion == Disposicion::PorFilas ? columnasFisicas() : filasFisicas();
+    }
+
+    bool indirecta() const {
+        return !indiceFilas.empty() || !indiceColumnas.empty();
+    }
+
+    void olvidarIndices() {
+        indiceFilas.clear();
+        indiceColumnas.clear();
+        ++generacionIndices;
+    }
+
+    // Saca 'index' del indice logico -> fisico; su linea fisica queda como hueco
+    static void quitarDelIndice(std::vector<size_t>& indice, size_t& almacenadas, size_t cantidad, size_t index) {
+        if (indice.empty()) {
+            indice.resize(cantidad);
+            std::iota(indice.begin(), indice.end(), size_t(0));
+            almacenadas = cantidad;
+        }
+        indice.erase(indice.begin() + index);
+    }
+
+    // Copia 'largo' celdas seguidas de una fila (o columna) en orden logico
+    void copiarFila(size_t fila, size_t columna, size_t largo, double* destino) const {
+        if (dispersa) {
+            disperso.copiarFila(fila, columna, largo, destino);
+            return;
+        }
+        if (comprimida()) {
+            for (size_t i = 0; i < largo; ++i) {
+                destino[i] = leerComprimida(fila, columna + i);
+            }
+            return;
+        }
+        for (size_t i = 0; i < largo; ++i) {
+            destino[i] = datos()[posicion(fila, columna + i)];
+        }
+    }
+
+    void copiarColumna(size_t fila, size_t columna, size_t largo, double* destino) const {
+        if (dispersa) {
+            disperso.copiarColumna(fila, columna, largo, destino);
+            return;
+        }
+        if (comprimida()) {
+            if (indiceFilas.empty()) {
+                comprimidas[indiceColumnas.empty() ? columna : indiceColumnas[columna]].copiar(fila, largo, destino);
+            } else {
+                for (size_t i = 0; i < largo; ++i) {
+                    destino[i] = leerComprimida(fila + i, columna);
+                }
+            }
+            return;
+        }
+        for (size_t i = 0; i < largo; ++i) {
+            destino[i] = datos()[posicion(fila + i, columna)];
+        }
+    }
+
+    void cambiarPaso(size_t nuevoPaso) {
+        materializar();
+        std::pmr::vector<double> nuevas(lineas() * nuevoPaso, 0.0, memoria);
+        size_t copiar = std::min(largoLinea(), nuevoPaso);
+        for (size_t linea = 0; linea < lineas(); ++linea) {
+            std::copy_n(celdas.begin() + linea * paso, copiar, nuevas.begin() + linea * nuevoPaso);
+        }
+        celdas.swap(nuevas);
+        paso = nuevoPaso;
+    }
+
+    // Copia las lineas vivas a un bloque crudo nuevo, en orden logico y sin
+    // huecos; las columnas comprimidas quedan descomprimidas
+    void quitarHuecos() {
+        if (!indirecta()) {
+            return;
+        }
+        invalidarReducciones();
+        bool porFilas = disposicion == Disposicion::PorFilas;
+        size_t nuevasLineas = porFilas ? numFilas : numColumnas;
+        size_t nuevoPaso = porFilas ? numColumnas : numFilas;
+        std::pmr::vector<double> nuevas(nuevasLineas * nuevoPaso, memoria);
+        for (size_t linea = 0; linea < nuevasLineas; ++linea) {
+            if (porFilas) {
+                copiarFila(linea, 0, nuevoPaso, nuevas.data() + linea * nuevoPaso);
+            } else {
+                copiarColumna(0, linea, nuevoPaso, nuevas.data() + linea * nuevoPaso);
+            }
+        }
+        soltarMapeo();
+        celdas.swap(nuevas);
+        paso = nuevoPaso;
+        olvidarIndices();
+    }
+
+    // Agrega una linea completa al final del bloque
+    void agregarLinea() {
+        materializar();
+        celdas.resize((lineas() + 1) * paso, 0.0);
+    }
+
+    // Agrega una posicion al final de cada linea, usando la holgura si la hay
+    void agregarPosicion() {
+        descomprimir();
+        if (largoLinea() == paso) {
+            cambiarPaso(paso + paso / 2 + 1);
+        }
+    }
+
+    // Interpreta un campo numerico como std::stod: salta espacios iniciales
+    // e ignora lo que siga al numero. Devuelve donde termino el numero.
+    static const char* leerCampo(const char* p, const char* fin, double& valor) {
+        while (p < fin && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\v' || *p == '\f')) {
+            ++p;
+        }
+        if (p < fin && *p == '+' && p + 1 < fin && p[1] != '-') {
+            ++p;
+        }
+        auto [resto, error] = std::from_chars(p, fin, valor);
+        if (error == std::errc::invalid_argument) {
+            throw std::invalid_argument("Valor no numerico en el CSV");
+        }
+        if (error == std::errc::result_out_of_range) {
+            throw std::out_of_range("Valor fuera de rango en el CSV");
+        }
+        return resto;
+    }
+
+    // Ajusta la hoja a 'columnas' columnas cuando una fila trae mas campos que la primera
+    void ensancharCarga(size_t columnas) {
+        if (disposicion == Disposicion::PorFilas) {
+            if (columnas > paso) {
+                cambiarPaso(columnas);
+            }
+        } else {
+            celdas.resize(columnas * paso, 0.0);
+        }
+        numColumnas = columnas;
+    }
+
+    // Convierte los campos de una linea y los escribe en la fila indicada.
+    // Devuelve cuantos campos tenia; los que no caben en la hoja se descartan.
+    // En el modo disperso van todos a los bloques y los ceros no se escriben.
+    size_t cargarLineaCSV(const char* campo, const char* finLinea, size_t fila) {
+        size_t col = 0;
+        while (campo < finLinea) {
+            double valor;
+            const char* resto = leerCampo(campo, finLinea, valor);
+            const char* coma = static_cast<const char*>(std::memchr(resto, ',', finLinea - resto));
+            if (dispersa) {
+                if (valor != 0.0 || std::signbit(valor)) {
+                    disperso.escribir(fila, col, valor);
+                }
+            } else if (col < numColumnas) {
+                celdas[posicion(fila, col)] = valor;
+            }
+            ++col;
+            if (coma == nullptr) {
+                break;
+            }
+            campo = coma + 1;
+        }
+        return col;
+    }
+
+    // Carga desde un bloque de bytes proyectado. El bloque se corta en tramos
+    // que terminan en un salto de linea; en una primera pasada cada tramo cuenta
+    // sus filas, con eso se sabe en que fila empieza cada uno y se reserva la
+    // hoja de una vez, y en la segunda cada tramo convierte sus campos con
+    // std::from_chars directamente en sus celdas. Con un grupo de hilos los
+    // tramos se procesan en paralelo; el resultado es el mismo que en serie.
+    // En el modo disperso los campos van directo a los bloques, en serie (el
+    // almacen y la memoria de la hoja son de un solo hilo), y la memoria sigue
+    // a las celdas ocupadas y no al tamano de la hoja.
+    void cargarCSVMapeado(const char* datos, size_t largo) {
+        const size_t minimoPorTramo = 1 << 20;
+        const char* fin = datos + largo;
+        size_t tramos = 1;
+        if (grupo) {
+            tramos = std::max<size_t>(1, std::min(grupo->cantidad() * 4, largo / minimoPorTramo));
+        }
+        std::vector<const char*> cortes(tramos + 1, fin);
+        cortes[0] = datos;
+        for (size_t t = 1; t < tramos; ++t) {
+            const char* p = std::max(cortes[t - 1], datos + largo / tramos * t);
+            const char* salto = static_cast<const char*>(std::memchr(p, '\n', fin - p));
+            cortes[t] = salto ? salto + 1 : fin;
+        }
+
+        std::vector<size_t> primeraFila(tramos + 1, 0);
+        repartir(tramos, [&](size_t t) {
+            size_t filas = 0;
+            for (const char* p = cortes[t]; p < cortes[t + 1]; ++filas) {
+                const char* salto = static_cast<const char*>(std::memchr(p, '\n', cortes[t + 1] - p));
+                p = salto ? salto + 1 : cortes[t + 1];
+            }
+            primeraFila[t + 1] = filas;
+        });
+        for (size_t t = 0; t < tramos; ++t) {
+            primeraFila[t + 1] += primeraFila[t];
+        }
+        size_t filas = primeraFila[tramos];
+
+        size_t columnas = 0;
+        if (filas > 0) {
+            const char* salto = static_cast<const char*>(std::memchr(datos, '\n', largo));
+            const char* finPrimera = salto ? salto : fin;
+            for (const char* campo = datos; campo < finPrimera; ++columnas) {
+                const char* coma = static_cast<const char*>(std::memchr(campo, ',', finPrimera - campo));
+                if (coma == nullptr) {
+                    ++columnas;
+                    break;
+                }
+                campo = coma + 1;
+            }
+        }
+        comprobarTamano(filas, columnas);
+
+        soltarMapeo();
+        borrarFormulas();
+        celdas.clear(); // Limpiar celdas antes de cargar
+        disperso.limpiar();
+        olvidarIndices();
+        indiceSumasAlDia = false;
+        indicesColumnasAlDia = false;
+        numFilas = filas;
+        numColumnas = columnas;
+        if (dispersa) {
+            paso = 0;
+            celdas.shrink_to_fit();
+            size_t fila = 0;
+            for (const char* p = datos; p < fin; ++fila) {
+                const char* salto = static_cast<const char*>(std::memchr(p, '\n', fin - p));
+                const char* finLinea = salto ? salto : fin;
+                numColumnas = std::max(numColumnas, cargarLineaCSV(p, finLinea, fila));
+                p = salto ? salto + 1 : fin;
+            }
+            comprobarTamano(numFilas, numColumnas);
+            return;
+        }
+        paso = (disposicion == Disposicion::PorFilas) ? columnas : filas;
+        celdas.assign(filas * columnas, 0.0);
+
+        // Si alguna fila trae mas campos que la primera, se ensancha la hoja y se repite la pasada
+        while (true) {
+            std::vector<size_t> ancho(tramos, 0);
+            repartir(tramos, [&](size_t t) {
+                const char* p = cortes[t];
+                for (size_t fila = primeraFila[t]; fila < primeraFila[t + 1]; ++fila) {
+                    const char* salto = static_cast<const char*>(std::memchr(p, '\n', cortes[t + 1] - p));
+                    const char* finLinea = salto ? salto : cortes[t + 1];
+                    ancho[t] = std::max(ancho[t], cargarLineaCSV(p, finLinea, fila));
+                    p = salto ? salto + 1 : cortes[t + 1];
+                }
+            });
+            size_t maximo = ancho.empty() ? 0 : *std::max_element(ancho.begin(), ancho.end());
+            if (maximo <= numColumnas) {
+                break;
+            }
+            ensancharCarga(maximo);
+        }
+    }
+
+    // Lectura linea a linea para lo que no se puede proyectar (tuberias, etc.)
+    bool cargarCSVFlujo(const std::string& nombreArchivo, size_t& bytes) {
+        std::ifstream archivo(nombreArchivo);
+        if (!archivo.is_open()) {
+            return false;
+        }
+
+        // La lectura llena el bloque por filas; al final se pasa a la disposicion
+        // elegida. En el modo disperso cada fila va directo a los bloques.
+        Disposicion elegida = disposicion;
+        if (!dispersa) {
+            disposicion = Disposicion::PorFilas;
+        }
+        soltarMapeo();
+        borrarFormulas();
+        celdas.clear(); // Limpiar celdas antes de cargar
+        disperso.limpiar();
+        olvidarIndices();
+        indiceSumasAlDia = false;
+        indicesColumnasAlDia = false;
+        numFilas = 0;
+        numColumnas = 0;
+        paso = 0;
+        std::string linea;
+        std::vector<double> fila;
+        while (std::getline(archivo, linea)) {
+            bytes += linea.size() + 1;
+            fila.clear();
+            std::stringstream ss(linea);
+            std::string valor;
+            while (std::getline(ss, valor, ',')) {
+                fila.push_back(std::stod(valor));
+            }
+            comprobarTamano(numFilas + 1, fila.size());
+            if (dispersa) {
+                for (size_t col = 0; col < fila.size(); ++col) {
+                    if (fila[col] != 0.0 || std::signbit(fila[col])) {
+                        disperso.escribir(numFilas, col, fila[col]);
+                    }
+                }
+                numColumnas = std::max(numColumnas, fila.size());
+                ++numFilas;
+                continue;
+            }
+            // Las filas mas largas ensanchan la hoja; las cortas se completan con ceros
+            if (fila.size() > numColumnas) {
+                if (fila.size() > paso) {
+                    cambiarPaso(fila.size());
+                }
+                numColumnas = fila.size();
+            }
+            celdas.resize((numFilas + 1) * paso, 0.0);
+            std::copy(fila.begin(), fila.end(), celdas.begin() + posicion(numFilas, 0));
+            ++numFilas;
+        }
+
+        archivo.close();
+        if (!dispersa) {
+            establecerDisposicion(elegida);
+        }
+        return true;
+    }
+
+
+    // Escribe las celdas como CSV. Cada valor se formatea con std::to_chars,
+    // que da la representacion mas corta que se vuelve a leer exactamente igual,
+    // en un bufer propio que se vuelca al archivo en bloques de 1 MB.
+    // 'inicioFila(fila)' da la primera celda de la fila; las siguientes estan
+    // cada 'salto' posiciones.
+    template <typename InicioFila>
+    static bool escribirFilasCSV(const std::string& nombreArchivo, size_t filas, size_t columnas,
+                                 size_t salto, InicioFila inicioFila, size_t* escritos = nullptr) {
+        std::ofstream archivo(nombreArchivo);
+        if (!archivo.is_open()) {
+            return false;
+        }
+        const size_t bloque = 1 << 20;
+        // Margen para un valor, su coma y el salto de linea despues de llenar el bloque
+        std::vector<char> bufer(bloque + 64);
+        char* p = bufer.data();
+        char* limite = bufer.data() + bloque;
+        size_t total = 0;
+        for (size_t fila = 0; fila < filas; ++fila) {
+            const double* valor = inicioFila(fila);
+            for (size_t col = 0; col < columnas; ++col, valor += salto) {
+                if (p >= limite) {
+                    archivo.write(bufer.data(), p - bufer.data());
+                    total += p - bufer.data();
+                    p = bufer.data();
+                }
+                p = std::to_chars(p, limite + 32, *valor).ptr;
+                if (col < columnas - 1) {
+                    *p++ = ',';
+                }
+            }
+            // Sin columnas solo se escriben saltos: tambien hay que vaciar aca
+            if (p >= limite) {
+                archivo.write(bufer.data(), p - bufer.data());
+                total += p - bufer.data();
+                p = bufer.data();
+            }
+            *p++ = '\n';
+        }
+        archivo.write(bufer.data(), p - bufer.data());
+        total += p - bufer.data();
+        if (escritos) {
+            *escritos = total;
+        }
+        archivo.close();
+        return !archivo.fail();
+    }
+
+    static bool escribirCSV(const std::string& nombreArchivo, const double* datos, size_t filas,
+                            size_t columnas, size_t paso, Disposicion disposicion) {
+        size_t saltoFila = (disposicion == Disposicion::PorFilas) ? paso : 1;
+        size_t saltoColumna = (disposicion == Disposicion::PorFilas) ? 1 : paso;
+        return escribirFilasCSV(nombreArchivo, filas, columnas, saltoColumna,
+                                [&](size_t fila) { return datos + fila * saltoFila; });
+    }
+
+    // Las columnas comprimidas se decodifican de a bloques de filas a un
+    // tramo de ColumnaComprimida::bloque filas por todas las columnas, y cada
+    // fila se escribe desde ahi. Los indices logico -> fisico son los de la hoja.
+    static bool escribirCSV(const std::string& nombreArchivo, const std::vector<ColumnaComprimida>& comprimidas,
+                            const std::vector<size_t>& indiceFilas, const std::vector<size_t>& indiceColumnas,
+                            size_t filas, size_t columnas, size_t* escritos = nullptr) {
+        const size_t bloque = ColumnaComprimida::bloque;
+        std::vector<double> tramo(bloque * columnas);
+        return escribirFilasCSV(nombreArchivo, filas, columnas, bloque, [&](size_t fila) {
+            if (fila % bloque == 0) {
+                size_t largo = std::min(bloque, filas - fila);
+                for (size_t col = 0; col < columnas; ++col) {
+                    const ColumnaComprimida& columna = comprimidas[indiceColumnas.empty() ? col : indiceColumnas[col]];
+                    double* destino = tramo.data() + col * bloque;
+                    if (indiceFilas.empty()) {
+                        columna.copiar(fila, largo, destino);
+                    } else {
+                        for (size_t i = 0; i < largo; ++i) {
+                            destino[i] = columna.leer(indiceFilas[fila + i]);
+                        }
+                    }
+                }
+            }
+            return static_cast<const double*>(tramo.data() + fila % bloque);
+        }, escritos);
+    }
+
+    // Las filas dispersas se arman de a una en un bufer, con sus ceros
+    static bool escribirCSV(const std::string& nombreArchivo, const AlmacenDisperso& almacen,
+                            size_t filas, size_t columnas) {
+        std::vector<double> linea(columnas);
+        return escribirFilasCSV(nombreArchivo, filas, columnas, 1, [&](size_t fila) {
+            almacen.copiarFila(fila, 0, columnas, linea.data());
+            return static_cast<const double*>(linea.data());
+        });
+    }
+
+    static uint64_t clave(size_t fila, size_t columna) {
+        return (static_cast<uint64_t>(fila) << 32) | columna;
+    }
+
+    static size_t filaDe(uint64_t celda) {
+        return static_cast<size_t>(celda >> 32);
+    }
+
+    static size_t columnaDe(uint64_t celda) {
+        return static_cast<size_t>(celda & 0xffffffffu);
+    }
+
+    static void comprobarTamano(size_t filas, size_t columnas) {
+        if (filas > maximoLineas || columnas > maximoLineas) {
+            throw std::out_of_range("La hoja no admite mas de " + std::to_string(maximoLineas) + " filas o columnas");
+        }
+    }
+
+    template <typename Accion>
+    void recorrerReferencias(const Formula& formula, Accion accion) const {
+        for (const auto& instruccion : formula.codigo) {
+            if (instruccion.tipo == Instruccion::Tipo::Referencia && instruccion.rango.valido()) {
+                accion(instruccion.rango);
+            }
+        }
+    }
+
+    void conectar(uint64_t destino, const Formula& formula) {
+        recorrerReferencias(formula, [&](const Rango& rango) {
+            if (rango.cantidad() <= maximoExpandido) {
+                for (size_t fila = rango.fila1; fila <= rango.fila2; ++fila) {
+                    for (size_t col = rango.columna1; col <= rango.columna2; ++col) {
+                        dependientes[clave(fila, col)].push_back(destino);
+                    }
+                }
+            } else {
+                for (size_t col = rango.columna1; col <= rango.columna2; ++col) {
+                    rangosPorColumna[col].push_back({rango, destino});
+                }
+            }
+        });
+    }
+
+    void desconectar(uint64_t destino, const Formula& formula) {
+        recorrerReferencias(formula, [&](const Rango& rango) {
+            if (rango.cantidad() <= maximoExpandido) {
+                for (size_t fila = rango.fila1; fila <= rango.fila2; ++fila) {
+                    for (size_t col = rango.columna1; col <= rango.columna2; ++col) {
+                        auto it = dependientes.find(clave(fila, col));
+                        if (it == dependientes.end()) continue;
+                        auto& lista = it->second;
+                        lista.erase(std::remove(lista.begin(), lista.end(), destino), lista.end());
+                        if (lista.empty()) dependientes.erase(it);
+                    }
+                }
+            } else {
+                for (size_t col = rango.columna1; col <= rango.columna2; ++col) {
+                    auto it = rangosPorColumna.find(col);
+                    if (it == rangosPorColumna.end()) continue;
+                    auto& lista = it->second;
+                    lista.erase(std::remove_if(lista.begin(), lista.end(),
+                        [&](const std::pair<Rango, uint64_t>& entrada) { return entrada.second == destino; }), lista.end());
+                    if (lista.empty()) rangosPorColumna.erase(it);
+                }
+            }
+        });
+    }
+
+    void reconstruirGrafo() {
+        dependientes.clear();
+        rangosPorColumna.clear();
+        for (const auto& [celda, formula] : formulas) {
+            conectar(celda, formula);
+        }
+    }
+
+    void quitarFormula(uint64_t celda) {
+        auto it = formulas.find(celda);
+        if (it != formulas.end()) {
+            desconectar(celda, it->second);
+            formulas.erase(it);
+        }
+    }
+
+    void borrarFormulas() {
+        formulas.clear();
+        dependientes.clear();
+        rangosPorColumna.clear();
+    }
+
+    void agregarDependientes(uint64_t celda, std::vector<uint64_t>& salida) const {
+        auto directos = dependientes.find(celda);
+        if (directos != dependientes.end()) {
+            salida.insert(salida.end(), directos->second.begin(), directos->second.end());
+        }
+        auto porRango = rangosPorColumna.find(columnaDe(celda));
+        if (porRango != rangosPorColumna.end()) {
+            for (const auto& [rango, destino] : porRango->second) {
+                if (rango.contiene(filaDe(celda), columnaDe(celda))) {
+                    salida.push_back(destino);
+                }
+            }
+        }
+    }
+
+    // Orden topologico de todo lo que depende (directa o indirectamente) de
+    // los origenes, origenes incluidos. Es un recorrido en profundidad
+    // iterativo, para soportar cadenas largas; volver a una celda que aun
+    // esta en el camino actual significa que hay una referencia circular.
+    // Si se pasa 'adyacencia', ahi quedan los dependientes directos de cada celda, en el mismo orden.
+    std::vector<uint64_t> ordenarDependientes(const std::vector<uint64_t>& origenes,
+                                              std::vector<std::vector<uint64_t>>* adyacencia = nullptr) const {
+        struct Marco {
+            uint64_t celda;
+            std::vector<uint64_t> siguientes;
+            size_t visitados;
+        };
+        std::unordered_map<uint64_t, char> estado; // 1 = en el camino, 2 = terminada
+        std::vector<uint64_t> orden;
+        std::vector<Marco> pila;
+        auto entrar = [&](uint64_t celda) {
+            estado[celda] = 1;
+            pila.push_back({celda, {}, 0});
+            agregarDependientes(celda, pila.back().siguientes);
+        };
+        for (uint64_t origen : origenes) {
+            if (estado.count(origen) != 0) {
+                continue;
+            }
+            entrar(origen);
+            while (!pila.empty()) {
+                Marco& marco = pila.back();
+                if (marco.visitados < marco.siguientes.size()) {
+                    uint64_t siguiente = marco.siguientes[marco.visitados++];
+                    auto it = estado.find(siguiente);
+                    if (it == estado.end()) {
+                        entrar(siguiente);
+                    } else if (it->second == 1) {
+                        throw std::invalid_argument("Referencia circular en la celda F" + std::to_string(filaDe(siguiente)) +
+                                                    "C" + std::to_string(columnaDe(siguiente)));
+                    }
+                } else {
+                    estado[marco.celda] = 2;
+                    orden.push_back(marco.celda);
+                    if (adyacencia) {
+                        adyacencia->push_back(std::move(marco.siguientes));
+                    }
+                    pila.pop_back();
+                }
+            }
+        }
+        std::reverse(orden.begin(), orden.end());
+        if (adyacencia) {
+            std::reverse(adyacencia->begin(), adyacencia->end());
+        }
+        return orden;
+    }
+
+    // Vuelve a calcular solo las formulas alcanzadas desde los origenes. Se
+    // agrupan por nivel (uno mas que el mayor nivel de las celdas que leen
+    // dentro de este recalculo): las de un mismo nivel no dependen entre si,
+    // asi que con un grupo de hilos cada nivel se evalua en paralelo, en
+    // bloques que los hilos se roban entre ellos, y el resultado es el mismo
+    // que en serie. En el modo disperso una escritura puede crear un bloque,
+    // asi que ahi se evalua en este hilo.
+    void recalcular(const std::vector<uint64_t>& origenes) {
+        recalculo = EstadisticasRecalculo();
+        if (formulas.empty()) {
+            return;
+        }
+        auto inicio = std::chrono::steady_clock::now();
+        std::vector<std::vector<uint64_t>> adyacencia;
+        std::vector<uint64_t> orden = ordenarDependientes(origenes, &adyacencia);
+
+        std::unordered_map<uint64_t, size_t> nivel;
+        nivel.reserve(orden.size());
+        std::vector<std::vector<std::pair<uint64_t, const Formula*>>> porNivel;
+        for (size_t i = 0; i < orden.size(); ++i) {
+            uint64_t celda = orden[i];
+            size_t propio = nivel[celda];
+            auto formula = formulas.find(celda);
+            if (formula != formulas.end()) {
+                if (porNivel.size() <= propio) {
+                    porNivel.resize(propio + 1);
+                }
+                porNivel[propio].push_back({celda, &formula->second});
+            }
+            for (uint64_t siguiente : adyacencia[i]) {
+                size_t& suyo = nivel[siguiente];
+                suyo = std::max(suyo, propio + 1);
+            }
+        }
+
+        const size_t porBloque = 64;
+        double trabajo = 0.0;
+        auto inicioEvaluacion = std::chrono::steady_clock::now();
+        for (const auto& tareas : porNivel) {
+            if (tareas.empty()) {
+                continue;
+            }
+            ++recalculo.niveles;
+            recalculo.tareas += tareas.size();
+            size_t bloques = (grupo && !dispersa && tareas.size() >= minimoParalelo) ? (tareas.size() + porBloque - 1) / porBloque : 1;
+            size_t largoBloque = (tareas.size() + bloques - 1) / bloques;
+            std::vector<double> tiempos(bloques, 0.0);
+            if (bloques > 1) {
+                // Los indices y las versiones no admiten escrituras desde varios hilos
+                descomprimir();
+                indiceSumasAlDia = false;
+                indicesColumnasAlDia = false;
+                invalidarReducciones();
+            }
+            repartir(bloques, [&](size_t bloque) {
+                auto comienzo = std::chrono::steady_clock::now();
+                size_t hasta = std::min(tareas.size(), (bloque + 1) * largoBloque);
+                for (size_t i = bloque * largoBloque; i < hasta; ++i) {
+                    escribirCelda(filaDe(tareas[i].first), columnaDe(tareas[i].first), evaluar(*tareas[i].second), bloques == 1);
+                }
+                tiempos[bloque] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - comienzo).count();
+            });
+            for (double tiempo : tiempos) {
+                trabajo += tiempo;
+            }
+        }
+        auto fin = std::chrono::steady_clock::now();
+        double evaluacion = std::chrono::duration<double, std::milli>(fin - inicioEvaluacion).count();
+        recalculo.milisegundos = std::chrono::duration<double, std::milli>(fin - inicio).count();
+        recalculo.aceleracion = evaluacion > 0 ? trabajo / evaluacion : 1.0;
+    }
+
+    void recalcularTodas() {
+        std::vector<uint64_t> todas;
+        todas.reserve(formulas.size());
+        for (const auto& entrada : formulas) {
+            todas.push_back(entrada.first);
+        }
+        recalcular(todas);
+    }
+
+    // Tras eliminar la fila o columna 'index' se mueven las formulas que estaban
+    // despues y se corrigen sus referencias; las que apuntaban a lo eliminado
+    // quedan invalidas y los rangos que lo cubrian se achican. Con 'entrada'
+    // se guardan ahi, como estaban, las formulas de la linea eliminada y las
+    // que cambiaron alguna referencia (ver devolverFormulas). Solo se vuelven
+    // a conectar en el grafo las formulas que se movieron o cambiaron, y solo
+    // se recalculan las que cambiaron y lo que depende de ellas.
+    void reubicarFormulas(bool esFila, size_t index, EntradaDiario* entrada = nullptr) {
+        if (formulas.empty()) {
+            return;
+        }
+        auto ajustar = [index](size_t& desde, size_t& hasta) {
+            if (hasta < index) return true;
+            if (desde > index) {
+                --desde;
+                --hasta;
+                return true;
+            }
+            if (desde == hasta) return false;
+            --hasta;
+            return true;
+        };
+        auto tocaLinea = [&](const Formula& formula) {
+            for (const auto& instruccion : formula.codigo) {
+                const Rango& rango = instruccion.rango;
+                if (instruccion.tipo == Instruccion::Tipo::Referencia && rango.valido() &&
+                    (esFila ? rango.fila2 : rango.columna2) >= index) {
+                    return true;
+                }
+            }
+            return false;
+        };
+        std::vector<std::pair<uint64_t, Formula>> movidas;
+        std::vector<uint64_t> cambiadas;
+        for (auto it = formulas.begin(); it != formulas.end();) {
+            size_t fila = filaDe(it->first);
+            size_t col = columnaDe(it->first);
+            size_t& propia = esFila ? fila : col;
+            Formula& formula = it->second;
+            // Lo que esta antes de 'index' y lee solo celdas de antes queda igual
+            bool cambio = tocaLinea(formula);
+            if (propia < index && !cambio) {
+                ++it;
+                continue;
+            }
+            desconectar(it->first, formula);
+            if (propia == index) {
+                if (entrada) {
+                    entrada->ampliar().formulas.emplace_back(it->first, std::move(formula));
+                }
+                it = formulas.erase(it);
+                continue;
+            }
+            if (propia > index) {
+                --propia;
+            }
+            if (cambio) {
+                if (entrada) {
+                    entrada->ampliar().formulas.emplace_back(it->first, formula);
+                }
+                for (auto& instruccion : formula.codigo) {
+                    Rango& rango = instruccion.rango;
+                    if (instruccion.tipo != Instruccion::Tipo::Referencia || !rango.valido()) continue;
+                    // Lo que termina antes de 'index' queda igual
+                    if ((esFila ? rango.fila2 : rango.columna2) < index) continue;
+                    bool sigue = esFila ? ajustar(rango.fila1, rango.fila2) : ajustar(rango.columna1, rango.columna2);
+                    if (!sigue) {
+                        rango.fila1 = rango.columna1 = Rango::invalida;
+                    }
+                }
+                formula.texto = describirFormula(formula.codigo);
+                cambiadas.push_back(clave(fila, col));
+            }
+            movidas.emplace_back(clave(fila, col), std::move(formula));
+            it = formulas.erase(it);
+        }
+        for (auto& [celda, formula] : movidas) {
+            conectar(celda, formulas.emplace(celda, std::move(formula)).first->second);
+        }
+        if (!cambiadas.empty()) {
+            recalcular(cambiadas);
+        }
+    }
+
+    // Deshace reubicarFormulas una vez devuelta la linea 'index': las formulas
+    // desde ahi vuelven a correrse una posicion y las guardadas en la entrada
+    // quedan como estaban antes de eliminar. Solo se mueven las claves desde
+    // 'index' y solo se recalculan las guardadas y lo que depende de ellas:
+    // las demas leen las mismas celdas que antes y su valor no cambio.
+    void devolverFormulas(const EntradaDiario& entrada, bool esFila, size_t index) {
+        std::vector<std::pair<uint64_t, Formula>> movidas;
+        for (auto it = formulas.begin(); it != formulas.end();) {
+            size_t fila = filaDe(it->first);
+            size_t col = columnaDe(it->first);
+            size_t& propia = esFila ? fila : col;
+            if (propia < index) {
+                ++it;
+                continue;
+            }
+            ++propia;
+            desconectar(it->first, it->second);
+            movidas.emplace_back(clave(fila, col), std::move(it->second));
+            it = formulas.erase(it);
+        }
+        for (auto& [celda, formula] : movidas) {
+            conectar(celda, formulas.emplace(celda, std::move(formula)).first->second);
+        }
+        std::vector<uint64_t> restauradas;
+        if (entrada.detalle) {
+            for (const auto& guardada : entrada.detalle->formulas) {
+                quitarFormula(guardada.first);
+                conectar(guardada.first, formulas[guardada.first] = guardada.second);
+                restauradas.push_back(guardada.first);
+            }
+        }
+        if (!restauradas.empty()) {
+            recalcular(restauradas);
+        }
+        // Al recuperar, insertar la linea no mueve formulas: se registran todas
+        if (registroActivo()) {
+            ponerFormulas(*registro);
+            terminarRegistro();
+        }
+    }
+
+    // Reparte [0, n) en tramos de al menos 'minimo' para los hilos del grupo
+    size_t tramosPara(size_t n, size_t minimo) const {
+        return grupo ? std::max<size_t>(1, std::min(grupo->cantidad() * 4, n / minimo)) : 1;
+    }
+
+    // Orden de ordenar y agrupar: el de siempre, con los NaN al final
+    static bool antesEnOrden(double a, double b) {
+        return a < b || (b != b && a == a);
+    }
+
+    // Cambia todo el contenido por 'valores' (por filas), como una carga:
+    // sin formulas ni indices y sin poder deshacer lo anterior. Se conservan
+    // la disposicion y el modo disperso que tenia la hoja.
+    void reemplazarContenido(size_t filas, size_t columnas, const std::vector<double>& valores) {
+        Disposicion elegida = disposicion;
+        bool eraDispersa = dispersa;
+        soltarMapeo();
+        borrarFormulas();
+        dispersa = false;
+        disperso.limpiar();
+        olvidarIndices();
+        indiceSumasAlDia = false;
+        indicesColumnasAlDia = false;
+        disposicion = Disposicion::PorFilas;
+        numFilas = filas;
+        numColumnas = filas == 0 ? 0 : columnas;
+        paso = numColumnas;
+        celdas.assign(valores.begin(), valores.begin() + numFilas * numColumnas);
+        renovarVersiones();
+        limpiarDiario();
+        establecerDisposicion(elegida);
+        establecerDispersa(eraDispersa);
+        if (compresion) {
+            comprimirColumnas();
+        }
+        if (registroActivo()) {
+            puntoDeControl();
+        }
+    }
+
+    // La fila i pasa a tener lo que tenia la fila orden[i]. El bloque se
+    // recorre por tandas de columnas con un buffer de un cuarto de la hoja
+    // (y al menos una columna); cada tanda se junta y se vuelve a escribir en
+    // paralelo, en el lugar y con los indices como esten. Las formulas se
+    // mueven con su fila y las referencias a una sola fila la siguen; los
+    // rangos de varias filas quedan como estaban. Con 'entrada' se guardan
+    // ahi, en su celda de antes, las formulas cuyas referencias cambiaron.
+    void permutarFilas(const std::vector<uint32_t>& orden, EntradaDiario* entrada = nullptr) {
+        size_t n = numFilas;
+        // La inversa solo hace falta para mover celdas dispersas, indices y formulas
+        std::vector<uint32_t> destino;
+        if (dispersa || indexando() || !formulas.empty()) {
+            destino.resize(n);
+            for (size_t i = 0; i < n; ++i) {
+                destino[orden[i]] = static_cast<uint32_t>(i);
+            }
+        }
+        indiceSumasAlDia = false;
+        if (dispersa) {
+            disperso.permutarFilas(destino);
+        } else {
+            bool porFilas = disposicion == Disposicion::PorFilas;
+            size_t cuarto = n * numColumnas * sizeof(double) / 4;
+            size_t ancho = std::max<size_t>(1, cuarto / std::max<size_t>(1, n * sizeof(double)));
+            size_t tramos = tramosPara(n, 4096);
+            std::vector<double> tanda(n * std::min(ancho, numColumnas));
+            double* base = datos();
+            for (size_t primera = 0; primera < numColumnas; primera += ancho) {
+                size_t columnas = std::min(ancho, numColumnas - primera);
+                // Por filas la tanda guarda juntas las celdas de cada fila; por columnas, cada columna
+                auto enTanda = [&](size_t fila, size_t col) { return porFilas ? fila * columnas + col : col * n + fila; };
+                repartir(tramos, [&](size_t t) {
+                    for (size_t fila = n * t / tramos; fila < n * (t + 1) / tramos; ++fila) {
+                        for (size_t col = 0; col < columnas; ++col) {
+                            tanda[enTanda(fila, col)] = base[posicion(orden[fila], primera + col)];
+                        }
+                    }
+                });
+                repartir(tramos, [&](size_t t) {
+                    for (size_t fila = n * t / tramos; fila < n * (t + 1) / tramos; ++fila) {
+                        for (size_t col = 0; col < columnas; ++col) {
+                            base[posicion(fila, primera + col)] = tanda[enTanda(fila, col)];
+                        }
+                    }
+                });
+            }
+        }
+        std::vector<uint64_t> versiones(n);
+        for (size_t i = 0; i < n; ++i) {
+            versiones[i] = versionFilas[orden[i]];
+        }
+        versionFilas.swap(versiones);
+        epocaFilas = ++reloj;
+        if (indexando()) {
+            for (auto& [columna, indice] : indicesColumnas) {
+                indice.permutar(destino);
+            }
+        }
+
+        if (!formulas.empty()) {
+            std::unordered_map<uint64_t, Formula> movidas;
+            for (auto& [celda, formula] : formulas) {
+                bool cambio = false;
+                for (auto& instruccion : formula.codigo) {
+                    Rango& rango = instruccion.rango;
+                    if (instruccion.tipo == Instruccion::Tipo::Referencia && rango.valido() &&
+                        rango.fila1 == rango.fila2 && rango.fila1 < n && destino[rango.fila1] != rango.fila1) {
+                        if (!cambio && entrada) {
+                            entrada->ampliar().formulas.emplace_back(celda, formula);
+                        }
+                        cambio = true;
+                        rango.fila1 = rango.fila2 = destino[rango.fila1];
+                    }
+                }
+                if (cambio) {
+                    formula.texto = describirFormula(formula.codigo);
+                }
+                movidas.emplace(clave(destino[filaDe(celda)], columnaDe(celda)), std::move(formula));
+            }
+            formulas.swap(movidas);
+            reconstruirGrafo();
+            recalcularTodas();
+        }
+        if (registroActivo()) {
+            registro->empezar(RegistroEscritura::Tipo::OrdenFilas);
+            registro->ponerEntero(n);
+            registro->ponerBytes(orden.data(), n * sizeof(uint32_t));
+            terminarRegistro();
+        }
+    }
+
+    bool diarioActivo() const {
+        return anotando && presupuestoDiario > 0;
+    }
+
+    // Agrega la formula de la celda, si tiene, a la entrada del diario
+    void guardarFormula(EntradaDiario& entrada, uint64_t celda) const {
+        auto existente = formulas.find(celda);
+        if (existente != formulas.end()) {
+            entrada.ampliar().formulas.emplace_back(celda, existente->second);
+        }
+    }
+
+    void anotar(EntradaDiario&& entrada) {
+        for (const auto& rehacible : rehacibles) {
+            bytesDiario -= rehacible.bytes();
+        }
+        rehacibles.clear();
+        size_t bytes = entrada.bytes();
+        if (bytes > presupuestoDiario) {
+            // No entra: lo anterior ya no se puede deshacer en orden
+            limpiarDiario();
+            return;
+        }
+        deshacibles.push_back(std::move(entrada));
+        bytesDiario += bytes;
+        while (bytesDiario > presupuestoDiario) {
+            bytesDiario -= deshacibles.front().bytes();
+            deshacibles.pop_front();
+        }
+    }
+
+    // Vuelve a poner las formulas guardadas en la entrada en lugar de las
+    // que haya en sus celdas
+    void restaurarFormulas(const EntradaDiario& entrada) {
+        if (!entrada.detalle) {
+            return;
+        }
+        const auto& guardadas = entrada.detalle->formulas;
+        std::vector<uint64_t> origenes;
+        for (const auto& guardada : guardadas) {
+            quitarFormula(guardada.first);
+            conectar(guardada.first, formulas[guardada.first] = guardada.second);
+            origenes.push_back(guardada.first);
+        }
+        if (!origenes.empty()) {
+            recalcular(origenes);
+        }
+        for (size_t i = 0; i < guardadas.size() && registroActivo(); ++i) {
+            registrarFormula(guardadas[i].first >> 32, guardadas[i].first & 0xffffffffULL);
+        }
+    }
+
+    // Vuelve a poner una fila eliminada en 'index' (para deshacer). En el
+    // bloque contiguo, si su hueco sigue ahi, basta con devolverlo al indice
+    // logico -> fisico; si no, la fila se agrega al final y se mueve solo su
+    // entrada en el indice. En el disperso se corren los bloques.
+    void insertarFila(size_t index, const DetalleDiario& detalle) {
+        const std::vector<double>& valores = detalle.anteriores;
+        // El indice de sumas recibe la fila entera en el hueco que dejo al
+        // eliminarla; mientras tanto las escrituras no lo tocan
+        bool sumasAlDia = indiceSumasAlDia && valores.size() == numColumnas && indiceSumas.insertarFila(index, valores.data());
+        indiceSumasAlDia = false;
+        if (!dispersa && detalle.generacion == generacionIndices && !indiceFilas.empty()) {
+            indiceFilas.insert(indiceFilas.begin() + index, detalle.fisica);
+            versionFilas.insert(versionFilas.begin() + index, ++reloj);
+            epocaFilas = ++reloj;
+            ++numFilas;
+            if (indexando()) {
+                for (auto& [columna, indice] : indicesColumnas) {
+                    indice.insertarFila(index, leerCelda(index, columna));
+                }
+            }
+            indiceSumasAlDia = sumasAlDia;
+            return;
+        }
+        agregarFila();
+        while (numColumnas < valores.size()) {
+            agregarColumna();
+        }
+        if (index + 1 < numFilas) {
+            if (dispersa) {
+                disperso.insertar(true, index);
+            } else {
+                if (indiceFilas.empty()) {
+                    indiceFilas.resize(numFilas);
+                    std::iota(indiceFilas.begin(), indiceFilas.end(), size_t(0));
+                    filasAlmacenadas = numFilas;
+                }
+                std::rotate(indiceFilas.begin() + index, indiceFilas.end() - 1, indiceFilas.end());
+            }
+            std::rotate(versionFilas.begin() + index, versionFilas.end() - 1, versionFilas.end());
+            // La fila vacia que agrego agregarFila al final pasa a 'index'
+            if (indexando()) {
+                for (auto& [columna, indice] : indicesColumnas) {
+                    indice.eliminarFila(numFilas - 1, 0.0);
+                    indice.insertarFila(index, 0.0);
+                }
+            }
+        }
+        for (size_t col = 0; col < valores.size(); ++col) {
+            escribirCelda(index, col, valores[col]);
+        }
+        indiceSumasAlDia = sumasAlDia;
+    }
+
+    void insertarColumna(size_t index, const DetalleDiario& detalle) {
+        const std::vector<double>& valores = detalle.anteriores;
+        bool sumasAlDia = indiceSumasAlDia && valores.size() == numFilas;
+        if (sumasAlDia) {
+            indiceSumas.insertarColumna(index, valores.data());
+        }
+        indiceSumasAlDia = false;
+        correrIndicesColumnas(index, true);
+        if (!dispersa && detalle.generacion == generacionIndices && !indiceColumnas.empty()) {
+            indiceColumnas.insert(indiceColumnas.begin() + index, detalle.fisica);
+            versionColumnas.insert(versionColumnas.begin() + index, ++reloj);
+            epocaColumnas = ++reloj;
+            ++numColumnas;
+            indiceSumasAlDia = sumasAlDia;
+            return;
+        }
+        agregarColumna();
+        if (index + 1 < numColumnas) {
+            if (dispersa) {
+                disperso.insertar(false, index);
+            } else {
+                if (indiceColumnas.empty()) {
+                    indiceColumnas.resize(numColumnas);
+                    std::iota(indiceColumnas.begin(), indiceColumnas.end(), size_t(0));
+                    columnasAlmacenadas = numColumnas;
+                }
+                std::rotate(indiceColumnas.begin() + index, indiceColumnas.end() - 1, indiceColumnas.end());
+            }
+            std::rotate(versionColumnas.begin() + index, versionColumnas.end() - 1, versionColumnas.end());
+        }
+        for (size_t fila = 0; fila < valores.size(); ++fila) {
+            escribirCelda(fila, index, valores[fila]);
+        }
+        indiceSumasAlDia = sumasAlDia;
+    }
+
+    void aplicarInversa(const EntradaDiario& entrada) {
+        using Tipo = EntradaDiario::Tipo;
+        switch (entrada.tipo) {
+            case Tipo::Celda:
+                actualizarCelda(entrada.fila, entrada.columna, entrada.anterior);
+                restaurarFormulas(entrada);
+                break;
+            case Tipo::Celdas: {
+                // Al reves, para que en una celda repetida quede el primer valor anterior
+                const DetalleDiario& detalle = *entrada.detalle;
+                size_t n = detalle.cambios.size();
+                std::vector<Actualizacion> inversas(n);
+                for (size_t i = 0; i < n; ++i) {
+                    inversas[n - 1 - i] = {detalle.cambios[i].fila, detalle.cambios[i].columna, detalle.anteriores[i]};
+                }
+                actualizarCeldas(inversas);
+                restaurarFormulas(entrada);
+                break;
+            }
+            case Tipo::Bloque:
+                actualizarBloque(entrada.fila, entrada.columna, entrada.detalle->filas, entrada.detalle->columnas, entrada.detalle->anteriores);
+                restaurarFormulas(entrada);
+                break;
+            case Tipo::Formula:
+                if (entrada.detalle->formulas.empty()) {
+                    actualizarCelda(entrada.fila, entrada.columna, entrada.anterior);
+                } else {
+                    restaurarFormulas(entrada);
+                }
+                break;
+            case Tipo::AgregarFila:
+                eliminarFila(numFilas - 1);
+                break;
+            case Tipo::AgregarColumna:
+                eliminarColumna(numColumnas - 1);
+                break;
+            case Tipo::EliminarFila:
+                {
+                    SinRegistro pausa(registrando);
+                    insertarFila(entrada.fila, *entrada.detalle);
+                }
+                registrarInsercion(RegistroEscritura::Tipo::InsertarFila, entrada.fila, entrada.detalle->anteriores);
+                if (!formulas.empty() || !entrada.detalle->formulas.empty()) {
+                    devolverFormulas(entrada, true, entrada.fila);
+                }
+                break;
+            case Tipo::EliminarColumna:
+                {
+                    SinRegistro pausa(registrando);
+                    insertarColumna(entrada.columna, *entrada.detalle);
+                }
+                registrarInsercion(RegistroEscritura::Tipo::InsertarColumna, entrada.columna, entrada.detalle->anteriores);
+                if (!formulas.empty() || !entrada.detalle->formulas.empty()) {
+                    devolverFormulas(entrada, false, entrada.columna);
+                }
+                break;
+            case Tipo::Ordenar: {
+                const std::vector<uint32_t>& orden = entrada.detalle->orden;
+                std::vector<uint32_t> inversa(orden.size());
+                for (size_t i = 0; i < orden.size(); ++i) {
+                    inversa[orden[i]] = static_cast<uint32_t>(i);
+                }
+                // Las referencias ya vuelven con la permutacion inversa; las
+                // guardadas devuelven ademas el texto como se escribio
+                permutarFilas(inversa);
+                restaurarFormulas(entrada);
+                break;
+            }
+        }
+    }
+
+    void aplicarDeNuevo(const EntradaDiario& entrada) {
+        using Tipo = EntradaDiario::Tipo;
+        switch (entrada.tipo) {
+            case Tipo::Celda:
+                actualizarCelda(entrada.fila, entrada.columna, entrada.nuevo);
+                break;
+            case Tipo::Celdas:
+                actualizarCeldas(entrada.detalle->cambios);
+                break;
+            case Tipo::Bloque:
+                actualizarBloque(entrada.fila, entrada.columna, entrada.detalle->filas, entrada.detalle->columnas, entrada.detalle->nuevos);
+                break;
+            case Tipo::Formula:
+                if (entrada.detalle->texto.empty()) {
+                    eliminarFormula(entrada.fila, entrada.columna);
+                } else {
+                    establecerFormula(entrada.fila, entrada.columna, entrada.detalle->texto);
+                }
+                break;
+            case Tipo::AgregarFila:
+                agregarFila();
+                break;
+            case Tipo::AgregarColumna:
+                agregarColumna();
+                break;
+            case Tipo::EliminarFila:
+                eliminarFila(entrada.fila);
+                break;
+            case Tipo::EliminarColumna:
+                eliminarColumna(entrada.columna);
+                break;
+            case Tipo::Ordenar:
+                permutarFilas(entrada.detalle->orden);
+                break;
+        }
+    }
+
+    bool registroActivo() const {
+        return registro && registrando;
+    }
+
+    static void ponerFormula(RegistroEscritura& destino, const Formula& formula) {
+        destino.ponerEntero(formula.texto.size());
+        destino.ponerBytes(formula.texto.data(), formula.texto.size());
+        destino.ponerEntero(formula.codigo.size());
+        for (const auto& instruccion : formula.codigo) {
+            destino.ponerEntero(static_cast<uint64_t>(instruccion.tipo));
+            destino.ponerEntero(static_cast<uint64_t>(instruccion.funcion));
+            destino.ponerEntero(instruccion.argumentos);
+            destino.ponerReal(instruccion.numero);
+            destino.ponerEntero(instruccion.rango.fila1);
+            destino.ponerEntero(instruccion.rango.columna1);
+            destino.ponerEntero(instruccion.rango.fila2);
+            destino.ponerEntero(instruccion.rango.columna2);
+        }
+    }
+
+    static Formula leerFormula(RegistroEscritura::Lector& lector) {
+        Formula formula;
+        formula.texto.resize(lector.entero());
+        lector.bytes(&formula.texto[0], formula.texto.size());
+        formula.codigo.resize(lector.entero());
+        for (auto& instruccion : formula.codigo) {
+            instruccion.tipo = static_cast<Instruccion::Tipo>(lector.entero());
+            instruccion.funcion = static_cast<FuncionRango>(lector.entero());
+            instruccion.argumentos = static_cast<unsigned>(lector.entero());
+            instruccion.numero = lector.real();
+            instruccion.rango.fila1 = lector.entero();
+            instruccion.rango.columna1 = lector.entero();
+            instruccion.rango.fila2 = lector.entero();
+            instruccion.rango.columna2 = lector.entero();
+        }
+        return formula;
+    }
+
+    // Todas las formulas, como primer registro despues de un punto de control
+    // o al deshacer la eliminacion de una linea
+    void ponerFormulas(RegistroEscritura& destino) const {
+        destino.empezar(RegistroEscritura::Tipo::Formulas);
+        destino.ponerEntero(formulas.size());
+        for (const auto& formula : formulas) {
+            destino.ponerEntero(formula.first);
+            ponerFormula(destino, formula.second);
+        }
+    }
+
+    void registrarFormula(size_t fila, size_t columna) {
+        registro->empezar(RegistroEscritura::Tipo::Formula);
+        registro->ponerEntero(fila);
+        registro->ponerEntero(columna);
+        ponerFormula(*registro, formulas.at(clave(fila, columna)));
+        terminarRegistro();
+    }
+
+    // Una linea devuelta a su lugar al deshacer, con sus valores
+    void registrarInsercion(RegistroEscritura::Tipo tipo, size_t index, const std::vector<double>& valores) {
+        if (!registroActivo()) {
+            return;
+        }
+        registro->empezar(tipo);
+        registro->ponerEntero(index);
+        registro->ponerEntero(valores.size());
+        registro->ponerBytes(valores.data(), valores.size() * sizeof(double));
+        terminarRegistro();
+    }
+
+    // Cierra el registro empezado. Cuando el archivo pesa mas que la foto
+    // (y que minimoPuntoControl) se hace un punto de control, asi reescribir
+    // la foto cuesta a lo sumo tanto como lo ya registrado.
+    void terminarRegistro() {
+        if (registro->terminar() > std::max(minimoPuntoControl, numFilas * numColumnas * sizeof(double))) {
+            puntoDeControl();
+        }
+    }
+
+    // Vuelve a hacer un cambio leido del registro, al recuperar
+    void aplicarRegistro(RegistroEscritura::Lector& lector) {
+        using Tipo = RegistroEscritura::Tipo;
+        Tipo tipo = lector.tipo();
+        switch (tipo) {
+            case Tipo::Celda: {
+                size_t fila = lector.entero();
+                size_t columna = lector.entero();
+                actualizarCelda(fila, columna, lector.real());
+                break;
+            }
+            case Tipo::Celdas: {
+                std::vector<Actualizacion> cambios(lector.entero());
+                lector.bytes(cambios.data(), cambios.size() * sizeof(Actualizacion));
+                actualizarCeldas(cambios);
+                break;
+            }
+            case Tipo::Bloque: {
+                size_t fila = lector.entero();
+                size_t columna = lector.entero();
+                size_t filas = lector.entero();
+                size_t columnas = lector.entero();
+                std::vector<double> valores(filas * columnas);
+                lector.bytes(valores.data(), valores.size() * sizeof(double));
+                actualizarBloque(fila, columna, filas, columnas, valores);
+                break;
+            }
+            case Tipo::AgregarFila:
+                agregarFila();
+                break;
+            case Tipo::EliminarFila:
+                eliminarFila(lector.entero());
+                break;
+            case Tipo::AgregarColumna:
+                agregarColumna();
+                break;
+            case Tipo::EliminarColumna:
+                eliminarColumna(lector.entero());
+                break;
+            case Tipo::InsertarFila:
+            case Tipo::InsertarColumna: {
+                size_t index = lector.entero();
+                DetalleDiario detalle;
+                detalle.anteriores.resize(lector.entero());
+                lector.bytes(detalle.anteriores.data(), detalle.anteriores.size() * sizeof(double));
+                if ((tipo == Tipo::InsertarFila ? index > numFilas : index > numColumnas)) {
+                    throw std::out_of_range("Indice de linea fuera de rango en el registro");
+                }
+                if (tipo == Tipo::InsertarFila) {
+                    insertarFila(index, detalle);
+                } else {
+                    insertarColumna(index, detalle);
+                }
+                break;
+            }
+            case Tipo::Formula: {
+                size_t fila = lector.entero();
+                size_t columna = lector.entero();
+                uint64_t celda = clave(fila, columna);
+                quitarFormula(celda);
+                conectar(celda, formulas[celda] = leerFormula(lector));
+                recalcular({celda});
+                break;
+            }
+            case Tipo::EliminarFormula: {
+                size_t fila = lector.entero();
+                eliminarFormula(fila, lector.entero());
+                break;
+            }
+            case Tipo::Formulas: {
+                borrarFormulas();
+                size_t cantidad = lector.entero();
+                for (size_t i = 0; i < cantidad; ++i) {
+                    uint64_t celda = lector.entero();
+                    conectar(celda, formulas[celda] = leerFormula(lector));
+                }
+                recalcularTodas();
+                break;
+            }
+            case Tipo::OrdenFilas: {
+                std::vector<uint32_t> orden(lector.entero());
+                lector.bytes(orden.data(), orden.size() * sizeof(uint32_t));
+                if (orden.size() != numFilas) {
+                    throw std::out_of_range("Orden de filas que no coincide con la hoja en el registro");
+                }
+                permutarFilas(orden);
+                break;
+            }
+            default:
+                throw std::runtime_error("Tipo de registro desconocido");
+        }
+    }
+
+    // Guarda la hoja en el formato binario (ver guardarBinario) con el numero
+    // de punto de control en la cabecera
+    bool escribirBinario(const std::string& nombreArchivo, uint64_t puntoControl) const {
+        std::ofstream archivo(nombreArchivo, std::ios::binary);
+        if (!archivo.is_open()) {
+            std::cerr << "No se pudo abrir el archivo para guardar." << std::endl;
+            return false;
+        }
+        CabeceraBinaria cabecera = {};
+        std::memcpy(cabecera.magia, magiaBinaria, sizeof(magiaBinaria));
+        cabecera.version = versionBinaria;
+        bool porFilas = dispersa || comprimida() || indirecta();
+        cabecera.disposicion = (porFilas || disposicion == Disposicion::PorFilas) ? 0 : 1;
+        cabecera.filas = numFilas;
+        cabecera.columnas = numColumnas;
+        cabecera.puntoControl = puntoControl;
+        instrumentacion.escritos(sizeof(cabecera) + numFilas * numColumnas * sizeof(double));
+
+        if (porFilas) {
+            std::vector<double> linea(numColumnas);
+            SumaVerificacion suma;
+            for (size_t fila = 0; fila < numFilas; ++fila) {
+                copiarFila(fila, 0, numColumnas, linea.data());
+                suma.agregar(linea.data(), numColumnas * sizeof(double));
+            }
+            cabecera.suma = suma.valor();
+            archivo.write(reinterpret_cast<const char*>(&cabecera), sizeof(cabecera));
+            for (size_t fila = 0; fila < numFilas; ++fila) {
+                copiarFila(fila, 0, numColumnas, linea.data());
+                archivo.write(reinterpret_cast<const char*>(linea.data()), numColumnas * sizeof(double));
+            }
+            archivo.close();
+            if (archivo.fail()) {
+                std::cerr << "Error al escribir el archivo binario." << std::endl;
+                return false;
+            }
+            return true;
+        }
+
+        size_t largo = largoLinea() * sizeof(double);
+        SumaVerificacion suma;
+        for (size_t linea = 0; linea < lineas(); ++linea) {
+            suma.agregar(datos() + linea * paso, largo);
+        }
+        cabecera.suma = suma.valor();
+
+        archivo.write(reinterpret_cast<const char*>(&cabecera), sizeof(cabecera));
+        if (paso == largoLinea()) {
+            archivo.write(reinterpret_cast<const char*>(datos()), lineas() * largo);
+        } else {
+            for (size_t linea = 0; linea < lineas(); ++linea) {
+                archivo.write(reinterpret_cast<const char*>(datos() + linea * paso), largo);
+            }
+        }
+        archivo.close();
+        if (archivo.fail()) {
+            std::cerr << "Error al escribir el archivo binario." << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+
+    // Acumula un rango recorriendolo por tramos contiguos (filas o columnas
+    // segun la disposicion), copiando solo los que pasan por un indice o son
+    // dispersos. Con 'paralelo' los tramos se reparten entre los hilos en
+    // grupos fijos que se unen en orden, asi el resultado no depende de
+    // cuantos hilos haya. Las formulas lo llaman sin 'paralelo' porque ya
+    // pueden estar corriendo dentro del grupo.
+    Acumulado acumularRango(const Rango& rango, bool paralelo) const {
+        if (comprimida() && indiceFilas.empty()) {
+            return acumularComprimido(rango, paralelo);
+        }
+        bool porFilas = dispersa || comprimida() || disposicion == Disposicion::PorFilas;
+        size_t tramos = porFilas ? rango.fila2 - rango.fila1 + 1 : rango.columna2 - rango.columna1 + 1;
+        size_t largo = porFilas ? rango.columna2 - rango.columna1 + 1 : rango.fila2 - rango.fila1 + 1;
+        // Cada tramo es contiguo salvo que sus posiciones pasen por un indice
+        bool copiar = dispersa || comprimida() || !(porFilas ? indiceColumnas : indiceFilas).empty();
+        // Los tramos que quedan uno detras del otro en memoria (lineas enteras
+        // sin holgura) se acumulan como una sola corrida.
+        auto acumularTramos = [&](size_t desde, size_t hasta) {
+            thread_local std::vector<double> copia;
+            Acumulado acumulado;
+            const double* corrida = nullptr;
+            size_t largoCorrida = 0;
+            for (size_t i = desde; i < hasta; ++i) {
+                if (copiar) {
+                    copia.resize(largo);
+                    if (porFilas) {
+                        copiarFila(rango.fila1 + i, rango.columna1, largo, copia.data());
+                    } else {
+                        copiarColumna(rango.fila1, rango.columna1 + i, largo, copia.data());
+                    }
+                    acumulado.unir(acumularContiguo(copia.data(), largo));
+                    continue;
+                }
+                const double* tramo = datos() + (porFilas ? posicion(rango.fila1 + i, rango.columna1) : posicion(rango.fila1, rango.columna1 + i));
+                if (tramo != corrida + largoCorrida) {
+                    acumulado.unir(acumularContiguo(corrida, largoCorrida));
+                    corrida = tramo;
+                    largoCorrida = 0;
+                }
+                largoCorrida += largo;
+            }
+            acumulado.unir(acumularContiguo(corrida, largoCorrida));
+            return acumulado;
+        };
+        // Grupos de unas 64K celdas
+        size_t porGrupo = std::max<size_t>(1, (size_t(1) << 16) / std::max<size_t>(largo, 1));
+        size_t grupos = (tramos + porGrupo - 1) / porGrupo;
+        if (!paralelo || grupos < 2) {
+            return acumularTramos(0, tramos);
+        }
+        std::vector<Acumulado> partes(grupos);
+        repartir(grupos, [&](size_t g) {
+            partes[g] = acumularTramos(g * porGrupo, std::min(tramos, (g + 1) * porGrupo));
+        });
+        Acumulado total;
+        for (const auto& parte : partes) {
+            total.unir(parte);
+        }
+        return total;
+    }
+
+    // Lo mismo sobre las columnas comprimidas: cada una junta los resumenes
+    // de sus bloques y solo descomprime los de las puntas
+    Acumulado acumularComprimido(const Rango& rango, bool paralelo) const {
+        size_t columnas = rango.columna2 - rango.columna1 + 1;
+        std::vector<Acumulado> partes(columnas);
+        auto acumularColumna = [&](size_t c) {
+            size_t columna = rango.columna1 + c;
+            partes[c] = comprimidas[indiceColumnas.empty() ? columna : indiceColumnas[columna]].acumular(rango.fila1, rango.fila2 + 1);
+        };
+        if (paralelo) {
+            repartir(columnas, acumularColumna);
+        } else {
+            for (size_t c = 0; c < columnas; ++c) {
+                acumularColumna(c);
+            }
+        }
+        Acumulado total;
+        for (const auto& parte : partes) {
+            total.unir(parte);
+        }
+        return total;
+    }
+
+    Parcial resumirRango(const Rango& rango) const {
+        Acumulado acumulado = acumularRango(rango, false);
+        return {acumulado.total(), acumulado.minimo, acumulado.maximo, rango.cantidad()};
+    }
+
+    // Evalua el codigo postfijo de una formula. Las referencias invalidas y
+    // las divisiones por cero dan NaN en lugar de lanzar, para no cortar un recalculo.
+    double evaluar(const Formula& formula) const {
+        const double nan = std::numeric_limits<double>::quiet_NaN();
+        auto escalar = [](double valor) { return Parcial{valor, valor, valor, 1}; };
+        thread_local std::vector<Parcial> pila;
+        pila.clear();
+        for (const auto& instruccion : formula.codigo) {
+            switch (instruccion.tipo) {
+                case Instruccion::Tipo::Numero:
+                    pila.push_back(escalar(instruccion.numero));
+                    break;
+                case Instruccion::Tipo::Referencia: {
+                    const Rango& rango = instruccion.rango;
+                    if (!rango.valido()) pila.push_back(escalar(nan));
+                    else if (rango.esCelda()) pila.push_back(escalar(leerCelda(rango.fila1, rango.columna1)));
+                    else pila.push_back(resumirRango(rango));
+                    break;
+                }
+                case Instruccion::Tipo::Negacion:
+                    pila.back() = escalar(-pila.back().suma);
+                    break;
+                case Instruccion::Tipo::Funcion: {
+                    Parcial total = {0.0, std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity(), 0};
+                    for (size_t i = pila.size() - instruccion.argumentos; i < pila.size(); ++i) {
+                        total.suma += pila[i].suma;
+                        total.minimo = std::min(total.minimo, pila[i].minimo);
+                        total.maximo = std::max(total.maximo, pila[i].maximo);
+                        total.cuenta += pila[i].cuenta;
+                    }
+                    pila.resize(pila.size() - instruccion.argumentos);
+                    double valor = nan;
+                    switch (instruccion.funcion) {
+                        case FuncionRango::Suma: valor = total.suma; break;
+                        case FuncionRango::Minimo: valor = total.cuenta ? total.minimo : nan; break;
+                        case FuncionRango::Maximo: valor = total.cuenta ? total.maximo : nan; break;
+                        case FuncionRango::Promedio: valor = total.cuenta ? total.suma / total.cuenta : nan; break;
+                        case FuncionRango::Contar: valor = static_cast<double>(total.cuenta); break;
+                    }
+                    pila.push_back(escalar(valor));
+                    break;
+                }
+                default: {
+                    double derecho = pila.back().suma;
+                    pila.pop_back();
+                    double valor = pila.back().suma;
+                    switch (instruccion.tipo) {
+                        case Instruccion::Tipo::Suma: valor += derecho; break;
+                        case Instruccion::Tipo::Resta: valor -= derecho; break;
+                        case Instruccion::Tipo::Producto: valor *= derecho; break;
+                        default: valor = (derecho != 0) ? valor / derecho : nan; break;
+                    }
+                    pila.back() = escalar(valor);
+                    break;
+                }
+            }
+        }
+        return pila.back().suma;
+    }
+public:
+    // 'memoria' da el espacio de las celdas; por defecto es el de todo el
+    // programa. LibroCalculo pasa la arena de cada hoja.
+    explicit HojaCalculo(std::pmr::memory_resource* memoria = std::pmr::get_default_resource())
+        : memoria(memoria), celdas(memoria), disperso(memoria) {}
+
+    // Cantidad de hilos para las operaciones paralelas; 0 usa todos los nucleos
+    void establecerHilos(size_t cantidad) {
+        if (cantidad == 0) {
+            cantidad = std::max(1u, std::thread::hardware_concurrency());
+        }
+        hilos = cantidad;
+        grupo = (hilos > 1) ? std::make_shared<GrupoHilos>(hilos) : nullptr;
+    }
+
+    size_t obtenerHilos() const {
+        return hilos;
+    }
+
+    void establecerAvisos(bool activar) {
+        avisos = activar;
+    }
+
+    // En los modos disperso y comprimido solo se recuerda; se aplica al
+    // volver al bloque contiguo
+    void establecerDisposicion(Disposicion nueva) {
+        if (nueva == disposicion) {
+            return;
+        }
+        invalidarReducciones();
+        if (dispersa || comprimida()) {
+            disposicion = nueva;
+            return;
+        }
+        quitarHuecos();
+        materializar();
+        // Transposicion por bloques para no saltar por toda la memoria
+        const size_t bloque = 64;
+        size_t nuevoPaso = (nueva == Disposicion::PorFilas) ? numColumnas : numFilas;
+        size_t nuevasLineas = (nueva == Disposicion::PorFilas) ? numFilas : numColumnas;
+        std::pmr::vector<double> nuevas(nuevasLineas * nuevoPaso, 0.0, memoria);
+        for (size_t f0 = 0; f0 < numFilas; f0 += bloque) {
+            for (size_t c0 = 0; c0 < numColumnas; c0 += bloque) {
+                size_t f1 = std::min(f0 + bloque, numFilas);
+                size_t c1 = std::min(c0 + bloque, numColumnas);
+                for (size_t fila = f0; fila < f1; ++fila) {
+                    for (size_t col = c0; col < c1; ++col) {
+                        size_t destino = (nueva == Disposicion::PorFilas) ? fila * nuevoPaso + col : col * nuevoPaso + fila;
+                        nuevas[destino] = celdas[posicion(fila, col)];
+                    }
+                }
+            }
+        }
+        celdas.swap(nuevas);
+        paso = nuevoPaso;
+        disposicion = nueva;
+    }
+
+    Disposicion obtenerDisposicion() const {
+        return disposicion;
+    }
+
+    // Pasa las celdas al almacenamiento disperso por bloques, o de vuelta al
+    // bloque contiguo. Conviene para hojas grandes con pocas celdas ocupadas.
+    void establecerDispersa(bool activar) {
+        if (activar == dispersa) {
+            return;
+        }
+        invalidarReducciones();
+        if (activar) {
+            quitarHuecos();
+            disperso.limpiar();
+            for (size_t fila = 0; fila < numFilas; ++fila) {
+                for (size_t col = 0; col < numColumnas; ++col) {
+                    disperso.escribir(fila, col, datos()[posicion(fila, col)]);
+                }
+            }
+            soltarMapeo();
+            celdas.clear();
+            celdas.shrink_to_fit();
+            paso = 0;
+        } else {
+            paso = largoLinea();
+            celdas.assign(lineas() * paso, 0.0);
+            disperso.recorrer([&](size_t fila, size_t col, double valor) {
+                celdas[posicion(fila, col)] = valor;
+            });
+            disperso.limpiar();
+        }
+        dispersa = activar;
+    }
+
+    bool esDispersa() const {
+        return dispersa;
+    }
+
+    // Guarda cada columna con la codificacion que ocupe menos (ver
+    // ColumnaComprimida), ahora y despues de cada cargarCSV. Las lecturas,
+    // los guardados y las estadisticas de rango trabajan sobre las columnas
+    // comprimidas. Escribir una celda deja cruda solo su columna; agregar
+    // filas o columnas descomprime la hoja entera, y eliminarlas la deja
+    // comprimida con huecos que compactar() saca volviendo a comprimir.
+    // establecerCompresion(true) vuelve a comprimir lo que haya quedado
+    // crudo y apagarla descomprime.
+    // En el modo disperso no se comprime.
+    void establecerCompresion(bool activar) {
+        compresion = activar;
+        if (activar) {
+            comprimirColumnas();
+        } else {
+            descomprimir();
+        }
+    }
+
+    bool esComprimida() const {
+        return comprimida();
+    }
+
+    // Codificacion, bytes y razon de compresion de cada columna; vacio si la
+    // hoja no esta comprimida
+    std::vector<EstadisticasColumnaComprimida> estadisticasCompresion() const {
+        std::vector<EstadisticasColumnaComprimida> resultado;
+        for (size_t col = 0; col < numColumnas && comprimida(); ++col) {
+            const ColumnaComprimida& columna = comprimidas[indiceColumnas.empty() ? col : indiceColumnas[col]];
+            size_t crudos = columna.cantidad() * sizeof(double);
+            resultado.push_back({col, columna.obtenerCodificacion(), columna.bytes(), crudos,
+                                 columna.bytes() == 0 ? 1.0 : static_cast<double>(crudos) / columna.bytes()});
+        }
+        return resultado;
+    }
+
+    // Vuelve a escribir la hoja en orden logico, sin los huecos que dejaron
+    // las filas y columnas eliminadas. Se hace solo cuando los huecos superan
+    // a las lineas vivas, o a pedido. Con la compresion activa las columnas
+    // se vuelven a comprimir sin los huecos.
+    void compactar() {
+        if (!indirecta()) {
+            return;
+        }
+        quitarHuecos();
+        if (compresion) {
+            comprimirColumnas();
+        }
+    }
+
+    // Lineas fisicas que son huecos de filas o columnas eliminadas
+    size_t huecos() const {
+        return (filasFisicas() - numFilas) + (columnasFisicas() - numColumnas);
+    }
+
+    // Memoria que ocupan los valores de las celdas
+    size_t bytesCeldas() const {
+        if (comprimida()) {
+            size_t total = 0;
+            for (const auto& columna : comprimidas) {
+                total += columna.bytes();
+            }
+            return total;
+        }
+        return dispersa ? disperso.bytes() : (bloqueMapeado ? lineas() * paso : celdas.capacity()) * sizeof(double);
+    }
+
+    void agregarFila() {
+        Medicion medicion(instrumentacion, Operacion::AgregarFila, std::max<size_t>(numColumnas, 1));
+        comprobarTamano(numFilas + 1, numColumnas);
+        if (diarioActivo()) {
+            EntradaDiario entrada;
+            entrada.tipo = EntradaDiario::Tipo::AgregarFila;
+            anotar(std::move(entrada));
+        }
+        // En una hoja vacia tambien aparece la primera columna
+        indiceSumasAlDia = indiceSumasAlDia && numFilas > 0;
+        if (indiceSumasAlDia) {
+            indiceSumas.agregarFila();
+        }
+        versionFilas.push_back(++reloj);
+        if (versionColumnas.empty()) {
+            versionColumnas.push_back(++reloj);
+        }
+        epocaFilas = ++reloj;
+        if (dispersa) {
+            numColumnas = std::max<size_t>(numColumnas, 1);
+            ++numFilas;
+        } else if (numFilas == 0) {
+            numFilas = 1;
+            numColumnas = 1;
+            paso = 1;
+            soltarMapeo();
+            olvidarIndices();
+            celdas.assign(1, 0.0);
+        } else {
+            if (disposicion == Disposicion::PorFilas) {
+                agregarLinea();
+            } else {
+                agregarPosicion();
+            }
+            if (!indiceFilas.empty()) {
+                indiceFilas.push_back(filasAlmacenadas++);
+            }
+            ++numFilas;
+        }
+        if (indexando()) {
+            for (auto& [columna, indice] : indicesColumnas) {
+                indice.insertarFila(numFilas - 1, 0.0);
+            }
+        }
+        if (registroActivo()) {
+            registro->empezar(RegistroEscritura::Tipo::AgregarFila);
+            terminarRegistro();
+        }
+    }
+
+    void eliminarFila(size_t index) {
+        Medicion medicion(instrumentacion, Operacion::EliminarFila, numColumnas);
+        if (index < numFilas) {
+            EntradaDiario entrada;
+            bool anotarla = diarioActivo();
+            if (anotarla) {
+                entrada.tipo = EntradaDiario::Tipo::EliminarFila;
+                entrada.fila = static_cast<uint32_t>(index);
+                DetalleDiario& detalle = entrada.ampliar();
+                detalle.anteriores.resize(numColumnas);
+                copiarFila(index, 0, numColumnas, detalle.anteriores.data());
+            }
+            if (indexando()) {
+                for (auto& [columna, indice] : indicesColumnas) {
+                    indice.eliminarFila(index, leerCelda(index, columna));
+                }
+            }
+            if (indiceSumasAlDia) {
+                std::vector<double> linea(numColumnas);
+                copiarFila(index, 0, numColumnas, linea.data());
+                indiceSumasAlDia = indiceSumas.eliminarFila(index, linea.data());
+            }
+            versionFilas.erase(versionFilas.begin() + index);
+            epocaFilas = ++reloj;
+            if (dispersa) {
+                disperso.eliminar(true, index);
+            } else {
+                size_t fisica = indiceFilas.empty() ? index : indiceFilas[index];
+                quitarDelIndice(indiceFilas, filasAlmacenadas, numFilas, index);
+                if (anotarla) {
+                    entrada.detalle->fisica = fisica;
+                    entrada.detalle->generacion = generacionIndices;
+                }
+            }
+            --numFilas;
+            if (numFilas == 0) {
+                numColumnas = 0;
+                paso = 0;
+                celdas.clear();
+                comprimidas.clear();
+                versionColumnas.clear();
+                olvidarIndices();
+                indicesColumnasAlDia = false;
+            } else if (filasFisicas() > 2 * numFilas) {
+                compactar();
+            }
+            reubicarFormulas(true, index, anotarla ? &entrada : nullptr);
+            if (anotarla) {
+                anotar(std::move(entrada));
+            }
+            if (registroActivo()) {
+                registro->empezar(RegistroEscritura::Tipo::EliminarFila);
+                registro->ponerEntero(index);
+                terminarRegistro();
+            }
+        } else {
+            throw std::out_of_range("Indice de fila fuera de rango");
+        }
+    }
+
+    void agregarColumna() {
+        Medicion medicion(instrumentacion, Operacion::AgregarColumna, numFilas);
+        if (numFilas == 0) {
+            return;
+        }
+        comprobarTamano(numFilas, numColumnas + 1);
+        if (diarioActivo()) {
+            EntradaDiario entrada;
+            entrada.tipo = EntradaDiario::Tipo::AgregarColumna;
+            anotar(std::move(entrada));
+        }
+        if (indiceSumasAlDia) {
+            indiceSumas.agregarColumna();
+        }
+        versionColumnas.push_back(++reloj);
+        epocaColumnas = ++reloj;
+        if (dispersa) {
+            // Nada que reservar: las celdas nuevas valen 0 hasta que se escriban
+        } else if (disposicion == Disposicion::PorFilas) {
+            agregarPosicion();
+        } else {
+            agregarLinea();
+        }
+        if (!indiceColumnas.empty()) {
+            indiceColumnas.push_back(columnasAlmacenadas++);
+        }
+        ++numColumnas;
+        if (registroActivo()) {
+            registro->empezar(RegistroEscritura::Tipo::AgregarColumna);
+            terminarRegistro();
+        }
+    }
+
+    void eliminarColumna(size_t index) {
+        Medicion medicion(instrumentacion, Operacion::EliminarColumna, numFilas);
+        if (numFilas > 0 && index < numColumnas) {
+            EntradaDiario entrada;
+            bool anotarla = diarioActivo();
+            if (anotarla) {
+                entrada.tipo = EntradaDiario::Tipo::EliminarColumna;
+                entrada.columna = static_cast<uint32_t>(index);
+                DetalleDiario& detalle = entrada.ampliar();
+                detalle.anteriores.resize(numFilas);
+                copiarColumna(0, index, numFilas, detalle.anteriores.data());
+            }
+            indicesColumnas.erase(index);
+            correrIndicesColumnas(index, false);
+            if (indiceSumasAlDia) {
+                std::vector<double> linea(numFilas);
+                copiarColumna(0, index, numFilas, linea.data());
+                indiceSumasAlDia = indiceSumas.eliminarColumna(index, linea.data());
+            }
+            versionColumnas.erase(versionColumnas.begin() + index);
+            epocaColumnas = ++reloj;
+            if (dispersa) {
+                disperso.eliminar(false, index);
+            } else {
+                size_t fisica = indiceColumnas.empty() ? index : indiceColumnas[index];
+                quitarDelIndice(indiceColumnas, columnasAlmacenadas, numColumnas, index);
+                if (anotarla) {
+                    entrada.detalle->fisica = fisica;
+                    entrada.detalle->generacion = generacionIndices;
+                }
+            }
+            --numColumnas;
+            if (numColumnas == 0) {
+                // Sin columnas no queda ninguna celda: se suelta el bloque para
+                // que la proxima columna no reuse la linea fisica eliminada
+                soltarMapeo();
+                celdas.clear();
+                paso = disposicion == Disposicion::PorFilas ? 0 : numFilas;
+                olvidarIndices();
+            } else if (columnasFisicas() > 2 * numColumnas) {
+                compactar();
+            }
+            reubicarFormulas(false, index, anotarla ? &entrada : nullptr);
+            if (anotarla) {
+                anotar(std::move(entrada));
+            }
+            if (registroActivo()) {
+                registro->empezar(RegistroEscritura::Tipo::EliminarColumna);
+                registro->ponerEntero(index);
+                terminarRegistro();
+            }
+        } else {
+            throw std::out_of_range("Indice de columna fuera de rango");
+        }
+    }
+
+    // Ordena las filas por una o mas columnas (la primera manda) de forma
+    // estable: las filas con las mismas claves conservan su orden. Los NaN
+    // van al final en los dos sentidos. Se ordena una permutacion de filas
+    // de 32 bits que lee las claves en la hoja: se ordenan partes por
+    // separado (en paralelo) y despues se mezclan de a pares, tambien en
+    // paralelo. Despues los datos se mueven una sola vez (ver permutarFilas).
+    void ordenar(const std::vector<ClaveOrden>& claves) {
+        Medicion medicion(instrumentacion, Operacion::Ordenar, numFilas * numColumnas);
+        if (claves.empty()) {
+            throw std::invalid_argument("Falta la columna por la que ordenar");
+        }
+        for (const auto& clave : claves) {
+            if (clave.columna >= numColumnas) {
+                throw std::out_of_range("Indice de columna fuera de rango");
+            }
+        }
+        size_t n = numFilas;
+        if (n < 2) {
+            return;
+        }
+        // Dispersa o comprimida, leer una celda cuesta mucho mas: ahi se
+        // copian las columnas clave. Densa se leen en su lugar.
+        bool enLugar = !dispersa && !comprimida();
+        const double* base = static_cast<const HojaCalculo*>(this)->datos();
+        std::vector<std::vector<double>> copias(enLugar ? 0 : claves.size(), std::vector<double>(enLugar ? 0 : n));
+        size_t tramos = tramosPara(n, 4096);
+        if (!enLugar) {
+            repartir(tramos, [&](size_t t) {
+                for (size_t fila = n * t / tramos; fila < n * (t + 1) / tramos; ++fila) {
+                    for (size_t k = 0; k < claves.size(); ++k) {
+                        copias[k][fila] = leerCelda(fila, claves[k].columna);
+                    }
+                }
+            });
+        }
+        // Las descendentes se comparan con el signo cambiado, asi todas se comparan igual
+        auto valor = [&](size_t k, uint32_t fila) {
+            double v = enLugar ? base[posicion(fila, claves[k].columna)] : copias[k][fila];
+            return claves[k].descendente ? -v : v;
+        };
+        auto antes = antesEnOrden;
+        // Desempata por las claves que siguen a la primera
+        auto menorResto = [&](uint32_t a, uint32_t b) {
+            for (size_t k = 1; k < claves.size(); ++k) {
+                double x = valor(k, a);
+                double y = valor(k, b);
+                if (antes(x, y)) return true;
+                if (antes(y, x)) return false;
+            }
+            return false;
+        };
+        // Cada parte se ordena con su primera clave al lado de cada fila, que
+        // es mucho mas rapido que ir a buscarla a la hoja. Las partes que se
+        // ordenan a la vez ocupan entre todas (con el buffer de stable_sort,
+        // media parte mas) a lo sumo un cuarto de la hoja.
+        struct Par {
+            double clave;
+            uint32_t fila;
+        };
+        size_t aLaVez = grupo ? grupo->cantidad() : 1;
+        size_t porParte = std::max<size_t>(4096, n * numColumnas * sizeof(double) / 4 / (sizeof(Par) * 3 / 2) / aLaVez);
+        size_t partes = std::max(tramos, (n + porParte - 1) / porParte);
+        std::vector<uint32_t> orden(n);
+        auto corte = [&](size_t parte) {
+            return n * std::min(parte, partes) / partes;
+        };
+        repartir(partes, [&](size_t t) {
+            std::vector<Par> pares;
+            pares.reserve(corte(t + 1) - corte(t));
+            for (size_t fila = corte(t); fila < corte(t + 1); ++fila) {
+                pares.push_back({valor(0, static_cast<uint32_t>(fila)), static_cast<uint32_t>(fila)});
+            }
+            std::stable_sort(pares.begin(), pares.end(), [&](const Par& a, const Par& b) {
+                if (antes(a.clave, b.clave)) return true;
+                if (antes(b.clave, a.clave)) return false;
+                return menorResto(a.fila, b.fila);
+            });
+            for (size_t i = 0; i < pares.size(); ++i) {
+                orden[corte(t) + i] = pares[i].fila;
+            }
+        });
+        if (partes > 1) {
+            // Cada mezcla aparta su tramo izquierdo y junta desde ahi sobre el
+            // lugar, asi la memoria extra es la de los tramos izquierdos y no
+            // otra permutacion entera. En empates gana el apartado, que es el
+            // de la izquierda, y la mezcla sigue siendo estable.
+            std::vector<uint32_t> apartado;
+            std::vector<size_t> desde;
+            for (size_t ancho = 1; ancho < partes; ancho *= 2) {
+                size_t mezclas = (partes + 2 * ancho - 1) / (2 * ancho);
+                desde.assign(mezclas + 1, 0);
+                for (size_t m = 0; m < mezclas; ++m) {
+                    size_t b = corte(2 * m * ancho + ancho);
+                    bool conDerecho = b < corte(2 * m * ancho + 2 * ancho);
+                    desde[m + 1] = desde[m] + (conDerecho ? b - corte(2 * m * ancho) : 0);
+                }
+                if (apartado.size() < desde[mezclas]) {
+                    apartado.resize(desde[mezclas]);
+                }
+                repartir(mezclas, [&](size_t m) {
+                    size_t a = corte(2 * m * ancho);
+                    size_t b = corte(2 * m * ancho + ancho);
+                    size_t c = corte(2 * m * ancho + 2 * ancho);
+                    if (b == c) {
+                        return;
+                    }
+                    uint32_t* izquierdo = apartado.data() + desde[m];
+                    std::copy(orden.begin() + a, orden.begin() + b, izquierdo);
+                    // La primera clave de cada cabeza se lee una vez, no en cada comparacion
+                    size_t i = 0;
+                    size_t j = b;
+                    size_t k = a;
+                    double x = valor(0, izquierdo[0]);
+                    double y = valor(0, orden[b]);
+                    while (true) {
+                        bool derecho = antes(y, x) || (!antes(x, y) && menorResto(orden[j], izquierdo[i]));
+                        if (derecho) {
+                            orden[k++] = orden[j++];
+                            if (j == c) {
+                                break;
+                            }
+                            y = valor(0, orden[j]);
+                        } else {
+                            orden[k++] = izquierdo[i++];
+                            if (i == b - a) {
+                                break;
+                            }
+                            x = valor(0, izquierdo[i]);
+                        }
+                    }
+                    std::copy(izquierdo + i, izquierdo + (b - a), orden.begin() + k);
+                });
+            }
+        }
+        bool igual = true;
+        for (size_t i = 0; i < n && igual; ++i) {
+            igual = orden[i] == i;
+        }
+        if (igual) {
+            return;
+        }
+        // Las copias de las claves ya no hacen falta: se sueltan antes de mover los datos
+        copias.clear();
+
+        EntradaDiario entrada;
+        bool anotarla = diarioActivo();
+        if (anotarla) {
+            entrada.tipo = EntradaDiario::Tipo::Ordenar;
+        }
+        permutarFilas(orden, anotarla ? &entrada : nullptr);
+        if (anotarla) {
+            entrada.ampliar().orden = std::move(orden);
+            anotar(std::move(entrada));
+        }
+    }
+
+    // Agrupa las filas por los valores de las columnas 'claves' y deja en
+    // 'destino' una fila por grupo: las claves y despues una columna por
+    // agregacion, en el orden pedido. Los grupos salen ordenados por clave
+    // como en ordenar; 0.0 y -0.0 son el mismo grupo, y todos los NaN otro.
+    // Cada hilo agrupa un tramo de filas en su propia tabla, leyendo las
+    // columnas de a 4096 filas; despues los grupos se reparten en cubetas
+    // por su hash y cada cubeta junta los parciales de todos los tramos, asi
+    // la union tambien es en paralelo y sin bloqueos. Devuelve los grupos.
+    size_t agrupar(const std::vector<size_t>& claves, const std::vector<Agregacion>& agregaciones,
+                   HojaCalculo& destino) const {
+        if (&destino == this) {
+            throw std::invalid_argument("El resultado debe ir a otra hoja");
+        }
+        if (claves.empty()) {
+            throw std::invalid_argument("Falta la columna por la que agrupar");
+        }
+        std::vector<size_t> columnasValor;
+        std::vector<size_t> lugar;
+        for (size_t columna : claves) {
+            if (columna >= numColumnas) {
+                throw std::out_of_range("Indice de columna fuera de rango");
+            }
+        }
+        for (const auto& agregacion : agregaciones) {
+            if (agregacion.columna >= numColumnas) {
+                throw std::out_of_range("Indice de columna fuera de rango");
+            }
+            auto repetida = std::find(columnasValor.begin(), columnasValor.end(), agregacion.columna);
+            lugar.push_back(repetida - columnasValor.begin());
+            if (repetida == columnasValor.end()) {
+                columnasValor.push_back(agregacion.columna);
+            }
+        }
+        size_t n = numFilas;
+        size_t k = claves.size();
+        size_t m = columnasValor.size();
+        Medicion medicion(instrumentacion, Operacion::Agrupar, n * (k + m));
+
+        struct Parcial {
+            TablaGrupos tabla;
+            std::vector<Acumulado> acumulados;
+        };
+        // Tramos grandes: cada uno repite en su tabla los grupos que comparte con los demas
+        size_t tramos = grupo ? std::max<size_t>(1, std::min(grupo->cantidad(), n / 65536)) : 1;
+        std::vector<Parcial> parciales(tramos, Parcial{TablaGrupos(k), {}});
+        repartir(tramos, [&](size_t t) {
+            const size_t bloque = 4096;
+            Parcial& parcial = parciales[t];
+            std::vector<double> valores((k + m) * bloque);
+            std::vector<uint64_t> clave(k);
+            for (size_t inicio = n * t / tramos; inicio < n * (t + 1) / tramos; inicio += bloque) {
+                size_t largo = std::min(bloque, n * (t + 1) / tramos - inicio);
+                for (size_t c = 0; c < k; ++c) {
+                    copiarColumna(inicio, claves[c], largo, valores.data() + c * bloque);
+                }
+                for (size_t c = 0; c < m; ++c) {
+                    copiarColumna(inicio, columnasValor[c], largo, valores.data() + (k + c) * bloque);
+                }
+                for (size_t i = 0; i < largo; ++i) {
+                    for (size_t c = 0; c < k; ++c) {
+                        clave[c] = TablaGrupos::bits(valores[c * bloque + i]);
+                    }
+                    size_t g = parcial.tabla.grupo(clave.data(), parcial.tabla.hashDe(clave.data()));
+                    if (g * m == parcial.acumulados.size()) {
+                        parcial.acumulados.resize((g + 1) * m);
+                    }
+                    Acumulado* acumulado = parcial.acumulados.data() + g * m;
+                    for (size_t c = 0; c < m; ++c) {
+                        double valor = valores[(k + c) * bloque + i];
+                        ++acumulado[c].cuenta;
+                        acumulado[c].sumar(valor);
+                        acumulado[c].minimo = std::min(acumulado[c].minimo, valor);
+                        acumulado[c].maximo = std::max(acumulado[c].maximo, valor);
+                    }
+                }
+            }
+        });
+
+        std::vector<Parcial> finales;
+        if (tramos == 1) {
+            finales.push_back(std::move(parciales[0]));
+        } else {
+            // Las cubetas se eligen con los bits altos del hash; los bajos ya ubican la casilla
+            size_t cubetas = tramos;
+            std::vector<std::vector<std::vector<uint32_t>>> repartidos(tramos, std::vector<std::vector<uint32_t>>(cubetas));
+            repartir(tramos, [&](size_t t) {
+                const TablaGrupos& tabla = parciales[t].tabla;
+                for (size_t g = 0; g < tabla.cantidad(); ++g) {
+                    repartidos[t][(tabla.hash(g) >> 32) % cubetas].push_back(static_cast<uint32_t>(g));
+                }
+            });
+            finales.assign(cubetas, Parcial{TablaGrupos(k), {}});
+            repartir(cubetas, [&](size_t b) {
+                Parcial& junta = finales[b];
+                for (size_t t = 0; t < tramos; ++t) {
+                    const Parcial& parcial = parciales[t];
+                    for (uint32_t g : repartidos[t][b]) {
+                        size_t unido = junta.tabla.grupo(parcial.tabla.clave(g), parcial.tabla.hash(g));
+                        if (unido * m == junta.acumulados.size()) {
+                            junta.acumulados.resize((unido + 1) * m);
+                        }
+                        for (size_t c = 0; c < m; ++c) {
+                            junta.acumulados[unido * m + c].unir(parcial.acumulados[g * m + c]);
+                        }
+                    }
+                }
+            });
+            parciales.clear();
+        }
+
+        struct Grupo {
+            uint32_t cubeta;
+            uint32_t numero;
+        };
+        std::vector<Grupo> grupos;
+        for (size_t b = 0; b < finales.size(); ++b) {
+            for (size_t g = 0; g < finales[b].tabla.cantidad(); ++g) {
+                grupos.push_back({static_cast<uint32_t>(b), static_cast<uint32_t>(g)});
+            }
+        }
+        std::sort(grupos.begin(), grupos.end(), [&](const Grupo& a, const Grupo& b) {
+            const uint64_t* claveA = finales[a.cubeta].tabla.clave(a.numero);
+            const uint64_t* claveB = finales[b.cubeta].tabla.clave(b.numero);
+            for (size_t c = 0; c < k; ++c) {
+                double x = TablaGrupos::valor(claveA[c]);
+                double y = TablaGrupos::valor(claveB[c]);
+                if (antesEnOrden(x, y)) return true;
+                if (antesEnOrden(y, x)) return false;
+            }
+            return false;
+        });
+
+        size_t ancho = k + agregaciones.size();
+        std::vector<double> resultado(grupos.size() * ancho);
+        for (size_t fila = 0; fila < grupos.size(); ++fila) {
+            const Parcial& junta = finales[grupos[fila].cubeta];
+            const uint64_t* clave = junta.tabla.clave(grupos[fila].numero);
+            double* salida = resultado.data() + fila * ancho;
+            for (size_t c = 0; c < k; ++c) {
+                salida[c] = TablaGrupos::valor(clave[c]);
+            }
+            for (size_t a = 0; a < agregaciones.size(); ++a) {
+                const Acumulado& acumulado = junta.acumulados[grupos[fila].numero * m + lugar[a]];
+                double valor = 0.0;
+                switch (agregaciones[a].funcion) {
+                    case FuncionRango::Suma: valor = acumulado.total(); break;
+                    case FuncionRango::Contar: valor = static_cast<double>(acumulado.cuenta); break;
+                    case FuncionRango::Minimo: valor = acumulado.minimo; break;
+                    case FuncionRango::Maximo: valor = acumulado.maximo; break;
+                    case FuncionRango::Promedio: valor = acumulado.total() / acumulado.cuenta; break;
+                }
+                salida[k + a] = valor;
+            }
+        }
+        destino.reemplazarContenido(grupos.size(), ancho, resultado);
+        return grupos.size();
+    }
+
+    void actualizarCelda(size_t fila, size_t columna, double valor) {
+        Medicion medicion(instrumentacion, Operacion::ActualizarCelda, 1, 64);
+        if (fila < numFilas && columna < numColumnas) {
+            if (diarioActivo()) {
+                EntradaDiario entrada;
+                entrada.tipo = EntradaDiario::Tipo::Celda;
+                entrada.fila = static_cast<uint32_t>(fila);
+                entrada.columna = static_cast<uint32_t>(columna);
+                entrada.anterior = leerCelda(fila, columna);
+                entrada.nuevo = valor;
+                guardarFormula(entrada, clave(fila, columna));
+                anotar(std::move(entrada));
+            }
+            escribirCelda(fila, columna, valor);
+            // Un valor escrito a mano reemplaza la formula que hubiera en la celda
+            if (!formulas.empty()) {
+                quitarFormula(clave(fila, columna));
+                recalcular({clave(fila, columna)});
+            }
+            if (registroActivo()) {
+                registro->empezar(RegistroEscritura::Tipo::Celda);
+                registro->ponerEntero(fila);
+                registro->ponerEntero(columna);
+                registro->ponerReal(valor);
+                terminarRegistro();
+            }
+        } else {
+            throw std::out_of_range("Indice de celda fuera de rango");
+        }
+    }
+
+    // Aplica muchas actualizaciones de una vez. Se validan todas antes de
+    // escribir, asi que si una cae fuera de la hoja no se aplica ninguna, y
+    // las formulas afectadas se recalculan una sola vez al final. Si una celda
+    // aparece varias veces queda el ultimo valor.
+    // En el modo disperso se agrupan antes por franjas de 'lado' filas (un
+    // recuento estable en O(n)) para buscar cada bloque una vez seguida; en el
+    // bloque contiguo se escriben en el orden dado, que medido sale mas rapido
+    // que reordenarlas.
+    void actualizarCeldas(const std::vector<Actualizacion>& cambios) {
+        Medicion medicion(instrumentacion, Operacion::ActualizarCeldas, cambios.size());
+        // Sin cambios no se anota nada: un deshacer vacio taparia el anterior
+        if (cambios.empty()) {
+            return;
+        }
+        for (const auto& cambio : cambios) {
+            if (cambio.fila >= numFilas || cambio.columna >= numColumnas) {
+                throw std::out_of_range("Indice de celda fuera de rango");
+            }
+        }
+        if (diarioActivo()) {
+            EntradaDiario entrada;
+            entrada.tipo = EntradaDiario::Tipo::Celdas;
+            DetalleDiario& detalle = entrada.ampliar();
+            detalle.cambios = cambios;
+            detalle.anteriores.reserve(cambios.size());
+            for (const auto& cambio : cambios) {
+                detalle.anteriores.push_back(leerCelda(cambio.fila, cambio.columna));
+                if (!formulas.empty()) {
+                    guardarFormula(entrada, clave(cambio.fila, cambio.columna));
+                }
+            }
+            anotar(std::move(entrada));
+        }
+        indiceSumasAlDia = false;
+        if (dispersa) {
+            std::vector<size_t> inicio(numFilas / AlmacenDisperso::lado + 2, 0);
+            for (const auto& cambio : cambios) {
+                ++inicio[cambio.fila / AlmacenDisperso::lado + 1];
+            }
+            std::partial_sum(inicio.begin(), inicio.end(), inicio.begin());
+            std::vector<Actualizacion> ordenados(cambios.size());
+            for (const auto& cambio : cambios) {
+                ordenados[inicio[cambio.fila / AlmacenDisperso::lado]++] = cambio;
+            }
+            for (const auto& cambio : ordenados) {
+                tocarCelda(cambio.fila, cambio.columna);
+                if (indexando()) {
+                    cambioEnIndices(cambio.fila, cambio.columna, disperso.leer(cambio.fila, cambio.columna), cambio.valor);
+                }
+                disperso.escribir(cambio.fila, cambio.columna, cambio.valor);
+            }
+        } else if (comprimida()) {
+            for (const auto& cambio : cambios) {
+                tocarCelda(cambio.fila, cambio.columna);
+                if (indexando()) {
+                    cambioEnIndices(cambio.fila, cambio.columna, leerComprimida(cambio.fila, cambio.columna), cambio.valor);
+                }
+                escribirComprimida(cambio.fila, cambio.columna, cambio.valor);
+            }
+        } else {
+            double* destino = datos();
+            for (const auto& cambio : cambios) {
+                tocarCelda(cambio.fila, cambio.columna);
+                double& celda = destino[posicion(cambio.fila, cambio.columna)];
+                if (indexando()) {
+                    cambioEnIndices(cambio.fila, cambio.columna, celda, cambio.valor);
+                }
+                celda = cambio.valor;
+            }
+        }
+        if (!formulas.empty()) {
+            std::vector<uint64_t> origenes;
+            origenes.reserve(cambios.size());
+            for (const auto& cambio : cambios) {
+                origenes.push_back(clave(cambio.fila, cambio.columna));
+                quitarFormula(origenes.back());
+            }
+            recalcular(origenes);
+        }
+        if (registroActivo()) {
+            registro->empezar(RegistroEscritura::Tipo::Celdas);
+            registro->ponerEntero(cambios.size());
+            registro->ponerBytes(cambios.data(), cambios.size() * sizeof(Actualizacion));
+            terminarRegistro();
+        }
+    }
+
+    // Escribe un bloque de filas x columnas desde (fila, columna). 'valores'
+    // viene por filas; cada fila del bloque se copia de una vez cuando es
+    // contigua en la hoja.
+    void actualizarBloque(size_t fila, size_t columna, size_t filas, size_t columnas, const std::vector<double>& valores) {
+        Medicion medicion(instrumentacion, Operacion::ActualizarBloque, valores.size());
+        if (fila > numFilas || filas > numFilas - fila || columna > numColumnas || columnas > numColumnas - columna) {
+            throw std::out_of_range("El bloque queda fuera de la hoja");
+        }
+        if (valores.size() != filas * columnas) {
+            throw std::invalid_argument("La cantidad de valores no coincide con el tamano del bloque");
+        }
+        if (diarioActivo()) {
+            EntradaDiario entrada;
+            entrada.tipo = EntradaDiario::Tipo::Bloque;
+            entrada.fila = static_cast<uint32_t>(fila);
+            entrada.columna = static_cast<uint32_t>(columna);
+            DetalleDiario& detalle = entrada.ampliar();
+            detalle.filas = filas;
+            detalle.columnas = columnas;
+            detalle.nuevos = valores;
+            detalle.anteriores.resize(valores.size());
+            for (size_t f = 0; f < filas; ++f) {
+                copiarFila(fila + f, columna, columnas, detalle.anteriores.data() + f * columnas);
+                for (size_t c = 0; c < columnas && !formulas.empty(); ++c) {
+                    guardarFormula(entrada, clave(fila + f, columna + c));
+                }
+            }
+            anotar(std::move(entrada));
+        }
+        indiceSumasAlDia = false;
+        for (size_t f = 0; f < filas; ++f) {
+            versionFilas[fila + f] = ++reloj;
+        }
+        for (size_t c = 0; c < columnas; ++c) {
+            versionColumnas[columna + c] = ++reloj;
+        }
+        // Los caminos directos no pasan por escribirCelda: los indices de columna se corrigen antes
+        auto corregirIndices = [&] {
+            for (auto& [col, indice] : indicesColumnas) {
+                for (size_t f = 0; col >= columna && col < columna + columnas && f < filas; ++f) {
+                    indice.cambiar(fila + f, leerCelda(fila + f, col), valores[f * columnas + col - columna]);
+                }
+            }
+        };
+        bool densa = !dispersa && !comprimida();
+        if (densa && disposicion == Disposicion::PorFilas && indiceColumnas.empty()) {
+            if (indexando()) {
+                corregirIndices();
+            }
+            for (size_t f = 0; f < filas; ++f) {
+                std::copy_n(valores.data() + f * columnas, columnas, datos() + posicion(fila + f, columna));
+            }
+        } else if (densa && disposicion == Disposicion::PorColumnas && indiceFilas.empty()) {
+            if (indexando()) {
+                corregirIndices();
+            }
+            for (size_t c = 0; c < columnas; ++c) {
+                double* destino = datos() + posicion(fila, columna + c);
+                for (size_t f = 0; f < filas; ++f) {
+                    destino[f] = valores[f * columnas + c];
+                }
+            }
+        } else {
+            for (size_t f = 0; f < filas; ++f) {
+                for (size_t c = 0; c < columnas; ++c) {
+                    escribirCelda(fila + f, columna + c, valores[f * columnas + c]);
+                }
+            }
+        }
+        if (!formulas.empty()) {
+            std::vector<uint64_t> origenes;
+            origenes.reserve(filas * columnas);
+            for (size_t f = 0; f < filas; ++f) {
+                for (size_t c = 0; c < columnas; ++c) {
+                    origenes.push_back(clave(fila + f, columna + c));
+                    quitarFormula(origenes.back());
+                }
+            }
+            recalcular(origenes);
+        }
+        if (registroActivo()) {
+            registro->empezar(RegistroEscritura::Tipo::Bloque);
+            registro->ponerEntero(fila);
+            registro->ponerEntero(columna);
+            registro->ponerEntero(filas);
+            registro->ponerEntero(columnas);
+            registro->ponerBytes(valores.data(), valores.size() * sizeof(double));
+            terminarRegistro();
+        }
+    }
+
+    // Lee lineas "fila,columna,valor" y las aplica con actualizarCeldas en
+    // lotes de 'lote' lineas, sin tener todo el archivo en memoria. Si una
+    // linea no se puede leer se lanza la excepcion y quedan aplicados solo
+    // los lotes anteriores; si el archivo no se puede abrir se lanza
+    // runtime_error. Devuelve cuantas actualizaciones se aplicaron.
+    size_t actualizarDesdeArchivo(const std::string& nombreArchivo, size_t lote = 1 << 16) {
+        Medicion medicion(instrumentacion, Operacion::ActualizarDesdeArchivo);
+        std::ifstream archivo(nombreArchivo);
+        if (!archivo.is_open()) {
+            throw std::runtime_error("No se pudo abrir el archivo de actualizaciones");
+        }
+        auto leerIndice = [](const char* p, const char* fin, size_t& indice) {
+            double valor;
+            p = leerCampo(p, fin, valor);
+            if (!(valor >= 0) || valor != std::floor(valor) || valor > std::numeric_limits<uint32_t>::max()) {
+                throw std::invalid_argument("Indice no valido en las actualizaciones");
+            }
+            indice = static_cast<size_t>(valor);
+            if (p == fin || *p != ',') {
+                throw std::invalid_argument("Faltan campos en las actualizaciones");
+            }
+            return p + 1;
+        };
+        std::vector<Actualizacion> cambios;
+        cambios.reserve(lote);
+        size_t aplicadas = 0;
+        std::string linea;
+        while (std::getline(archivo, linea)) {
+            instrumentacion.leidos(linea.size() + 1);
+            const char* p = linea.data();
+            const char* fin = p + linea.size();
+            if (linea.find_first_not_of(" \t\r") == std::string::npos) {
+                continue;
+            }
+            Actualizacion cambio;
+            p = leerIndice(p, fin, cambio.fila);
+            p = leerIndice(p, fin, cambio.columna);
+            leerCampo(p, fin, cambio.valor);
+            cambios.push_back(cambio);
+            if (cambios.size() == lote) {
+                actualizarCeldas(cambios);
+                aplicadas += lote;
+                cambios.clear();
+            }
+        }
+        aplicadas += cambios.size();
+        if (!cambios.empty()) {
+            actualizarCeldas(cambios);
+        }
+        medicion.celdas(aplicadas);
+        return aplicadas;
+    }
+
+    // Escribe una formula en la celda y calcula su valor y el de las celdas
+    // que dependen de ella. Lanza invalid_argument si no se puede interpretar
+    // o si crea una referencia circular; en ese caso la hoja queda como estaba.
+    void establecerFormula(size_t fila, size_t columna, const std::string& texto) {
+        Medicion medicion(instrumentacion, Operacion::EstablecerFormula);
+        if (fila >= numFilas || columna >= numColumnas) {
+            throw std::out_of_range("Indice de celda fuera de rango");
+        }
+        Formula nueva;
+        nueva.codigo = LectorFormula(texto).compilar();
+        recorrerReferencias(nueva, [&](const Rango& rango) {
+            if (rango.fila2 >= numFilas || rango.columna2 >= numColumnas) {
+                throw std::out_of_range("La formula hace referencia a celdas fuera de la hoja");
+            }
+        });
+        nueva.texto = describirFormula(nueva.codigo);
+
+        uint64_t celda = clave(fila, columna);
+        EntradaDiario entrada;
+        bool anotarla = diarioActivo();
+        if (anotarla) {
+            entrada.tipo = EntradaDiario::Tipo::Formula;
+            entrada.fila = static_cast<uint32_t>(fila);
+            entrada.columna = static_cast<uint32_t>(columna);
+            entrada.anterior = leerCelda(fila, columna);
+            entrada.ampliar().texto = texto;
+            guardarFormula(entrada, celda);
+        }
+        auto existente = formulas.find(celda);
+        Formula anterior;
+        bool habiaAnterior = existente != formulas.end();
+        if (habiaAnterior) {
+            anterior = existente->second;
+            quitarFormula(celda);
+        }
+        conectar(celda, formulas[celda] = std::move(nueva));
+        try {
+            recalcular({celda});
+        } catch (...) {
+            quitarFormula(celda);
+            if (habiaAnterior) {
+                conectar(celda, formulas[celda] = std::move(anterior));
+            }
+            throw;
+        }
+        medicion.celdas(recalculo.tareas);
+        if (anotarla) {
+            anotar(std::move(entrada));
+        }
+        if (registroActivo()) {
+            registrarFormula(fila, columna);
+        }
+    }
+
+    // Deja en la celda el ultimo valor calculado, sin la formula
+    void eliminarFormula(size_t fila, size_t columna) {
+        bool habia = formulas.count(clave(fila, columna)) != 0;
+        if (diarioActivo() && habia) {
+            EntradaDiario entrada;
+            entrada.tipo = EntradaDiario::Tipo::Formula;
+            entrada.fila = static_cast<uint32_t>(fila);
+            entrada.columna = static_cast<uint32_t>(columna);
+            entrada.anterior = leerCelda(fila, columna);
+            guardarFormula(entrada, clave(fila, columna));
+            anotar(std::move(entrada));
+        }
+        quitarFormula(clave(fila, columna));
+        if (registroActivo() && habia) {
+            registro->empezar(RegistroEscritura::Tipo::EliminarFormula);
+            registro->ponerEntero(fila);
+            registro->ponerEntero(columna);
+            terminarRegistro();
+        }
+    }
+
+    bool tieneFormula(size_t fila, size_t columna) const {
+        return formulas.count(clave(fila, columna)) != 0;
+    }
+
+    std::string obtenerFormula(size_t fila, size_t columna) const {
+        auto it = formulas.find(clave(fila, columna));
+        return it == formulas.end() ? std::string() : it->second.texto;
+    }
+
+    size_t cantidadFormulas() const {
+        return formulas.size();
+    }
 
-public:
-    void agregarFila() {
-        std::vector<double> nuevaFila(celdas.empty() ? 1 : celdas[0].size(), 0.0);
-        celdas.push_back(nuevaFila);
+    // Cuantas formulas se volvieron a calcular en el ultimo recalculo
+    size_t ultimasRecalculadas() const {
+        return recalculo.tareas;
     }
 
-    void eliminarFila(size_t index) {
-        if (index < celdas.size()) {
-            celdas.erase(celdas.begin() + index);
+    const EstadisticasRecalculo& estadisticasRecalculo() const {
+        return recalculo;
+    }
+
+    double obtenerCelda(size_t fila, size_t columna) const {
+        Medicion medicion(instrumentacion, Operacion::ObtenerCelda, 1, 64);
+        if (fila < numFilas && columna < numColumnas) {
+            return leerCelda(fila, columna);
+        } else {
+            throw std::out_of_range("Indice de celda fuera de rango");
+        }
+    }
+
+    double operarCeldas(size_t fila1, size_t col1, size_t fila2, size_t col2, char operacion) const {
+        Medicion medicion(instrumentacion, Operacion::OperarCeldas, 0, 64);
+        if (fila1 >= numFilas || col1 >= numColumnas || fila2 >= numFilas || col2 >= numColumnas) {
+            throw std::out_of_range("Indice de celda fuera de rango");
+        }
+        double valor1 = leerCelda(fila1, col1);
+        double valor2 = leerCelda(fila2, col2);
+
+        switch (operacion) {
+            case '+': return valor1 + valor2;
+            case '-': return valor1 - valor2;
+            case '*': return valor1 * valor2;
+            case '/':
+                if (valor2 != 0) return valor1 / valor2;
+                else throw std::invalid_argument("Error: Division por cero.");
+            default:
+                throw std::invalid_argument("Error: Operacion no valida.");
+        }
+    }
+
+    // SUMA, MIN, MAX, PROMEDIO, CONTAR y DESVIACION de un rectangulo en una
+    // sola pasada. Las esquinas pueden venir en cualquier orden.
+    EstadisticasRango estadisticasRango(size_t fila1, size_t columna1, size_t fila2, size_t columna2) const {
+        Medicion medicion(instrumentacion, Operacion::EstadisticasRango);
+        if (fila1 > fila2) {
+            std::swap(fila1, fila2);
+        }
+        if (columna1 > columna2) {
+            std::swap(columna1, columna2);
+        }
+        if (fila2 >= numFilas || columna2 >= numColumnas) {
+            throw std::out_of_range("El rango queda fuera de la hoja");
+        }
+        Acumulado acumulado = acumularRango({fila1, columna1, fila2, columna2}, true);
+        medicion.celdas(acumulado.cuenta);
+        const double nan = std::numeric_limits<double>::quiet_NaN();
+        EstadisticasRango resultado;
+        resultado.suma = acumulado.total();
+        resultado.minimo = acumulado.minimo;
+        resultado.maximo = acumulado.maximo;
+        resultado.cuenta = acumulado.cuenta;
+        resultado.promedio = resultado.suma / acumulado.cuenta;
+        resultado.desviacion = acumulado.cuenta > 1 ? std::sqrt(acumulado.cuadrados / (acumulado.cuenta - 1)) : nan;
+        return resultado;
+    }
+
+    // Elige el indice de sumas que usa sumaRango; se construye en la primera consulta
+    void establecerIndiceSumas(TipoIndiceSumas tipo) {
+        tipoIndiceSumas = tipo;
+        indiceSumasAlDia = false;
+        if (tipo == TipoIndiceSumas::Ninguno) {
+            indiceSumas = IndiceSumas();
+        }
+    }
+
+    TipoIndiceSumas obtenerIndiceSumas() const {
+        return tipoIndiceSumas;
+    }
+
+    // Crea (o reemplaza) un indice secundario sobre la columna para buscar y
+    // filtrar. Se construye ahora y despues lo mantienen las escrituras.
+    void crearIndiceColumna(size_t columna, TipoIndiceColumna tipo) {
+        if (columna >= numColumnas) {
+            throw std::out_of_range("Indice de columna fuera de rango");
+        }
+        IndiceColumna& indice = indicesColumnas[columna] = IndiceColumna(tipo);
+        if (indicesColumnasAlDia) {
+            construirIndice(columna, indice);
+        }
+    }
+
+    bool eliminarIndiceColumna(size_t columna) {
+        return indicesColumnas.erase(columna) > 0;
+    }
+
+    // Columnas con indice, con su tipo y los bytes que ocupa
+    std::vector<EstadisticasIndiceColumna> indicesDeColumnas() const {
+        asegurarIndicesColumnas();
+        std::vector<EstadisticasIndiceColumna> resultado;
+        for (const auto& [columna, indice] : indicesColumnas) {
+            resultado.push_back({columna, indice.obtenerTipo(), indice.bytes()});
+        }
+        return resultado;
+    }
+
+    // Filas donde la columna vale exactamente 'valor' (0.0 y -0.0 son
+    // iguales; NaN no es igual a nada). Con un indice en la columna, de
+    // cualquier tipo, no se recorre la columna.
+    ResultadoBusqueda buscar(size_t columna, double valor) const {
+        Medicion medicion(instrumentacion, Operacion::Buscar);
+        if (columna >= numColumnas) {
+            throw std::out_of_range("Indice de columna fuera de rango");
+        }
+        asegurarIndicesColumnas();
+        ResultadoBusqueda resultado{{}, false};
+        auto indice = indicesColumnas.find(columna);
+        if (indice != indicesColumnas.end()) {
+            indice->second.buscar(valor, resultado.filas);
+            std::sort(resultado.filas.begin(), resultado.filas.end());
+            resultado.conIndice = true;
+            medicion.celdas(resultado.filas.size());
+        } else {
+            resultado.filas = recorrerColumna(columna, [valor](double celda) { return celda == valor; });
+            medicion.celdas(numFilas);
+        }
+        return resultado;
+    }
+
+    // Filas donde desde <= valor <= hasta. Solo el indice ordenado sirve
+    // para rangos; con uno de hash se recorre la columna.
+    ResultadoBusqueda filtrar(size_t columna, double desde, double hasta) const {
+        Medicion medicion(instrumentacion, Operacion::Filtrar);
+        if (columna >= numColumnas) {
+            throw std::out_of_range("Indice de columna fuera de rango");
+        }
+        asegurarIndicesColumnas();
+        ResultadoBusqueda resultado{{}, false};
+        auto indice = indicesColumnas.find(columna);
+        if (indice != indicesColumnas.end() && indice->second.obtenerTipo() == TipoIndiceColumna::Ordenado) {
+            indice->second.buscarEntre(desde, hasta, resultado.filas);
+            std::sort(resultado.filas.begin(), resultado.filas.end());
+            resultado.conIndice = true;
+            medicion.celdas(resultado.filas.size());
         } else {
+            resultado.filas = recorrerColumna(columna, [desde, hasta](double celda) { return celda >= desde && celda <= hasta; });
+            medicion.celdas(numFilas);
+        }
+        return resultado;
+    }
+
+    // Suma de un rectangulo a traves del indice de sumas. Sin indice, o si
+    // la hoja tiene valores no finitos, se recorre el rango.
+    double sumaRango(size_t fila1, size_t columna1, size_t fila2, size_t columna2) const {
+        Medicion medicion(instrumentacion, Operacion::SumaRango);
+        if (fila1 > fila2) {
+            std::swap(fila1, fila2);
+        }
+        if (columna1 > columna2) {
+            std::swap(columna1, columna2);
+        }
+        if (fila2 >= numFilas || columna2 >= numColumnas) {
+            throw std::out_of_range("El rango queda fuera de la hoja");
+        }
+        size_t recorridas = (fila2 - fila1 + 1) * (columna2 - columna1 + 1);
+        if (tipoIndiceSumas == TipoIndiceSumas::Ninguno) {
+            medicion.celdas(recorridas);
+            return acumularRango({fila1, columna1, fila2, columna2}, true).total();
+        }
+        if (!indiceSumasAlDia) {
+            indiceSumas.construir(tipoIndiceSumas, numFilas, numColumnas, [this](size_t fila, double* destino) {
+                copiarFila(fila, 0, numColumnas, destino);
+            });
+            indiceSumasAlDia = true;
+            medicion.celdas(numFilas * numColumnas);
+        }
+        if (indiceSumas.cantidadNoFinitas() > 0) {
+            medicion.celdas(recorridas);
+            return acumularRango({fila1, columna1, fila2, columna2}, true).total();
+        }
+        return indiceSumas.suma(fila1, columna1, fila2, columna2);
+    }
+
+    double operarFila(size_t fila, char operacion) const {
+        Medicion medicion(instrumentacion, Operacion::OperarFila, 0, 16);
+        if (fila >= numFilas || numColumnas == 0) {
             throw std::out_of_range("Indice de fila fuera de rango");
         }
+        return recordarReduccion({versionFilas[fila], epocaColumnas, 'F', operacion}, [&] {
+            medicion.celdas(numColumnas);
+            if (dispersa || comprimida() || !indiceColumnas.empty()) {
+                std::vector<double> linea(numColumnas);
+                copiarFila(fila, 0, numColumnas, linea.data());
+                return reducir(linea.data(), numColumnas, 1, operacion);
+            }
+            size_t salto = (disposicion == Disposicion::PorFilas) ? 1 : paso;
+            return reducir(datos() + posicion(fila, 0), numColumnas, salto, operacion);
+        });
     }
 
-    void agregarColumna() {
-        for (auto& fila : celdas) {
-            fila.push_back(0.0);
+    double operarColumna(size_t columna, char operacion) const {
+        Medicion medicion(instrumentacion, Operacion::OperarColumna, 0, 16);
+        if (columna >= numColumnas || numFilas == 0) {
+            throw std::out_of_range("Indice de columna fuera de rango");
         }
+        return recordarReduccion({versionColumnas[columna], epocaFilas, 'C', operacion}, [&] {
+            medicion.celdas(numFilas);
+            if (dispersa || comprimida() || !indiceFilas.empty()) {
+                std::vector<double> linea(numFilas);
+                copiarColumna(0, columna, numFilas, linea.data());
+                return reducir(linea.data(), numFilas, 1, operacion);
+            }
+            size_t salto = (disposicion == Disposicion::PorColumnas) ? 1 : paso;
+            return reducir(datos() + posicion(0, columna), numFilas, salto, operacion);
+        });
     }
 
-    void eliminarColumna(size_t index) {
-        if (!celdas.empty() && index < celdas[0].size()) {
-            for (auto& fila : celdas) {
-                fila.erase(fila.begin() + index);
+    // Aciertos y fallos de la cache de operarFila / operarColumna
+    EstadisticasCache estadisticasCache() const {
+        return {aciertosCache, fallosCache, reducciones.size()};
+    }
+
+    void reiniciarEstadisticasCache() {
+        aciertosCache = 0;
+        fallosCache = 0;
+    }
+
+    // Olvida los resultados guardados (para medir operarFila / operarColumna en frio)
+    void vaciarCacheReducciones() {
+        reducciones.clear();
+    }
+
+    // Vuelca la instrumentacion como un objeto JSON en una linea
+    void escribirInstrumentacion(std::ostream& salida) const {
+        instrumentacion.volcarJSON(salida);
+    }
+
+    void reiniciarInstrumentacion() {
+        instrumentacion.reiniciar();
+    }
+
+    // Deshace el ultimo cambio anotado en el diario; devuelve false si no hay
+    bool deshacer() {
+        if (deshacibles.empty()) {
+            return false;
+        }
+        EntradaDiario entrada = std::move(deshacibles.back());
+        deshacibles.pop_back();
+        anotando = false;
+        try {
+            aplicarInversa(entrada);
+        } catch (...) {
+            anotando = true;
+            limpiarDiario();
+            throw;
+        }
+        anotando = true;
+        rehacibles.push_back(std::move(entrada));
+        return true;
+    }
+
+    bool rehacer() {
+        if (rehacibles.empty()) {
+            return false;
+        }
+        EntradaDiario entrada = std::move(rehacibles.back());
+        rehacibles.pop_back();
+        anotando = false;
+        try {
+            aplicarDeNuevo(entrada);
+        } catch (...) {
+            anotando = true;
+            limpiarDiario();
+            throw;
+        }
+        anotando = true;
+        deshacibles.push_back(std::move(entrada));
+        return true;
+    }
+
+    // Memoria maxima del diario en bytes; 0 lo apaga
+    void establecerPresupuestoDiario(size_t bytes) {
+        presupuestoDiario = bytes;
+        while (bytesDiario > presupuestoDiario && !deshacibles.empty()) {
+            bytesDiario -= deshacibles.front().bytes();
+            deshacibles.pop_front();
+        }
+        if (bytesDiario > presupuestoDiario) {
+            limpiarDiario();
+        }
+    }
+
+    EstadisticasDiario estadisticasDiario() const {
+        return {deshacibles.size(), rehacibles.size(), bytesDiario, presupuestoDiario};
+    }
+
+    void limpiarDiario() {
+        deshacibles.clear();
+        rehacibles.clear();
+        bytesDiario = 0;
+    }
+
+    // Activa el registro de cambios en base + ".hoja" (foto del ultimo punto
+    // de control, en el formato de guardarBinario) y base + ".registro" (los
+    // cambios posteriores). Si la foto ya existe la hoja se reemplaza por ella
+    // y se le aplican los cambios registrados: es la recuperacion despues de
+    // un corte. Si no existe, la hoja actual pasa a ser el primer punto de
+    // control. Devuelve false si los archivos no se pudieron usar.
+    bool abrirRegistro(const std::string& base) {
+        cerrarRegistro();
+        std::string foto = base + ".hoja";
+        std::string cambios = base + ".registro";
+        baseRegistro = base;
+        recuperados = 0;
+        CabeceraBinaria cabecera;
+        std::ifstream archivoFoto(foto, std::ios::binary);
+        if (!archivoFoto.read(reinterpret_cast<char*>(&cabecera), sizeof(cabecera))) {
+            registro = RegistroEscritura::crear(cambios, 0);
+            if (!registro || !puntoDeControl()) {
+                registro.reset();
+                std::cerr << "No se pudo crear el registro de cambios." << std::endl;
+                return false;
+            }
+            return true;
+        }
+        archivoFoto.close();
+        uint64_t puntoControl = 0;
+        if (!RegistroEscritura::leerCabecera(cambios, puntoControl) || puntoControl != cabecera.puntoControl) {
+            // Un corte entre los dos reemplazos de un punto de control deja el registro nuevo aparte
+            if (!RegistroEscritura::leerCabecera(cambios + ".tmp", puntoControl) || puntoControl != cabecera.puntoControl ||
+                !RegistroEscritura::reemplazar(cambios + ".tmp", cambios)) {
+                std::cerr << "El registro de cambios no corresponde a " << foto << "." << std::endl;
+                return false;
+            }
+        }
+        std::remove((foto + ".tmp").c_str());
+        std::remove((cambios + ".tmp").c_str());
+        if (!abrirBinario(foto)) {
+            return false;
+        }
+        size_t largo = 0;
+        try {
+            largo = RegistroEscritura::recorrer(cambios, [&](RegistroEscritura::Lector& lector) {
+                aplicarRegistro(lector);
+                ++recuperados;
+            });
+        } catch (const std::exception& e) {
+            std::cerr << "No se pudo aplicar el registro de cambios: " << e.what() << std::endl;
+            return false;
+        }
+        limpiarDiario();
+        registro = RegistroEscritura::continuar(cambios, puntoControl, largo);
+        if (!registro) {
+            std::cerr << "No se pudo abrir el registro de cambios." << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Confirma lo pendiente y deja de registrar
+    void cerrarRegistro() {
+        registro.reset();
+    }
+
+    // Confirma el lote pendiente sin esperar a que se llene
+    bool sincronizarRegistro() {
+        return !registro || registro->confirmar();
+    }
+
+    // Escribe una foto nueva de la hoja y empieza un registro vacio sobre
+    // ella. Ambos se escriben aparte y se ponen en su lugar uno tras otro.
+    bool puntoDeControl() {
+        if (!registro) {
+            return false;
+        }
+        Medicion medicion(instrumentacion, Operacion::PuntoDeControl, numFilas * numColumnas);
+        uint64_t siguiente = registro->obtenerPuntoControl() + 1;
+        std::string foto = baseRegistro + ".hoja";
+        std::string cambios = baseRegistro + ".registro";
+        bool escrita = escribirBinario(foto + ".tmp", siguiente) && RegistroEscritura::asegurarArchivo(foto + ".tmp");
+        std::unique_ptr<RegistroEscritura> nuevo = escrita ? RegistroEscritura::crear(cambios + ".tmp", siguiente) : nullptr;
+        if (nuevo) {
+            nuevo->establecerLote(registro->obtenerLoteBytes(), registro->obtenerDemora());
+            // La foto guarda solo valores: las formulas van en el primer registro
+            if (!formulas.empty()) {
+                ponerFormulas(*nuevo);
+                nuevo->terminar();
+            }
+        }
+        if (!nuevo || !nuevo->confirmar() || !RegistroEscritura::reemplazar(foto + ".tmp", foto) ||
+            !RegistroEscritura::reemplazar(cambios + ".tmp", cambios)) {
+            std::cerr << "No se pudo guardar el punto de control." << std::endl;
+            return false;
+        }
+        registro->descartar();
+        registro = std::move(nuevo);
+        ++puntosControl;
+        return true;
+    }
+
+    // Un lote se confirma al llegar a 'bytes' o cuando su primer cambio lleva
+    // 'milisegundos' esperando
+    void establecerLoteRegistro(size_t bytes, double milisegundos) {
+        if (milisegundos < 0) {
+            throw std::invalid_argument("La espera del lote no puede ser negativa");
+        }
+        if (registro) {
+            registro->establecerLote(bytes, std::chrono::microseconds(static_cast<long long>(milisegundos * 1000)));
+        }
+    }
+
+    // Tamano del registro a partir del cual se hace un punto de control
+    // aunque la foto sea mas chica
+    void establecerMinimoPuntoControl(size_t bytes) {
+        minimoPuntoControl = bytes;
+    }
+
+    EstadisticasRegistro estadisticasRegistro() const {
+        if (!registro) {
+            return {false, 0, 0, 0, 0, puntosControl, recuperados, 0.0};
+        }
+        return {true, registro->cantidadRegistros(), registro->cantidadLotes(), registro->pendientes(), registro->bytes(),
+                puntosControl, recuperados, registro->tiempoSincronizando()};
+    }
+
+    // Dibuja solo la ventana visible. Todo se arma en un texto y se escribe
+    // de una vez, asi que el costo depende de las celdas visibles y no del
+    // tamano de la hoja. Si la hoja se achico, la ventana se corre hasta el final.
+    void mostrar(std::ostream& salida = std::cout) const {
+        Medicion medicion(instrumentacion, Operacion::Mostrar);
+        const size_t ancho = 12;
+        std::string texto = "Hoja de Clculo";
+        if (numFilas == 0 || numColumnas == 0) {
+            texto += " (vacia)\n";
+            salida << texto << std::flush;
+            return;
+        }
+        size_t filas = std::min(vistaFilas, numFilas);
+        size_t columnas = std::min(vistaColumnas, numColumnas);
+        size_t fila0 = std::min(vistaFila, numFilas - filas);
+        size_t columna0 = std::min(vistaColumna, numColumnas - columnas);
+        medicion.celdas(filas * columnas);
+
+        char numero[32];
+        auto agregar = [&](char prefijo, const char* inicio, const char* fin, size_t relleno) {
+            size_t largo = (fin - inicio) + (prefijo ? 1 : 0);
+            if (largo < relleno) {
+                texto.append(relleno - largo, ' ');
+            }
+            if (prefijo) {
+                texto += prefijo;
+            }
+            texto.append(inicio, fin);
+        };
+        auto agregarIndice = [&](char prefijo, size_t indice, size_t relleno) {
+            agregar(prefijo, numero, std::to_chars(numero, numero + sizeof(numero), indice).ptr, relleno);
+        };
+        size_t anchoFila = std::to_string(fila0 + filas - 1).size() + 1;
+
+        texto += ": filas " + std::to_string(fila0) + "-" + std::to_string(fila0 + filas - 1) + " de " + std::to_string(numFilas) +
+                 ", columnas " + std::to_string(columna0) + "-" + std::to_string(columna0 + columnas - 1) + " de " + std::to_string(numColumnas) + "\n";
+        texto.reserve(texto.size() + (filas + 2) * (anchoFila + 2 + columnas * (ancho + 2)));
+        texto.append(anchoFila, ' ');
+        texto += " |";
+        for (size_t col = columna0; col < columna0 + columnas; ++col) {
+            agregarIndice('C', col, ancho + 1);
+            texto += " |";
+        }
+        texto += '\n';
+        texto.append(anchoFila + 1, '-');
+        texto += '+';
+        for (size_t col = 0; col < columnas; ++col) {
+            texto.append(ancho + 2, '-');
+            texto += '+';
+        }
+        texto += '\n';
+        for (size_t fila = fila0; fila < fila0 + filas; ++fila) {
+            agregarIndice('F', fila, anchoFila);
+            texto += " |";
+            for (size_t col = columna0; col < columna0 + columnas; ++col) {
+                char* fin = std::to_chars(numero, numero + sizeof(numero), leerCelda(fila, col), std::chars_format::general, 6).ptr;
+                agregar('\0', numero, fin, ancho + 1);
+                texto += " |";
             }
+            texto += '\n';
+        }
+        salida << texto << std::flush;
+    }
+
+    // Mueve la ventana de mostrar() a partir de (fila, columna)
+    void irA(size_t fila, size_t columna) {
+        vistaFila = fila;
+        vistaColumna = columna;
+    }
+
+    // Corre la ventana; los desplazamientos negativos se detienen en 0
+    void desplazarVista(long long filas, long long columnas) {
+        size_t fila0 = std::min(vistaFila, numFilas - std::min(vistaFilas, numFilas));
+        size_t columna0 = std::min(vistaColumna, numColumnas - std::min(vistaColumnas, numColumnas));
+        vistaFila = filas < 0 ? fila0 - std::min<size_t>(fila0, -static_cast<unsigned long long>(filas)) : fila0 + filas;
+        vistaColumna = columnas < 0 ? columna0 - std::min<size_t>(columna0, -static_cast<unsigned long long>(columnas)) : columna0 + columnas;
+    }
+
+    void establecerTamanoVista(size_t filas, size_t columnas) {
+        if (filas == 0 || columnas == 0) {
+            throw std::invalid_argument("La vista debe tener al menos una fila y una columna");
+        }
+        vistaFilas = filas;
+        vistaColumnas = columnas;
+    }
+
+    bool guardarCSV(const std::string& nombreArchivo) const {
+        Medicion medicion(instrumentacion, Operacion::GuardarCSV, numFilas * numColumnas);
+        bool correcto;
+        size_t escritos = 0;
+        if (comprimida()) {
+            correcto = escribirCSV(nombreArchivo, comprimidas, indiceFilas, indiceColumnas, numFilas, numColumnas, &escritos);
+        } else if (dispersa || !indiceColumnas.empty()) {
+            std::vector<double> linea(numColumnas);
+            correcto = escribirFilasCSV(nombreArchivo, numFilas, numColumnas, 1, [&](size_t fila) {
+                copiarFila(fila, 0, numColumnas, linea.data());
+                return static_cast<const double*>(linea.data());
+            }, &escritos);
         } else {
-            throw std::out_of_range("Indice de columna fuera de rango");
+            const double* base = datos();
+            size_t salto = (disposicion == Disposicion::PorFilas) ? 1 : paso;
+            correcto = escribirFilasCSV(nombreArchivo, numFilas, numColumnas, salto,
+                                        [&](size_t fila) { return base + posicion(fila, 0); }, &escritos);
+        }
+        instrumentacion.escritos(escritos);
+        if (!correcto) {
+            std::cerr << "No se pudo abrir el archivo para guardar." << std::endl;
         }
+        return correcto;
     }
 
-    void actualizarCelda(size_t fila, size_t columna, double valor) {
-        if (fila < celdas.size() && columna < celdas[fila].size()) {
-            celdas[fila][columna] = valor;
+    // Copia las celdas y las escribe desde otro hilo, asi el menu sigue
+    // respondiendo mientras se guarda una hoja grande. Si ya habia un guardado
+    // en curso, primero espera a que termine.
+    // Mientras dura, la memoria extra es la de la copia: el bloque de celdas
+    // entero en la hoja cruda, los bloques ocupados en la dispersa y las
+    // columnas comprimidas tal como estan (mas un tramo de 512 filas que el
+    // hilo decodifica de a uno) en la comprimida.
+    void guardarCSVEnSegundoPlano(const std::string& nombreArchivo) {
+        esperarGuardado();
+        // Se mide solo la copia; la escritura corre en el otro hilo
+        Medicion medicion(instrumentacion, Operacion::GuardarCSVEnSegundoPlano, numFilas * numColumnas);
+        if (dispersa) {
+            guardado = std::async(std::launch::async,
+                [nombreArchivo, copia = disperso, filas = numFilas, columnas = numColumnas] {
+                    return escribirCSV(nombreArchivo, copia, filas, columnas);
+                });
+            return;
+        }
+        if (comprimida()) {
+            // El hilo descomprime su copia de a bloques; la hoja sigue comprimida
+            guardado = std::async(std::launch::async,
+                [nombreArchivo, copia = comprimidas, filasCopia = indiceFilas, columnasCopia = indiceColumnas,
+                 filas = numFilas, columnas = numColumnas] {
+                    return escribirCSV(nombreArchivo, copia, filasCopia, columnasCopia, filas, columnas);
+                });
+            return;
+        }
+        quitarHuecos();
+        std::vector<double> copia(datos(), datos() + lineas() * paso);
+        guardado = std::async(std::launch::async,
+            [nombreArchivo, copia = std::move(copia), filas = numFilas, columnas = numColumnas, paso = paso, disposicion = disposicion] {
+                return escribirCSV(nombreArchivo, copia.data(), filas, columnas, paso, disposicion);
+            });
+    }
+
+    bool guardandoEnSegundoPlano() const {
+        return guardado.valid() && guardado.wait_for(std::chrono::seconds(0)) != std::future_status::ready;
+    }
+
+    // Espera el guardado en segundo plano pendiente; devuelve false si fallo
+    bool esperarGuardado() {
+        if (!guardado.valid()) {
+            return true;
+        }
+        bool correcto = guardado.get();
+        if (!correcto) {
+            std::cerr << "No se pudo abrir el archivo para guardar." << std::endl;
+        }
+        return correcto;
+    }
+
+    // En el modo disperso la carga escribe directo en los bloques, sin pasar
+    // por el bloque contiguo. Devuelve false si el archivo no se pudo abrir.
+    bool cargarCSV(const std::string& nombreArchivo) {
+        Medicion medicion(instrumentacion, Operacion::CargarCSV);
+        auto inicio = std::chrono::steady_clock::now();
+        size_t bytes = 0;
+        bool cargado = false;
+        try {
+#ifndef _WIN32
+            ArchivoMapeado mapa(nombreArchivo);
+            if (mapa.disponible()) {
+                bytes = mapa.tamano();
+                cargarCSVMapeado(mapa.inicio(), bytes);
+                cargado = true;
+            }
+#endif
+            if (!cargado && !cargarCSVFlujo(nombreArchivo, bytes)) {
+                std::cerr << "No se pudo abrir el archivo para cargar." << std::endl;
+                return false;
+            }
+        } catch (...) {
+            // Una carga a medias deja la hoja con otro tamano
+            renovarVersiones();
+            limpiarDiario();
+            if (registroActivo()) {
+                puntoDeControl();
+            }
+            throw;
+        }
+        renovarVersiones();
+        limpiarDiario();
+        if (compresion) {
+            comprimirColumnas();
+        }
+        // Una hoja nueva no se registra cambio por cambio: se toma su foto
+        if (registroActivo()) {
+            puntoDeControl();
+        }
+        medicion.celdas(numFilas * numColumnas);
+        instrumentacion.leidos(bytes);
+
+        if (!avisos) {
+            return true;
+        }
+        double segundos = std::chrono::duration<double>(std::chrono::steady_clock::now() - inicio).count();
+        double megas = bytes / (1024.0 * 1024.0);
+        std::cout << "Archivo CSV cargado correctamente (" << megas << " MB, "
+                  << (segundos > 0 ? megas / segundos : 0.0) << " MB/s)." << std::endl;
+        return true;
+    }
+
+    // Guarda la hoja en el formato binario propio: cabecera de 64 bytes y el
+    // bloque de dobles en la disposicion actual, sin las posiciones de holgura.
+    // Una hoja dispersa, o con huecos sin compactar, se guarda por filas.
+    // Se escribe al lado y se renombra: el archivo puede ser el que esta
+    // proyectado (abrirBinario), y truncarlo dejaria sin respaldo las paginas
+    // que todavia no se copiaron.
+    bool guardarBinario(const std::string& nombreArchivo) const {
+        Medicion medicion(instrumentacion, Operacion::GuardarBinario, numFilas * numColumnas);
+        std::string temporal = nombreArchivo + ".tmp";
+        if (!escribirBinario(temporal, 0)) {
+            std::remove(temporal.c_str());
+            return false;
+        }
+        if (!RegistroEscritura::reemplazar(temporal, nombreArchivo)) {
+            std::cerr << "No se pudo reemplazar el archivo binario." << std::endl;
+            std::remove(temporal.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    // Abre un archivo guardado con guardarBinario. Donde hay mmap el bloque de
+    // celdas es la propia proyeccion del archivo, asi que abrir no copia ni
+    // convierte nada; con 'verificar' se recorre una vez para comprobar la suma.
+    bool abrirBinario(const std::string& nombreArchivo, bool verificar = true) {
+        Medicion medicion(instrumentacion, Operacion::AbrirBinario);
+        CabeceraBinaria cabecera;
+#ifndef _WIN32
+        auto proyeccion = std::make_unique<ArchivoMapeado>(nombreArchivo, true);
+        if (!proyeccion->disponible() || proyeccion->tamano() < sizeof(cabecera)) {
+            std::cerr << "No se pudo abrir el archivo binario." << std::endl;
+            return false;
+        }
+        std::memcpy(&cabecera, proyeccion->inicio(), sizeof(cabecera));
+        double* bloque = reinterpret_cast<double*>(proyeccion->inicio() + sizeof(cabecera));
+        size_t disponibles = (proyeccion->tamano() - sizeof(cabecera)) / sizeof(double);
+#else
+        std::ifstream archivo(nombreArchivo, std::ios::binary);
+        if (!archivo.is_open() || !archivo.read(reinterpret_cast<char*>(&cabecera), sizeof(cabecera))) {
+            std::cerr << "No se pudo abrir el archivo binario." << std::endl;
+            return false;
+        }
+        std::pmr::vector<double> leidas(cabecera.filas * cabecera.columnas, memoria);
+        archivo.read(reinterpret_cast<char*>(leidas.data()), leidas.size() * sizeof(double));
+        double* bloque = leidas.data();
+        size_t disponibles = archivo.gcount() / sizeof(double);
+#endif
+        if (std::memcmp(cabecera.magia, magiaBinaria, sizeof(magiaBinaria)) != 0 ||
+            cabecera.version != versionBinaria || cabecera.disposicion > 1 ||
+            cabecera.filas > maximoLineas || cabecera.columnas > maximoLineas ||
+            (cabecera.columnas != 0 && cabecera.filas > disponibles / cabecera.columnas) ||
+            cabecera.filas * cabecera.columnas != disponibles) {
+            std::cerr << "El archivo no es una hoja binaria valida." << std::endl;
+            return false;
+        }
+        size_t total = cabecera.filas * cabecera.columnas;
+        if (verificar) {
+            SumaVerificacion suma;
+            suma.agregar(bloque, total * sizeof(double));
+            if (suma.valor() != cabecera.suma) {
+                std::cerr << "La suma de verificacion del archivo binario no coincide." << std::endl;
+                return false;
+            }
+        }
+
+        soltarMapeo();
+        borrarFormulas();
+        dispersa = false;
+        disperso.limpiar();
+        olvidarIndices();
+        indiceSumasAlDia = false;
+        indicesColumnasAlDia = false;
+        disposicion = cabecera.disposicion == 0 ? Disposicion::PorFilas : Disposicion::PorColumnas;
+        numFilas = cabecera.filas;
+        numColumnas = numFilas == 0 ? 0 : cabecera.columnas;
+        paso = largoLinea();
+        renovarVersiones();
+        limpiarDiario();
+#ifndef _WIN32
+        celdas.clear();
+        celdas.shrink_to_fit();
+        if (total > 0) {
+            mapa = std::move(proyeccion);
+            bloqueMapeado = bloque;
+        }
+#else
+        celdas.swap(leidas);
+#endif
+        medicion.celdas(total);
+        // Con la proyeccion solo se lee todo al verificar; lo demas se pagina a demanda
+        instrumentacion.leidos(sizeof(cabecera) + (verificar ? total * sizeof(double) : 0));
+        if (registroActivo()) {
+            puntoDeControl();
+        }
+        return true;
+    }
+};
+
+// Uso de memoria de un LibroCalculo. 'reservados' es lo pedido al sistema,
+// 'entregados' lo que tienen las hojas en tramos, 'ocupados' lo que piden
+// de verdad sus contenedores y 'libres' los tramos devueltos que esperan
+// otra hoja. La fragmentacion es la parte reservada que no esta ocupada.
+struct EstadisticasMemoria {
+    size_t reservados;
+    size_t entregados;
+    size_t ocupados;
+    size_t libres;
+    size_t picoReservados;
+    size_t picoOcupados;
+    size_t tramos;
+    double fragmentacion;
+};
+
+// Tramos de memoria compartidos por las hojas de un libro. Un tramo devuelto
+// no vuelve al sistema: queda en una lista por tamano y se entrega a la
+// proxima hoja que pida un tamano parecido (hasta un cuarto mas grande), asi
+// cargar y soltar hojas reutiliza los mismos bloques. recortar() devuelve al
+// sistema los que nadie usa.
+class ArenaLibro {
+public:
+    static constexpr size_t pagina = 4096;
+    static constexpr size_t alineacion = 64;
+
+    ArenaLibro() = default;
+    ArenaLibro(const ArenaLibro&) = delete;
+    ArenaLibro& operator=(const ArenaLibro&) = delete;
+
+    ~ArenaLibro() {
+        recortar();
+        for (const auto& entregado : entregados) {
+            ::operator delete(entregado.first, std::align_val_t(alineacion));
+        }
+    }
+
+    // Entrega un tramo de al menos 'bytes'; en 'bytes' queda su tamano real
+    void* tomar(size_t& bytes) {
+        bytes = (bytes + pagina - 1) / pagina * pagina;
+        std::lock_guard<std::mutex> bloqueo(mutex);
+        void* tramo = nullptr;
+        auto libre = libres.lower_bound(bytes);
+        if (libre != libres.end() && libre->first <= bytes + bytes / 4) {
+            bytes = libre->first;
+            tramo = libre->second;
+            libres.erase(libre);
+            bytesLibres -= bytes;
         } else {
-            throw std::out_of_range("Indice de celda fuera de rango");
+            try {
+                tramo = ::operator new(bytes, std::align_val_t(alineacion));
+            } catch (const std::bad_alloc&) {
+                // Lo libre no sirve en este tamano: se devuelve al sistema y se reintenta
+                recortarSinBloqueo();
+                tramo = ::operator new(bytes, std::align_val_t(alineacion));
+            }
+            bytesReservados += bytes;
+            picoReservados = std::max(picoReservados, bytesReservados);
+        }
+        entregados.emplace(tramo, bytes);
+        bytesEntregados += bytes;
+        return tramo;
+    }
+
+    void devolver(void* tramo) {
+        std::lock_guard<std::mutex> bloqueo(mutex);
+        auto entregado = entregados.find(tramo);
+        size_t bytes = entregado->second;
+        entregados.erase(entregado);
+        bytesEntregados -= bytes;
+        libres.emplace(bytes, tramo);
+        bytesLibres += bytes;
+    }
+
+    void recortar() {
+        std::lock_guard<std::mutex> bloqueo(mutex);
+        recortarSinBloqueo();
+    }
+
+    // Lo que piden los contenedores de las hojas, para el pico y la fragmentacion
+    void ocupar(size_t bytes) {
+        size_t ahora = bytesOcupados.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+        size_t pico = picoOcupados.load(std::memory_order_relaxed);
+        while (ahora > pico && !picoOcupados.compare_exchange_weak(pico, ahora, std::memory_order_relaxed)) {
+        }
+    }
+    void desocupar(size_t bytes) {
+        bytesOcupados.fetch_sub(bytes, std::memory_order_relaxed);
+    }
+
+    EstadisticasMemoria estadisticas() {
+        std::lock_guard<std::mutex> bloqueo(mutex);
+        EstadisticasMemoria resultado;
+        resultado.reservados = bytesReservados;
+        resultado.entregados = bytesEntregados;
+        resultado.ocupados = bytesOcupados.load(std::memory_order_relaxed);
+        resultado.libres = bytesLibres;
+        resultado.picoReservados = picoReservados;
+        resultado.picoOcupados = picoOcupados.load(std::memory_order_relaxed);
+        resultado.tramos = entregados.size() + libres.size();
+        resultado.fragmentacion = bytesReservados ? 1.0 - static_cast<double>(resultado.ocupados) / bytesReservados : 0.0;
+        return resultado;
+    }
+
+private:
+    std::mutex mutex;
+    std::multimap<size_t, void*> libres;
+    std::unordered_map<void*, size_t> entregados;
+    size_t bytesReservados = 0;
+    size_t bytesEntregados = 0;
+    size_t bytesLibres = 0;
+    size_t picoReservados = 0;
+    std::atomic<size_t> bytesOcupados{0};
+    std::atomic<size_t> picoOcupados{0};
+
+    void recortarSinBloqueo() {
+        for (const auto& libre : libres) {
+            ::operator delete(libre.second, std::align_val_t(alineacion));
+            bytesReservados -= libre.first;
+        }
+        libres.clear();
+        bytesLibres = 0;
+    }
+};
+
+// Memoria de una hoja del libro. Lo grande (el bloque de celdas) es un tramo
+// propio de la ArenaLibro y vuelve a ella al soltarse. Lo chico (bloques
+// dispersos de 2 KB, por ejemplo) sale de tramos de 64 KB avanzando un
+// puntero, y lo que se suelta queda en una lista por potencia de 2 para la
+// misma hoja. Al destruirse la arena, sus tramos vuelven todos juntos.
+class ArenaHoja : public std::pmr::memory_resource {
+public:
+    explicit ArenaHoja(ArenaLibro& libro) : libro(libro) {}
+    ArenaHoja(const ArenaHoja&) = delete;
+    ArenaHoja& operator=(const ArenaHoja&) = delete;
+
+    ~ArenaHoja() override {
+        for (void* tramo : tramos) {
+            libro.devolver(tramo);
+        }
+        libro.desocupar(ocupados);
+    }
+
+    size_t bytesOcupados() const { return ocupados; }
+
+private:
+    static constexpr size_t tramoChico = 64 << 10;
+    static constexpr size_t maximoChico = 16 << 10;
+    // Clases 16, 32, ... maximoChico bytes
+    static constexpr size_t clases = 11;
+
+    ArenaLibro& libro;
+    std::vector<void*> tramos;
+    char* actual = nullptr;
+    size_t restante = 0;
+    std::array<void*, clases> libres{};
+    size_t ocupados = 0;
+
+    static size_t clase(size_t bytes) {
+        size_t indice = 0;
+        while ((size_t(16) << indice) < bytes) {
+            ++indice;
+        }
+        return indice;
+    }
+
+    void* do_allocate(size_t bytes, size_t alineacion) override {
+        libro.ocupar(bytes);
+        ocupados += bytes;
+        if (bytes > maximoChico || alineacion > ArenaLibro::alineacion) {
+            size_t tamano = bytes;
+            return libro.tomar(tamano);
+        }
+        size_t indice = clase(bytes);
+        if (libres[indice] != nullptr) {
+            void* bloque = libres[indice];
+            libres[indice] = *static_cast<void**>(bloque);
+            return bloque;
+        }
+        // Cada clase queda alineada a su tamano (hasta 64 bytes)
+        size_t tamano = size_t(16) << indice;
+        size_t alinear = std::min(tamano, ArenaLibro::alineacion);
+        size_t salto = (alinear - reinterpret_cast<uintptr_t>(actual) % alinear) % alinear;
+        if (actual == nullptr || salto + tamano > restante) {
+            size_t nuevo = tramoChico;
+            actual = static_cast<char*>(libro.tomar(nuevo));
+            restante = nuevo;
+            tramos.push_back(actual);
+            salto = 0;
+        }
+        void* bloque = actual + salto;
+        actual += salto + tamano;
+        restante -= salto + tamano;
+        return bloque;
+    }
+
+    void do_deallocate(void* bloque, size_t bytes, size_t alineacion) override {
+        libro.desocupar(bytes);
+        ocupados -= bytes;
+        if (bytes > maximoChico || alineacion > ArenaLibro::alineacion) {
+            libro.devolver(bloque);
+            return;
+        }
+        size_t indice = clase(bytes);
+        *static_cast<void**>(bloque) = libres[indice];
+        libres[indice] = bloque;
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& otra) const noexcept override {
+        return this == &otra;
+    }
+};
+
+// Un libro con varias hojas con nombre. Cada hoja guarda sus celdas en su
+// propia ArenaHoja, y todas toman los tramos de la misma ArenaLibro: crear,
+// cargar o eliminar una hoja entera pide o devuelve tramos grandes, no
+// miles de bloques sueltos.
+//
+// Los rangos pueden nombrar la hoja: "Ventas!F0C0:F9C2". Sin nombre se usa
+// la hoja activa. Varios rangos separados por comas, de la misma hoja o de
+// otras, se resumen juntos.
+class LibroCalculo {
+private:
+    // La arena se declara antes que las hojas para destruirse despues
+    ArenaLibro arena;
+    // La hoja se declara despues de su arena para destruirse antes
+    struct Hoja {
+        std::unique_ptr<ArenaHoja> memoria;
+        std::unique_ptr<HojaCalculo> hoja;
+    };
+    std::map<std::string, Hoja> hojas;
+    std::string nombreActiva;
+
+    struct ReferenciaRango {
+        HojaCalculo* hoja;
+        size_t fila1;
+        size_t columna1;
+        size_t fila2;
+        size_t columna2;
+    };
+
+    static size_t leerNumeroReferencia(const std::string& texto, size_t& i) {
+        size_t inicio = i;
+        size_t valor = 0;
+        while (i < texto.size() && std::isdigit(static_cast<unsigned char>(texto[i]))) {
+            valor = valor * 10 + static_cast<size_t>(texto[i++] - '0');
+        }
+        if (i == inicio) {
+            throw std::invalid_argument("Referencia no valida: " + texto);
+        }
+        return valor;
+    }
+
+    static void leerCelda(const std::string& texto, size_t& i, size_t& fila, size_t& columna) {
+        if (i >= texto.size() || std::toupper(static_cast<unsigned char>(texto[i])) != 'F') {
+            throw std::invalid_argument("Referencia no valida: " + texto);
+        }
+        fila = leerNumeroReferencia(texto, ++i);
+        if (i >= texto.size() || std::toupper(static_cast<unsigned char>(texto[i])) != 'C') {
+            throw std::invalid_argument("Referencia no valida: " + texto);
         }
+        columna = leerNumeroReferencia(texto, ++i);
     }
 
-    double obtenerCelda(size_t fila, size_t columna) const {
-        if (fila < celdas.size() && columna < celdas[fila].size()) {
-            return celdas[fila][columna];
-        } else {
-            throw std::out_of_range("Indice de celda fuera de rango");
+    // "Hoja!FxCy:FzCw", "Hoja!FxCy" o lo mismo sin "Hoja!"
+    ReferenciaRango leerReferencia(std::string texto) {
+        texto.erase(0, texto.find_first_not_of(" \t"));
+        texto.erase(texto.find_last_not_of(" \t") + 1);
+        size_t exclamacion = texto.rfind('!');
+        ReferenciaRango referencia;
+        referencia.hoja = exclamacion == std::string::npos ? &activa() : &hoja(texto.substr(0, exclamacion));
+        size_t i = exclamacion == std::string::npos ? 0 : exclamacion + 1;
+        leerCelda(texto, i, referencia.fila1, referencia.columna1);
+        referencia.fila2 = referencia.fila1;
+        referencia.columna2 = referencia.columna1;
+        if (i < texto.size() && texto[i] == ':') {
+            leerCelda(texto, ++i, referencia.fila2, referencia.columna2);
+        }
+        if (i != texto.size()) {
+            throw std::invalid_argument("Referencia no valida: " + texto);
         }
+        return referencia;
     }
 
-    double operarCeldas(size_t fila1, size_t col1, size_t fila2, size_t col2, char operacion) const {
-        double valor1 = obtenerCelda(fila1, col1);
-        double valor2 = obtenerCelda(fila2, col2);
+public:
+    LibroCalculo() = default;
+    LibroCalculo(const LibroCalculo&) = delete;
+    LibroCalculo& operator=(const LibroCalculo&) = delete;
 
-        switch (operacion) {
-            case '+': return valor1 + valor2;
-            case '-': return valor1 - valor2;
-            case '*': return valor1 * valor2;
-            case '/':
-                if (valor2 != 0) return valor1 / valor2;
-                else throw std::invalid_argument("Error: Division por cero.");
-            default:
-                throw std::invalid_argument("Error: Operacion no valida.");
+    // Crea una hoja vacia; la primera pasa a ser la activa
+    HojaCalculo& crearHoja(const std::string& nombre) {
+        if (nombre.empty() || nombre.find_first_of("!,") != std::string::npos) {
+            throw std::invalid_argument("Nombre de hoja no valido: '" + nombre + "'");
+        }
+        if (hojas.count(nombre)) {
+            throw std::invalid_argument("Ya existe la hoja '" + nombre + "'");
         }
+        Hoja nueva;
+        nueva.memoria = std::make_unique<ArenaHoja>(arena);
+        nueva.hoja = std::make_unique<HojaCalculo>(nueva.memoria.get());
+        HojaCalculo& hoja = *nueva.hoja;
+        hojas.emplace(nombre, std::move(nueva));
+        if (nombreActiva.empty()) {
+            nombreActiva = nombre;
+        }
+        return hoja;
     }
 
-    double operarFila(size_t fila, char operacion) const {
-        if (fila >= celdas.size()) {
-            throw std::out_of_range("Indice de fila fuera de rango");
+    HojaCalculo& hoja(const std::string& nombre) {
+        auto it = hojas.find(nombre);
+        if (it == hojas.end()) {
+            throw std::out_of_range("No existe la hoja '" + nombre + "'");
         }
+        return *it->second.hoja;
+    }
 
-        double resultado = celdas[fila][0];
-        for (size_t col = 1; col < celdas[fila].size(); ++col) {
-            switch (operacion) {
-                case '+': resultado += celdas[fila][col]; break;
-                case '-': resultado -= celdas[fila][col]; break;
-                case '*': resultado *= celdas[fila][col]; break;
-                case '/':
-                    if (celdas[fila][col] != 0) resultado /= celdas[fila][col];
-                    else throw std::invalid_argument("Error: Division por cero.");
-                default: throw std::invalid_argument("Error: Operacion no valida.");
-            }
+    bool existeHoja(const std::string& nombre) const {
+        return hojas.count(nombre) != 0;
+    }
+
+    // Destruye la hoja y devuelve sus tramos a la arena del libro
+    void eliminarHoja(const std::string& nombre) {
+        auto it = hojas.find(nombre);
+        if (it == hojas.end()) {
+            throw std::out_of_range("No existe la hoja '" + nombre + "'");
+        }
+        hojas.erase(it);
+        if (nombreActiva == nombre) {
+            nombreActiva = hojas.empty() ? std::string() : hojas.begin()->first;
         }
-        return resultado;
     }
 
-    double operarColumna(size_t columna, char operacion) const {
-        if (columna >= celdas[0].size()) {
-            throw std::out_of_range("Indice de columna fuera de rango");
+    // Agrupa las filas de la hoja activa en una hoja nueva (ver
+    // HojaCalculo::agrupar); si falla, la hoja nueva no queda en el libro
+    size_t agrupar(const std::vector<size_t>& claves, const std::vector<Agregacion>& agregaciones,
+                   const std::string& destino) {
+        HojaCalculo& origen = activa();
+        HojaCalculo& nueva = crearHoja(destino);
+        try {
+            return origen.agrupar(claves, agregaciones, nueva);
+        } catch (...) {
+            eliminarHoja(destino);
+            throw;
         }
+    }
 
-        double resultado = celdas[0][columna];
-        for (size_t fila = 1; fila < celdas.size(); ++fila) {
-            switch (operacion) {
-                case '+': resultado += celdas[fila][columna]; break;
-                case '-': resultado -= celdas[fila][columna]; break;
-                case '*': resultado *= celdas[fila][columna]; break;
-                case '/':
-                    if (celdas[fila][columna] != 0) resultado /= celdas[fila][columna];
-                    else throw std::invalid_argument("Error: Division por cero.");
-                default: throw std::invalid_argument("Error: Operacion no valida.");
-            }
+    std::vector<std::string> nombres() const {
+        std::vector<std::string> resultado;
+        for (const auto& entrada : hojas) {
+            resultado.push_back(entrada.first);
         }
         return resultado;
     }
 
-    void mostrar() const {
-        std::cout << "Hoja de Clculo:\n";
+    size_t cantidadHojas() const {
+        return hojas.size();
+    }
 
-        for (size_t i = 0; i < celdas[0].size(); ++i) {
-            std::cout << "-------";
-        }
-        std::cout << std::endl;
+    void activar(const std::string& nombre) {
+        hoja(nombre);
+        nombreActiva = nombre;
+    }
 
-        for (const auto& fila : celdas) {
-            std::cout << "|";
-            for (const auto& celda : fila) {
-                std::cout << " " << celda << " |";
-            }
-            std::cout << std::endl;
+    const std::string& nombreHojaActiva() const {
+        return nombreActiva;
+    }
 
-            for (size_t i = 0; i < celdas[0].size(); ++i) {
-                std::cout << "-------";
-            }
-            std::cout << std::endl;
+    HojaCalculo& activa() {
+        if (nombreActiva.empty()) {
+            throw std::out_of_range("El libro no tiene hojas");
         }
-        std::cout << std::endl;
+        return hoja(nombreActiva);
     }
 
-    void guardarCSV(const std::string& nombreArchivo) const {
-        std::ofstream archivo(nombreArchivo);
-        if (archivo.is_open()) {
-            for (const auto& fila : celdas) {
-                for (size_t i = 0; i < fila.size(); ++i) {
-                    archivo << fila[i];
-                    if (i < fila.size() - 1) {
-                        archivo << ",";
-                    }
-                }
-                archivo << "\n";
-            }
-            archivo.close();
-        } else {
-            std::cerr << "No se pudo abrir el archivo para guardar." << std::endl;
+    // Estadisticas de uno o varios rangos separados por comas, de cualquier
+    // hoja: "A!F0C0:F9C0, B!F0C0:F9C0". Cada rango se resume en su hoja y los
+    // resumenes se unen sin volver a recorrer las celdas.
+    EstadisticasRango estadisticasRango(const std::string& referencias) {
+        Acumulado total;
+        std::stringstream partes(referencias);
+        std::string parte;
+        while (std::getline(partes, parte, ',')) {
+            ReferenciaRango rango = leerReferencia(parte);
+            EstadisticasRango resumen = rango.hoja->estadisticasRango(rango.fila1, rango.columna1, rango.fila2, rango.columna2);
+            Acumulado acumulado;
+            acumulado.cuenta = resumen.cuenta;
+            acumulado.suma = resumen.suma;
+            acumulado.minimo = resumen.minimo;
+            acumulado.maximo = resumen.maximo;
+            acumulado.cuadrados = resumen.cuenta > 1 ? resumen.desviacion * resumen.desviacion * (resumen.cuenta - 1) : 0.0;
+            total.unir(acumulado);
         }
+        if (total.cuenta == 0) {
+            throw std::invalid_argument("No se indico ningun rango");
+        }
+        EstadisticasRango resultado;
+        resultado.suma = total.total();
+        resultado.minimo = total.minimo;
+        resultado.maximo = total.maximo;
+        resultado.cuenta = total.cuenta;
+        resultado.promedio = resultado.suma / total.cuenta;
+        resultado.desviacion = total.cuenta > 1 ? std::sqrt(total.cuadrados / (total.cuenta - 1))
+                                                : std::numeric_limits<double>::quiet_NaN();
+        return resultado;
     }
 
-    void cargarCSV(const std::string& nombreArchivo) {
-        std::ifstream archivo(nombreArchivo);
-        if (!archivo.is_open()) {
-            std::cerr << "No se pudo abrir el archivo para cargar." << std::endl;
-            return;
+    // Suma de uno o varios rangos; cada uno usa el indice de sumas de su hoja
+    double sumaRango(const std::string& referencias) {
+        double total = 0.0;
+        std::stringstream partes(referencias);
+        std::string parte;
+        while (std::getline(partes, parte, ',')) {
+            ReferenciaRango rango = leerReferencia(parte);
+            total += rango.hoja->sumaRango(rango.fila1, rango.columna1, rango.fila2, rango.columna2);
         }
+        return total;
+    }
 
-        celdas.clear(); // Limpiar celdas antes de cargar
-        std::string linea;
-        while (std::getline(archivo, linea)) {
-            std::vector<double> fila;
-            std::stringstream ss(linea);
-            std::string valor;
-            while (std::getline(ss, valor, ',')) {
-                fila.push_back(std::stod(valor));
-            }
-            celdas.push_back(fila);
-        }
+    EstadisticasMemoria estadisticasMemoria() {
+        return arena.estadisticas();
+    }
 
-        archivo.close();
-        std::cout << "Archivo CSV cargado correctamente." << std::endl;
+    // Devuelve al sistema los tramos que ninguna hoja usa
+    void recortarMemoria() {
+        arena.recortar();
     }
 };
 
@@ -208,6 +7150,80 @@ size_t leerTamano(const std::string& mensaje) {
     }
 }
 
+// Claves de orden escritas como "2 desc 0": columnas, cada una seguida
+// opcionalmente de "asc" o "desc"
+std::vector<ClaveOrden> leerClavesOrden(std::istream& entrada) {
+    std::vector<ClaveOrden> claves;
+    std::string palabra;
+    while (entrada >> palabra) {
+        if (palabra == "asc" || palabra == "desc") {
+            if (claves.empty()) {
+                throw std::invalid_argument("'" + palabra + "' debe ir despues de una columna");
+            }
+            claves.back().descendente = palabra == "desc";
+        } else if (!palabra.empty() && std::all_of(palabra.begin(), palabra.end(), [](unsigned char c) { return std::isdigit(c); })) {
+            claves.push_back({std::stoul(palabra)});
+        } else {
+            throw std::invalid_argument("se esperaba una columna, 'asc' o 'desc': " + palabra);
+        }
+    }
+    if (claves.empty()) {
+        throw std::invalid_argument("falta la columna por la que ordenar");
+    }
+    return claves;
+}
+
+const char* nombreCodificacion(CodificacionColumna codificacion) {
+    switch (codificacion) {
+        case CodificacionColumna::Diccionario: return "diccionario";
+        case CodificacionColumna::Referencia: return "referencia";
+        case CodificacionColumna::Xor: return "xor";
+        default: return "cruda";
+    }
+}
+
+// Agrupacion escrita como "0 1 : 2 suma 2 promedio 3 cuenta": columnas
+// clave, dos puntos y pares columna funcion (suma, cuenta, minimo, maximo
+// o promedio)
+void leerAgrupacion(std::istream& entrada, std::vector<size_t>& claves, std::vector<Agregacion>& agregaciones) {
+    auto esNumero = [](const std::string& palabra) {
+        return !palabra.empty() && std::all_of(palabra.begin(), palabra.end(), [](unsigned char c) { return std::isdigit(c); });
+    };
+    std::string palabra;
+    while (entrada >> palabra && palabra != ":") {
+        if (!esNumero(palabra)) {
+            throw std::invalid_argument("se esperaba una columna clave o ':': " + palabra);
+        }
+        claves.push_back(std::stoul(palabra));
+    }
+    if (claves.empty()) {
+        throw std::invalid_argument("falta la columna por la que agrupar");
+    }
+    while (entrada >> palabra) {
+        if (!esNumero(palabra)) {
+            throw std::invalid_argument("se esperaba una columna de valores: " + palabra);
+        }
+        size_t columna = std::stoul(palabra);
+        std::string funcion;
+        if (!(entrada >> funcion)) {
+            throw std::invalid_argument("falta la funcion de la columna " + palabra);
+        }
+        if (funcion == "suma") {
+            agregaciones.push_back({columna, FuncionRango::Suma});
+        } else if (funcion == "cuenta") {
+            agregaciones.push_back({columna, FuncionRango::Contar});
+        } else if (funcion == "minimo") {
+            agregaciones.push_back({columna, FuncionRango::Minimo});
+        } else if (funcion == "maximo") {
+            agregaciones.push_back({columna, FuncionRango::Maximo});
+        } else if (funcion == "promedio") {
+            agregaciones.push_back({columna, FuncionRango::Promedio});
+        } else {
+            throw std::invalid_argument("funcion de agrupacion desconocida '" + funcion + "'");
+        }
+    }
+}
+
 void limpiarConsola() {
 #ifdef _WIN32
     system("cls");
@@ -216,11 +7232,15 @@ void limpiarConsola() {
 #endif
 }
 
-void menu(HojaCalculo& hoja) {
+void menu(LibroCalculo& libro) {
     int opcion;
     do {
+        // Las opciones trabajan sobre la hoja activa del libro
+        HojaCalculo& hoja = libro.activa();
         limpiarConsola();
-        std::cout << "--- Menu de Hoja de Calculo ---\n";
+        hoja.mostrar();
+        std::cout << "--- Menu de Hoja de Calculo (" << libro.nombreHojaActiva() << ", "
+                  << libro.cantidadHojas() << " hoja(s) en el libro) ---\n";
         std::cout << "1. Agregar Fila\n";
         std::cout << "2. Eliminar Fila\n";
         std::cout << "3. Agregar Columna\n";
@@ -232,6 +7252,38 @@ void menu(HojaCalculo& hoja) {
         std::cout << "9. Operar Todos los Elementos de una Columna\n";
         std::cout << "10. Guardar en CSV\n";
         std::cout << "11. Cargar desde CSV\n";
+        std::cout << "12. Cambiar Disposicion (por filas / por columnas)\n";
+        std::cout << "13. Configurar Hilos\n";
+        std::cout << "14. Guardar en CSV en Segundo Plano\n";
+        std::cout << "15. Guardar en Formato Binario\n";
+        std::cout << "16. Abrir Archivo Binario\n";
+        std::cout << "17. Escribir Formula en Celda\n";
+        std::cout << "18. Ver Formula de Celda\n";
+        std::cout << "19. Cambiar Almacenamiento (denso / disperso)\n";
+        std::cout << "20. Compactar Hoja\n";
+        std::cout << "21. Actualizar Celdas desde Archivo (fila,columna,valor)\n";
+        std::cout << "22. Estadisticas de un Rango\n";
+        std::cout << "23. Indice de Sumas (ninguno / tabla / Fenwick)\n";
+        std::cout << "24. Suma de un Rango\n";
+        std::cout << "25. Ver Cache de Operaciones por Fila / Columna\n";
+        std::cout << "26. Desplazar Vista\n";
+        std::cout << "27. Ir a Celda\n";
+        std::cout << "28. Cambiar Tamano de la Vista\n";
+        std::cout << "29. Ver Instrumentacion (JSON)\n";
+        std::cout << "30. Deshacer\n";
+        std::cout << "31. Rehacer\n";
+        std::cout << "32. Memoria para Deshacer\n";
+        std::cout << "33. Registro de Cambios (abrir / recuperar)\n";
+        std::cout << "34. Punto de Control del Registro\n";
+        std::cout << "35. Cambiar de Hoja (la crea si no existe)\n";
+        std::cout << "36. Eliminar Hoja\n";
+        std::cout << "37. Estadisticas de Rangos entre Hojas\n";
+        std::cout << "38. Memoria del Libro\n";
+        std::cout << "39. Ordenar Filas por Columnas\n";
+        std::cout << "40. Indice de Columna (hash, ordenado o ninguno)\n";
+        std::cout << "41. Buscar o Filtrar Filas por Valor\n";
+        std::cout << "42. Agrupar Filas en una Hoja Nueva\n";
+        std::cout << "43. Compresion de Columnas\n";
         std::cout << "0. Salir\n";
         std::cout << "Ingrese su opcion: ";
         std::cin >> opcion;
@@ -309,19 +7361,402 @@ void menu(HojaCalculo& hoja) {
                 std::string nombreArchivo;
                 std::cout << "Ingrese el nombre del archivo CSV para guardar: ";
                 std::cin >> nombreArchivo;
-                hoja.guardarCSV(nombreArchivo);
-                std::cout << "Datos guardados correctamente en " << nombreArchivo << ".\n";
+                if (hoja.guardarCSV(nombreArchivo)) {
+                    std::cout << "Datos guardados correctamente en " << nombreArchivo << ".\n";
+                }
                 break;
             }
             case 11: {
                 std::string nombreArchivo;
                 std::cout << "Ingrese el nombre del archivo CSV para cargar: ";
                 std::cin >> nombreArchivo;
-                hoja.cargarCSV(nombreArchivo);
-                hoja.mostrar(); // Mostrar la hoja despus de cargar
+                if (hoja.cargarCSV(nombreArchivo)) {
+                    hoja.mostrar(); // Mostrar la hoja despus de cargar
+                }
+                break;
+            }
+            case 12: {
+                if (hoja.obtenerDisposicion() == Disposicion::PorFilas) {
+                    hoja.establecerDisposicion(Disposicion::PorColumnas);
+                    std::cout << "Hoja almacenada por columnas.\n";
+                } else {
+                    hoja.establecerDisposicion(Disposicion::PorFilas);
+                    std::cout << "Hoja almacenada por filas.\n";
+                }
+                break;
+            }
+            case 13: {
+                size_t cantidad = leerTamano("Ingrese la cantidad de hilos (0 = todos los nucleos): ");
+                hoja.establecerHilos(cantidad);
+                std::cout << "Usando " << hoja.obtenerHilos() << " hilo(s).\n";
+                break;
+            }
+            case 14: {
+                std::string nombreArchivo;
+                std::cout << "Ingrese el nombre del archivo CSV para guardar: ";
+                std::cin >> nombreArchivo;
+                hoja.guardarCSVEnSegundoPlano(nombreArchivo);
+                std::cout << "Guardando en " << nombreArchivo << " en segundo plano.\n";
+                break;
+            }
+            case 15: {
+                std::string nombreArchivo;
+                std::cout << "Ingrese el nombre del archivo binario para guardar: ";
+                std::cin >> nombreArchivo;
+                if (hoja.guardarBinario(nombreArchivo)) {
+                    std::cout << "Datos guardados en " << nombreArchivo << ".\n";
+                }
+                break;
+            }
+            case 16: {
+                std::string nombreArchivo;
+                std::cout << "Ingrese el nombre del archivo binario para abrir: ";
+                std::cin >> nombreArchivo;
+                auto inicio = std::chrono::steady_clock::now();
+                if (hoja.abrirBinario(nombreArchivo)) {
+                    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - inicio).count();
+                    std::cout << "Archivo binario abierto en " << ms << " ms.\n";
+                }
+                break;
+            }
+            case 17: {
+                size_t fila = leerTamano("Ingrese el ndice de la fila: ");
+                size_t columna = leerTamano("Ingrese el ndice de la columna: ");
+                std::string texto;
+                std::cout << "Ingrese la formula (ejemplo: =F0C0 + SUMA(F1C0:F9C0)): ";
+                std::getline(std::cin, texto);
+                try {
+                    hoja.establecerFormula(fila, columna, texto);
+                    const EstadisticasRecalculo& recalculo = hoja.estadisticasRecalculo();
+                    std::cout << "Formula guardada. Valor: " << hoja.obtenerCelda(fila, columna) << "\n";
+                    std::cout << "Recalculo: " << recalculo.tareas << " formula(s) en " << recalculo.niveles
+                              << " nivel(es), " << recalculo.milisegundos << " ms, aceleracion x"
+                              << recalculo.aceleracion << "\n";
+                } catch (const std::exception& e) {
+                    std::cout << "Error: " << e.what() << std::endl;
+                }
+                break;
+            }
+            case 18: {
+                size_t fila = leerTamano("Ingrese el ndice de la fila: ");
+                size_t columna = leerTamano("Ingrese el ndice de la columna: ");
+                if (hoja.tieneFormula(fila, columna)) {
+                    std::cout << "Formula: " << hoja.obtenerFormula(fila, columna) << "\n";
+                } else {
+                    std::cout << "La celda no tiene formula.\n";
+                }
+                break;
+            }
+            case 19: {
+                hoja.establecerDispersa(!hoja.esDispersa());
+                std::cout << (hoja.esDispersa() ? "Hoja almacenada en bloques dispersos" : "Hoja almacenada en un bloque contiguo")
+                          << " (" << hoja.bytesCeldas() / (1024.0 * 1024.0) << " MB).\n";
+                break;
+            }
+            case 20: {
+                size_t huecos = hoja.huecos();
+                auto inicio = std::chrono::steady_clock::now();
+                hoja.compactar();
+                double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - inicio).count();
+                std::cout << "Hoja compactada: " << huecos << " linea(s) libre(s) recuperada(s) en " << ms << " ms.\n";
+                break;
+            }
+            case 21: {
+                std::string nombreArchivo;
+                std::cout << "Ingrese el nombre del archivo de actualizaciones: ";
+                std::cin >> nombreArchivo;
+                try {
+                    auto inicio = std::chrono::steady_clock::now();
+                    size_t aplicadas = hoja.actualizarDesdeArchivo(nombreArchivo);
+                    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - inicio).count();
+                    std::cout << aplicadas << " celda(s) actualizada(s) en " << ms << " ms.\n";
+                } catch (const std::exception& e) {
+                    std::cout << "Error: " << e.what() << "\n";
+                }
+                break;
+            }
+            case 22: {
+                size_t fila1 = leerTamano("Ingrese el ndice de la fila inicial: ");
+                size_t col1 = leerTamano("Ingrese el ndice de la columna inicial: ");
+                size_t fila2 = leerTamano("Ingrese el ndice de la fila final: ");
+                size_t col2 = leerTamano("Ingrese el ndice de la columna final: ");
+                EstadisticasRango resultado = hoja.estadisticasRango(fila1, col1, fila2, col2);
+                std::cout << "Suma: " << resultado.suma << "\n";
+                std::cout << "Minimo: " << resultado.minimo << "\n";
+                std::cout << "Maximo: " << resultado.maximo << "\n";
+                std::cout << "Promedio: " << resultado.promedio << "\n";
+                std::cout << "Cuenta: " << resultado.cuenta << "\n";
+                std::cout << "Desviacion estandar: " << resultado.desviacion << "\n";
+                break;
+            }
+            case 23: {
+                size_t tipo = leerTamano("Ingrese el indice (0 = ninguno, 1 = tabla de sumas, 2 = arbol de Fenwick): ");
+                if (tipo > 2) {
+                    std::cout << "Opcin invlida.\n";
+                    break;
+                }
+                hoja.establecerIndiceSumas(static_cast<TipoIndiceSumas>(tipo));
+                std::cout << "Indice de sumas configurado.\n";
+                break;
+            }
+            case 24: {
+                size_t fila1 = leerTamano("Ingrese el ndice de la fila inicial: ");
+                size_t col1 = leerTamano("Ingrese el ndice de la columna inicial: ");
+                size_t fila2 = leerTamano("Ingrese el ndice de la fila final: ");
+                size_t col2 = leerTamano("Ingrese el ndice de la columna final: ");
+                auto inicio = std::chrono::steady_clock::now();
+                double suma = hoja.sumaRango(fila1, col1, fila2, col2);
+                double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - inicio).count();
+                std::cout << "Suma: " << suma << " (" << ms << " ms)\n";
+                break;
+            }
+            case 25: {
+                EstadisticasCache cache = hoja.estadisticasCache();
+                size_t consultas = cache.aciertos + cache.fallos;
+                std::cout << "Aciertos: " << cache.aciertos << ", fallos: " << cache.fallos
+                          << " (" << (consultas ? 100.0 * cache.aciertos / consultas : 0.0) << "% de aciertos), "
+                          << cache.entradas << " resultados guardados\n";
+                break;
+            }
+            case 26: {
+                std::cout << "Filas a desplazar (negativo hacia arriba): ";
+                double filas = leerNumero();
+                std::cout << "Columnas a desplazar (negativo hacia la izquierda): ";
+                double columnas = leerNumero();
+                hoja.desplazarVista(static_cast<long long>(filas), static_cast<long long>(columnas));
+                hoja.mostrar();
+                break;
+            }
+            case 27: {
+                size_t fila = leerTamano("Ingrese el ndice de la fila: ");
+                size_t col = leerTamano("Ingrese el ndice de la columna: ");
+                hoja.irA(fila, col);
+                hoja.mostrar();
+                break;
+            }
+            case 28: {
+                size_t filas = leerTamano("Filas visibles: ");
+                size_t columnas = leerTamano("Columnas visibles: ");
+                try {
+                    hoja.establecerTamanoVista(filas, columnas);
+                    hoja.mostrar();
+                } catch (const std::invalid_argument& e) {
+                    std::cout << "Error: " << e.what() << "\n";
+                }
+                break;
+            }
+            case 29: {
+                std::string nombreArchivo;
+                std::cout << "Archivo donde guardar el JSON ('-' para verlo en pantalla): ";
+                std::cin >> nombreArchivo;
+                if (nombreArchivo == "-") {
+                    hoja.escribirInstrumentacion(std::cout);
+                    break;
+                }
+                std::ofstream archivo(nombreArchivo);
+                if (!archivo.is_open()) {
+                    std::cerr << "No se pudo abrir el archivo para guardar." << std::endl;
+                    break;
+                }
+                hoja.escribirInstrumentacion(archivo);
+                std::cout << "Instrumentacion guardada en " << nombreArchivo << ".\n";
+                break;
+            }
+            case 30: {
+                if (hoja.deshacer()) {
+                    std::cout << "Cambio deshecho.\n";
+                } else {
+                    std::cout << "No hay cambios para deshacer.\n";
+                }
+                break;
+            }
+            case 31: {
+                if (hoja.rehacer()) {
+                    std::cout << "Cambio rehecho.\n";
+                } else {
+                    std::cout << "No hay cambios para rehacer.\n";
+                }
+                break;
+            }
+            case 32: {
+                EstadisticasDiario diario = hoja.estadisticasDiario();
+                std::cout << diario.deshacibles << " cambios para deshacer, " << diario.rehacibles
+                          << " para rehacer, " << diario.bytes << " de " << diario.presupuesto << " bytes\n";
+                size_t presupuesto = leerTamano("Nuevo presupuesto en bytes (0 desactiva el historial): ");
+                hoja.establecerPresupuestoDiario(presupuesto);
+                break;
+            }
+            case 33: {
+                std::string base;
+                std::cout << "Nombre base del registro (se usan base.hoja y base.registro): ";
+                std::cin >> base;
+                if (hoja.abrirRegistro(base)) {
+                    EstadisticasRegistro registro = hoja.estadisticasRegistro();
+                    std::cout << "Registro activo; " << registro.recuperados << " cambios recuperados.\n";
+                }
+                break;
+            }
+            case 34: {
+                if (hoja.puntoDeControl()) {
+                    std::cout << "Punto de control guardado.\n";
+                } else {
+                    std::cout << "El registro de cambios no esta activo.\n";
+                }
+                break;
+            }
+            case 35: {
+                std::cout << "Hojas:";
+                for (const auto& nombre : libro.nombres()) {
+                    std::cout << ' ' << nombre;
+                }
+                std::string nombre;
+                std::cout << "\nNombre de la hoja: ";
+                std::cin >> nombre;
+                try {
+                    if (!libro.existeHoja(nombre)) {
+                        libro.crearHoja(nombre);
+                        std::cout << "Hoja creada.\n";
+                    }
+                    libro.activar(nombre);
+                } catch (const std::invalid_argument& e) {
+                    std::cout << "Error: " << e.what() << "\n";
+                }
+                break;
+            }
+            case 36: {
+                std::string nombre;
+                std::cout << "Nombre de la hoja a eliminar: ";
+                std::cin >> nombre;
+                if (libro.cantidadHojas() == 1) {
+                    std::cout << "El libro necesita al menos una hoja.\n";
+                    break;
+                }
+                try {
+                    libro.eliminarHoja(nombre);
+                    std::cout << "Hoja eliminada.\n";
+                } catch (const std::out_of_range& e) {
+                    std::cout << "Error: " << e.what() << "\n";
+                }
+                break;
+            }
+            case 37: {
+                std::string referencias;
+                std::cout << "Rangos separados por comas (ej. Hoja1!F0C0:F9C0,Hoja2!F0C0:F9C0): ";
+                std::getline(std::cin >> std::ws, referencias);
+                try {
+                    EstadisticasRango resultado = libro.estadisticasRango(referencias);
+                    std::cout << "Suma: " << resultado.suma << "\n";
+                    std::cout << "Minimo: " << resultado.minimo << "\n";
+                    std::cout << "Maximo: " << resultado.maximo << "\n";
+                    std::cout << "Promedio: " << resultado.promedio << "\n";
+                    std::cout << "Cuenta: " << resultado.cuenta << "\n";
+                    std::cout << "Desviacion estandar: " << resultado.desviacion << "\n";
+                } catch (const std::exception& e) {
+                    std::cout << "Error: " << e.what() << "\n";
+                }
+                break;
+            }
+            case 38: {
+                EstadisticasMemoria memoria = libro.estadisticasMemoria();
+                const double mega = 1024.0 * 1024.0;
+                std::cout << "Reservada: " << memoria.reservados / mega << " MB (pico " << memoria.picoReservados / mega << " MB)\n";
+                std::cout << "Ocupada por las hojas: " << memoria.ocupados / mega << " MB (pico " << memoria.picoOcupados / mega << " MB)\n";
+                std::cout << "Tramos libres: " << memoria.libres / mega << " MB de " << memoria.tramos << " tramos\n";
+                std::cout << "Fragmentacion: " << 100.0 * memoria.fragmentacion << "%\n";
+                break;
+            }
+            case 39: {
+                std::string linea;
+                std::cout << "Columnas por las que ordenar, cada una con asc o desc si hace falta (ej. 2 desc 0): ";
+                std::getline(std::cin >> std::ws, linea);
+                try {
+                    std::istringstream campos(linea);
+                    hoja.ordenar(leerClavesOrden(campos));
+                    std::cout << "Filas ordenadas.\n";
+                } catch (const std::exception& e) {
+                    std::cout << "Error: " << e.what() << "\n";
+                }
+                break;
+            }
+            case 40: {
+                for (const auto& indice : hoja.indicesDeColumnas()) {
+                    std::cout << "Columna " << indice.columna << ": "
+                              << (indice.tipo == TipoIndiceColumna::Hash ? "hash" : "ordenado") << ", " << indice.bytes << " bytes\n";
+                }
+                size_t columna = leerTamano("Ingrese el ndice de la columna: ");
+                std::string tipo;
+                std::cout << "Tipo de indice (hash, ordenado o ninguno): ";
+                std::cin >> tipo;
+                try {
+                    if (tipo == "ninguno") {
+                        hoja.eliminarIndiceColumna(columna);
+                    } else if (tipo == "hash" || tipo == "ordenado") {
+                        hoja.crearIndiceColumna(columna, tipo == "hash" ? TipoIndiceColumna::Hash : TipoIndiceColumna::Ordenado);
+                        std::cout << "Indice creado.\n";
+                    } else {
+                        std::cout << "Tipo de indice no valido.\n";
+                    }
+                } catch (const std::out_of_range& e) {
+                    std::cout << "Error: " << e.what() << "\n";
+                }
+                break;
+            }
+            case 41: {
+                size_t columna = leerTamano("Ingrese el ndice de la columna: ");
+                std::cout << "Valor minimo: ";
+                double desde = leerNumero();
+                std::cout << "Valor maximo (igual al minimo para buscar un valor): ";
+                double hasta = leerNumero();
+                try {
+                    ResultadoBusqueda resultado = desde == hasta ? hoja.buscar(columna, desde) : hoja.filtrar(columna, desde, hasta);
+                    std::cout << resultado.filas.size() << " filas (" << (resultado.conIndice ? "con indice" : "recorriendo la columna") << ")";
+                    for (size_t i = 0; i < resultado.filas.size() && i < 20; ++i) {
+                        std::cout << (i == 0 ? ": " : ", ") << resultado.filas[i];
+                    }
+                    std::cout << (resultado.filas.size() > 20 ? ", ...\n" : "\n");
+                } catch (const std::out_of_range& e) {
+                    std::cout << "Error: " << e.what() << "\n";
+                }
+                break;
+            }
+            case 42: {
+                std::string nombre;
+                std::string linea;
+                std::cout << "Nombre de la hoja para el resultado: ";
+                std::cin >> nombre;
+                std::cout << "Columnas clave, ':' y columnas con su funcion (ej. 0 1 : 2 suma 3 promedio): ";
+                std::getline(std::cin >> std::ws, linea);
+                try {
+                    std::vector<size_t> claves;
+                    std::vector<Agregacion> agregaciones;
+                    std::istringstream campos(linea);
+                    leerAgrupacion(campos, claves, agregaciones);
+                    size_t grupos = libro.agrupar(claves, agregaciones, nombre);
+                    std::cout << grupos << " grupos en la hoja '" << nombre << "'.\n";
+                } catch (const std::exception& e) {
+                    std::cout << "Error: " << e.what() << "\n";
+                }
+                break;
+            }
+            case 43: {
+                std::string respuesta;
+                std::cout << "Comprimir las columnas, ahora y al cargar CSV? (s/n): ";
+                std::cin >> respuesta;
+                hoja.establecerCompresion(respuesta == "s" || respuesta == "S");
+                if (!hoja.esComprimida()) {
+                    std::cout << "La hoja no esta comprimida.\n";
+                }
+                for (const auto& columna : hoja.estadisticasCompresion()) {
+                    std::cout << "Columna " << columna.columna << ": " << nombreCodificacion(columna.codificacion) << ", "
+                              << columna.bytes << " de " << columna.bytesCrudos << " bytes (" << columna.razon << ":1)\n";
+                }
                 break;
             }
             case 0:
+                if (hoja.guardandoEnSegundoPlano()) {
+                    std::cout << "Esperando que termine el guardado en segundo plano...\n";
+                }
+                hoja.esperarGuardado();
                 std::cout << "Saliendo del programa...\n";
                 break;
             default:
@@ -329,6 +7764,9 @@ void menu(HojaCalculo& hoja) {
                 break;
         }
 
+        // A mano los cambios llegan de a uno: no tiene sentido esperar a juntar un lote.
+        // La hoja se vuelve a pedir porque la opcion 36 puede haber eliminado la que era activa
+        libro.activa().sincronizarRegistro();
         std::cout << "Presione Enter para continuar...";
         std::cin.ignore();
         std::cin.get();
@@ -336,8 +7774,451 @@ void menu(HojaCalculo& hoja) {
     } while (opcion != 0);
 }
 
-int main() {
-    HojaCalculo hoja;
-    menu(hoja);
-    return 0;
+// Modo sin pantalla: ejecuta una orden por linea, tomada de un archivo o de
+// la entrada estandar, sin limpiar la consola, sin pausas y sin mostrar la
+// hoja salvo que se pida. Solo se imprimen los resultados pedidos; los
+// errores y el resumen de tiempos van a std::cerr. Devuelve cuantas ordenes fallaron.
+//
+//   agregarFila [n]            eliminarFila f
+//   agregarColumna [n]         eliminarColumna c
+//   ordenar c [asc|desc] [c2 [asc|desc]] ...    (filas, estable; la primera columna manda)
+//   agrupar hoja c [c2 ...] : c funcion [c funcion ...]   (en una hoja nueva; imprime los grupos)
+//                              (funcion: suma, cuenta, minimo, maximo o promedio)
+//   actualizar f c valor       obtener f c
+//   actualizarBloque f c filas columnas v1 v2 ...   (valores por filas)
+//   actualizarDesde archivo    (lineas "fila,columna,valor")
+//   operarCeldas f1 c1 f2 c2 op
+//   operarFila f op            operarColumna c op
+//   rango f1 c1 f2 c2 [suma|minimo|maximo|promedio|cuenta|desviacion]
+//   rango Hoja!F0C0:F9C0,Otra!F0C0:F9C0 [funcion]   (rangos de varias hojas juntos)
+//   indiceSumas ninguno|tabla|fenwick           sumaRango f1 c1 f2 c2 | referencias
+//   indiceColumna c hash|ordenado|ninguno      indicesColumna   (columna, tipo y bytes)
+//   buscar c valor             filtrar c desde hasta
+//                              (cantidad, "indice" o "recorrido" y las filas en una linea)
+//   hoja nombre                (activa la hoja; la crea si no existe)
+//   hojas                      eliminarHoja nombre
+//   memoria                    (reservada, ocupada, libre, picos y fragmentacion)
+//   recortarMemoria
+//   cache                      (aciertos, fallos y entradas de la cache de reducciones)
+//   instrumentacion [archivo]  (JSON con llamadas, latencias, celdas y bytes)
+//   deshacer                   rehacer
+//   diario [bytes]             (presupuesto del historial; sin valor imprime su estado)
+//   registro [base]            (abre o recupera base.hoja + base.registro; sin valor imprime su estado)
+//   puntoControl               sincronizar
+//   loteRegistro bytes milisegundos
+//   formula f c texto          mostrar
+//   ir f c                     desplazar filas columnas    vista filas columnas
+//   cargar archivo.csv         guardar archivo.csv
+//   guardarBinario archivo     abrirBinario archivo
+//   hilos n                    disposicion filas|columnas
+//   dispersa si|no             compactar
+//   compresion si|no           (comprime las columnas ahora y al cargar)
+//   columnasComprimidas        (columna, codificacion, bytes, bytes sin comprimir y razon)
+//
+// Las lineas vacias y las que empiezan con '#' se ignoran.
+int ejecutarGuion(LibroCalculo& libro, std::istream& entrada) {
+    struct Tiempo {
+        size_t veces = 0;
+        double milisegundos = 0.0;
+    };
+    std::map<std::string, Tiempo> tiempos;
+    size_t numeroLinea = 0;
+    size_t errores = 0;
+    char texto[64];
+    auto imprimir = [&](double valor) {
+        *std::to_chars(texto, texto + sizeof(texto) - 1, valor).ptr = '\0';
+        std::cout << texto << '\n';
+    };
+    auto inicioTotal = std::chrono::steady_clock::now();
+    for (const auto& nombre : libro.nombres()) {
+        libro.hoja(nombre).establecerAvisos(false);
+    }
+
+    std::string linea;
+    while (std::getline(entrada, linea)) {
+        ++numeroLinea;
+        std::istringstream campos(linea);
+        std::string orden;
+        if (!(campos >> orden) || orden[0] == '#') {
+            continue;
+        }
+        auto leerIndice = [&]() {
+            long long valor;
+            if (!(campos >> valor) || valor < 0) {
+                throw std::invalid_argument("se esperaba un indice");
+            }
+            return static_cast<size_t>(valor);
+        };
+        auto leerValor = [&]() {
+            double valor;
+            if (!(campos >> valor)) {
+                throw std::invalid_argument("se esperaba un numero");
+            }
+            return valor;
+        };
+        auto leerPalabra = [&]() {
+            std::string palabra;
+            if (!(campos >> palabra)) {
+                throw std::invalid_argument("falta un argumento");
+            }
+            return palabra;
+        };
+        auto leerOperacion = [&]() {
+            return leerPalabra()[0];
+        };
+
+        auto inicio = std::chrono::steady_clock::now();
+        try {
+            // Las ordenes de una hoja van a la activa, que puede cambiar con "hoja"
+            HojaCalculo& hoja = libro.activa();
+            if (orden == "agregarFila" || orden == "agregarColumna") {
+                size_t veces = 1;
+                if (!(campos >> std::ws).eof()) {
+                    veces = leerIndice();
+                }
+                for (size_t i = 0; i < veces; ++i) {
+                    if (orden == "agregarFila") {
+                        hoja.agregarFila();
+                    } else {
+                        hoja.agregarColumna();
+                    }
+                }
+            } else if (orden == "eliminarFila") {
+                hoja.eliminarFila(leerIndice());
+            } else if (orden == "eliminarColumna") {
+                hoja.eliminarColumna(leerIndice());
+            } else if (orden == "ordenar") {
+                hoja.ordenar(leerClavesOrden(campos));
+            } else if (orden == "agrupar") {
+                std::string nombre = leerPalabra();
+                std::vector<size_t> claves;
+                std::vector<Agregacion> agregaciones;
+                leerAgrupacion(campos, claves, agregaciones);
+                std::cout << libro.agrupar(claves, agregaciones, nombre) << '\n';
+                libro.hoja(nombre).establecerAvisos(false);
+            } else if (orden == "actualizar") {
+                size_t fila = leerIndice();
+                size_t columna = leerIndice();
+                hoja.actualizarCelda(fila, columna, leerValor());
+            } else if (orden == "actualizarBloque") {
+                size_t fila = leerIndice();
+                size_t columna = leerIndice();
+                size_t filas = leerIndice();
+                size_t columnas = leerIndice();
+                std::vector<double> valores;
+                for (double valor; campos >> valor;) {
+                    valores.push_back(valor);
+                }
+                hoja.actualizarBloque(fila, columna, filas, columnas, valores);
+            } else if (orden == "actualizarDesde") {
+                hoja.actualizarDesdeArchivo(leerPalabra());
+            } else if (orden == "obtener") {
+                size_t fila = leerIndice();
+                imprimir(hoja.obtenerCelda(fila, leerIndice()));
+            } else if (orden == "operarCeldas") {
+                size_t fila1 = leerIndice();
+                size_t col1 = leerIndice();
+                size_t fila2 = leerIndice();
+                size_t col2 = leerIndice();
+                imprimir(hoja.operarCeldas(fila1, col1, fila2, col2, leerOperacion()));
+            } else if (orden == "operarFila") {
+                size_t fila = leerIndice();
+                imprimir(hoja.operarFila(fila, leerOperacion()));
+            } else if (orden == "operarColumna") {
+                size_t columna = leerIndice();
+                imprimir(hoja.operarColumna(columna, leerOperacion()));
+            } else if (orden == "rango") {
+                EstadisticasRango resultado;
+                if (std::isdigit((campos >> std::ws).peek())) {
+                    size_t fila1 = leerIndice();
+                    size_t col1 = leerIndice();
+                    size_t fila2 = leerIndice();
+                    resultado = hoja.estadisticasRango(fila1, col1, fila2, leerIndice());
+                } else {
+                    resultado = libro.estadisticasRango(leerPalabra());
+                }
+                std::string funcion;
+                campos >> funcion;
+                if (funcion.empty()) {
+                    for (double valor : {resultado.suma, resultado.minimo, resultado.maximo, resultado.promedio,
+                                         static_cast<double>(resultado.cuenta), resultado.desviacion}) {
+                        imprimir(valor);
+                    }
+                } else if (funcion == "suma") {
+                    imprimir(resultado.suma);
+                } else if (funcion == "minimo") {
+                    imprimir(resultado.minimo);
+                } else if (funcion == "maximo") {
+                    imprimir(resultado.maximo);
+                } else if (funcion == "promedio") {
+                    imprimir(resultado.promedio);
+                } else if (funcion == "cuenta") {
+                    imprimir(static_cast<double>(resultado.cuenta));
+                } else if (funcion == "desviacion") {
+                    imprimir(resultado.desviacion);
+                } else {
+                    throw std::invalid_argument("funcion de rango desconocida '" + funcion + "'");
+                }
+            } else if (orden == "indiceSumas") {
+                std::string tipo = leerPalabra();
+                if (tipo == "ninguno") {
+                    hoja.establecerIndiceSumas(TipoIndiceSumas::Ninguno);
+                } else if (tipo == "tabla") {
+                    hoja.establecerIndiceSumas(TipoIndiceSumas::Tabla);
+                } else if (tipo == "fenwick") {
+                    hoja.establecerIndiceSumas(TipoIndiceSumas::Fenwick);
+                } else {
+                    throw std::invalid_argument("el indice es 'ninguno', 'tabla' o 'fenwick'");
+                }
+            } else if (orden == "indiceColumna") {
+                size_t columna = leerIndice();
+                std::string tipo = leerPalabra();
+                if (tipo == "ninguno") {
+                    hoja.eliminarIndiceColumna(columna);
+                } else if (tipo == "hash") {
+                    hoja.crearIndiceColumna(columna, TipoIndiceColumna::Hash);
+                } else if (tipo == "ordenado") {
+                    hoja.crearIndiceColumna(columna, TipoIndiceColumna::Ordenado);
+                } else {
+                    throw std::invalid_argument("el indice es 'hash', 'ordenado' o 'ninguno'");
+                }
+            } else if (orden == "indicesColumna") {
+                for (const auto& indice : hoja.indicesDeColumnas()) {
+                    std::cout << indice.columna << ' ' << (indice.tipo == TipoIndiceColumna::Hash ? "hash" : "ordenado")
+                              << ' ' << indice.bytes << '\n';
+                }
+            } else if (orden == "buscar" || orden == "filtrar") {
+                size_t columna = leerIndice();
+                double desde = leerValor();
+                ResultadoBusqueda resultado = orden == "buscar" ? hoja.buscar(columna, desde) : hoja.filtrar(columna, desde, leerValor());
+                std::cout << resultado.filas.size() << (resultado.conIndice ? " indice" : " recorrido");
+                for (size_t fila : resultado.filas) {
+                    std::cout << ' ' << fila;
+                }
+                std::cout << '\n';
+            } else if (orden == "sumaRango") {
+                if (std::isdigit((campos >> std::ws).peek())) {
+                    size_t fila1 = leerIndice();
+                    size_t col1 = leerIndice();
+                    size_t fila2 = leerIndice();
+                    imprimir(hoja.sumaRango(fila1, col1, fila2, leerIndice()));
+                } else {
+                    imprimir(libro.sumaRango(leerPalabra()));
+                }
+            } else if (orden == "hoja") {
+                std::string nombre = leerPalabra();
+                if (!libro.existeHoja(nombre)) {
+                    libro.crearHoja(nombre).establecerAvisos(false);
+                }
+                libro.activar(nombre);
+            } else if (orden == "hojas") {
+                for (const auto& nombre : libro.nombres()) {
+                    std::cout << (nombre == libro.nombreHojaActiva() ? "*" : "") << nombre << '\n';
+                }
+            } else if (orden == "eliminarHoja") {
+                if (libro.cantidadHojas() == 1) {
+                    throw std::runtime_error("el libro necesita al menos una hoja");
+                }
+                libro.eliminarHoja(leerPalabra());
+            } else if (orden == "memoria") {
+                EstadisticasMemoria memoria = libro.estadisticasMemoria();
+                std::cout << memoria.reservados << ' ' << memoria.ocupados << ' ' << memoria.libres << ' '
+                          << memoria.picoReservados << ' ' << memoria.picoOcupados << ' ' << memoria.fragmentacion << '\n';
+            } else if (orden == "recortarMemoria") {
+                libro.recortarMemoria();
+            } else if (orden == "cache") {
+                EstadisticasCache cache = hoja.estadisticasCache();
+                std::cout << cache.aciertos << ' ' << cache.fallos << ' ' << cache.entradas << '\n';
+            } else if (orden == "instrumentacion") {
+                std::string nombre;
+                if (campos >> nombre) {
+                    std::ofstream archivo(nombre);
+                    if (!archivo.is_open()) {
+                        throw std::runtime_error("no se pudo abrir " + nombre);
+                    }
+                    hoja.escribirInstrumentacion(archivo);
+                } else {
+                    hoja.escribirInstrumentacion(std::cout);
+                }
+            } else if (orden == "deshacer" || orden == "rehacer") {
+                bool hecho = orden == "deshacer" ? hoja.deshacer() : hoja.rehacer();
+                if (!hecho) {
+                    throw std::runtime_error("no hay cambios para " + orden);
+                }
+            } else if (orden == "diario") {
+                std::string presupuesto;
+                if (campos >> presupuesto) {
+                    hoja.establecerPresupuestoDiario(static_cast<size_t>(std::stod(presupuesto)));
+                } else {
+                    EstadisticasDiario diario = hoja.estadisticasDiario();
+                    std::cout << diario.deshacibles << ' ' << diario.rehacibles << ' '
+                              << diario.bytes << ' ' << diario.presupuesto << '\n';
+                }
+            } else if (orden == "registro") {
+                std::string base;
+                if (campos >> base) {
+                    if (!hoja.abrirRegistro(base)) {
+                        throw std::runtime_error("no se pudo abrir el registro " + base);
+                    }
+                } else {
+                    EstadisticasRegistro registro = hoja.estadisticasRegistro();
+                    std::cout << registro.registros << ' ' << registro.lotes << ' ' << registro.pendientes << ' '
+                              << registro.bytes << ' ' << registro.puntosControl << ' ' << registro.recuperados << '\n';
+                }
+            } else if (orden == "puntoControl") {
+                if (!hoja.puntoDeControl()) {
+                    throw std::runtime_error("el registro de cambios no esta activo");
+                }
+            } else if (orden == "sincronizar") {
+                if (!hoja.sincronizarRegistro()) {
+                    throw std::runtime_error("no se pudo confirmar el registro de cambios");
+                }
+            } else if (orden == "loteRegistro") {
+                size_t bytes = leerIndice();
+                double milisegundos = 0.0;
+                if (!(campos >> milisegundos)) {
+                    throw std::invalid_argument("se esperaba la espera del lote en milisegundos");
+                }
+                hoja.establecerLoteRegistro(bytes, milisegundos);
+            } else if (orden == "formula") {
+                size_t fila = leerIndice();
+                size_t columna = leerIndice();
+                std::string formula;
+                std::getline(campos >> std::ws, formula);
+                hoja.establecerFormula(fila, columna, formula);
+            } else if (orden == "mostrar") {
+                hoja.mostrar();
+            } else if (orden == "ir") {
+                size_t fila = leerIndice();
+                hoja.irA(fila, leerIndice());
+            } else if (orden == "desplazar") {
+                long long filas = 0;
+                long long columnas = 0;
+                if (!(campos >> filas >> columnas)) {
+                    throw std::invalid_argument("se esperaban dos desplazamientos");
+                }
+                hoja.desplazarVista(filas, columnas);
+            } else if (orden == "vista") {
+                size_t filas = leerIndice();
+                hoja.establecerTamanoVista(filas, leerIndice());
+            } else if (orden == "cargar") {
+                if (!hoja.cargarCSV(leerPalabra())) {
+                    ++errores;
+                }
+            } else if (orden == "guardar") {
+                if (!hoja.guardarCSV(leerPalabra())) {
+                    ++errores;
+                }
+            } else if (orden == "guardarBinario") {
+                if (!hoja.guardarBinario(leerPalabra())) {
+                    ++errores;
+                }
+            } else if (orden == "abrirBinario") {
+                if (!hoja.abrirBinario(leerPalabra())) {
+                    ++errores;
+                }
+            } else if (orden == "hilos") {
+                hoja.establecerHilos(leerIndice());
+            } else if (orden == "disposicion") {
+                std::string nombre = leerPalabra();
+                if (nombre != "filas" && nombre != "columnas") {
+                    throw std::invalid_argument("la disposicion es 'filas' o 'columnas'");
+                }
+                hoja.establecerDisposicion(nombre == "filas" ? Disposicion::PorFilas : Disposicion::PorColumnas);
+            } else if (orden == "dispersa") {
+                hoja.establecerDispersa(leerPalabra() == "si");
+            } else if (orden == "compresion") {
+                hoja.establecerCompresion(leerPalabra() == "si");
+            } else if (orden == "columnasComprimidas") {
+                for (const auto& columna : hoja.estadisticasCompresion()) {
+                    std::cout << columna.columna << ' ' << nombreCodificacion(columna.codificacion) << ' ' << columna.bytes
+                              << ' ' << columna.bytesCrudos << ' ' << columna.razon << '\n';
+                }
+            } else if (orden == "compactar") {
+                hoja.compactar();
+            } else {
+                throw std::invalid_argument("orden desconocida '" + orden + "'");
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Linea " << numeroLinea << ": " << e.what() << std::endl;
+            ++errores;
+            continue;
+        }
+        Tiempo& tiempo = tiempos[orden];
+        ++tiempo.veces;
+        tiempo.milisegundos += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - inicio).count();
+    }
+    for (const auto& nombre : libro.nombres()) {
+        libro.hoja(nombre).esperarGuardado();
+    }
+    std::cout.flush();
+
+    double total = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - inicioTotal).count();
+    std::cerr << "--- Resumen ---\n";
+    for (const auto& entrada : tiempos) {
+        std::cerr << entrada.first << ": " << entrada.second.veces << " en "
+                  << entrada.second.milisegundos << " ms\n";
+    }
+    std::cerr << "Total: " << total << " ms, " << errores << " error(es)" << std::endl;
+    return static_cast<int>(errores);
+}
+
+#ifndef HOJA_SIN_MAIN
+// Sin argumentos abre el menu; con "--script archivo" (o "--script -" para
+// la entrada estandar) ejecuta las ordenes sin pantalla. Con
+// "--instrumentacion archivo" deja al salir el JSON de la instrumentacion
+// de la hoja activa; "--registro base" recupera y registra la primera hoja.
+// Con HOJA_SIN_MAIN definido el archivo se puede incluir desde otro
+// programa (el de rendimiento).
+int main(int argc, char* argv[]) {
+    LibroCalculo libro;
+    HojaCalculo& hoja = libro.crearHoja("Hoja1");
+    const char* guion = nullptr;
+    const char* instrumentacion = nullptr;
+    const char* registro = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        std::string opcion = argv[i];
+        if (opcion == "--script") {
+            guion = (i + 1 < argc) ? argv[++i] : "-";
+        } else if (opcion == "--instrumentacion" && i + 1 < argc) {
+            instrumentacion = argv[++i];
+        } else if (opcion == "--registro" && i + 1 < argc) {
+            registro = argv[++i];
+        } else {
+            std::cerr << "Opcion desconocida: " << opcion << std::endl;
+            return 1;
+        }
+    }
+
+    // Con --registro la hoja arranca desde la foto y los cambios registrados
+    if (registro) {
+        if (!hoja.abrirRegistro(registro)) {
+            return 1;
+        }
+    }
+
+    int resultado = 0;
+    if (!guion) {
+        menu(libro);
+    } else if (std::string(guion) == "-") {
+        resultado = ejecutarGuion(libro, std::cin) == 0 ? 0 : 1;
+    } else {
+        std::ifstream archivo(guion);
+        if (!archivo.is_open()) {
+            std::cerr << "No se pudo abrir el guion " << guion << "." << std::endl;
+            return 1;
+        }
+        resultado = ejecutarGuion(libro, archivo) == 0 ? 0 : 1;
+    }
+
+    if (instrumentacion) {
+        std::ofstream archivo(instrumentacion);
+        if (!archivo.is_open()) {
+            std::cerr << "No se pudo abrir el archivo de instrumentacion." << std::endl;
+            return 1;
+        }
+        libro.activa().escribirInstrumentacion(archivo);
+    }
+    return resultado;
 }
+#endif
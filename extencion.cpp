@@ -5,52 +5,285 @@
 #include <stdexcept>
 #include <limits>
 #include <cstdlib>
+#include <algorithm>
+#include <charconv>
+#include <string>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+enum class Disposicion { PorFilas, PorColumnas };
+
+// Reduce n valores contiguos con la operacion indicada ('+' suma, '*' producto).
+// Usa AVX (4 dobles por instruccion) o SSE2 (2 dobles) cuando el compilador
+// los habilita y un bucle escalar para el resto.
+template <char Operacion>
+double reducirContiguo(const double* datos, size_t n) {
+    size_t i = 0;
+    double total = (Operacion == '+') ? 0.0 : 1.0;
+#if defined(__AVX__)
+    __m256d a = _mm256_set1_pd(total);
+    __m256d b = a;
+    for (; i + 8 <= n; i += 8) {
+        __m256d x = _mm256_loadu_pd(datos + i);
+        __m256d y = _mm256_loadu_pd(datos + i + 4);
+        if constexpr (Operacion == '+') {
+            a = _mm256_add_pd(a, x);
+            b = _mm256_add_pd(b, y);
+        } else {
+            a = _mm256_mul_pd(a, x);
+            b = _mm256_mul_pd(b, y);
+        }
+    }
+    alignas(32) double carriles[8];
+    _mm256_store_pd(carriles, a);
+    _mm256_store_pd(carriles + 4, b);
+#elif defined(__SSE2__)
+    __m128d a = _mm_set1_pd(total);
+    __m128d b = a;
+    for (; i + 4 <= n; i += 4) {
+        __m128d x = _mm_loadu_pd(datos + i);
+        __m128d y = _mm_loadu_pd(datos + i + 2);
+        if constexpr (Operacion == '+') {
+            a = _mm_add_pd(a, x);
+            b = _mm_add_pd(b, y);
+        } else {
+            a = _mm_mul_pd(a, x);
+            b = _mm_mul_pd(b, y);
+        }
+    }
+    alignas(16) double carriles[4];
+    _mm_store_pd(carriles, a);
+    _mm_store_pd(carriles + 2, b);
+#endif
+#if defined(__AVX__) || defined(__SSE2__)
+    // Las sumas (o productos) parciales de cada carril se combinan al final
+    for (double carril : carriles) {
+        if constexpr (Operacion == '+') total += carril;
+        else total *= carril;
+    }
+#endif
+    for (; i < n; ++i) {
+        if constexpr (Operacion == '+') {
+            total += datos[i];
+        } else {
+            total *= datos[i];
+        }
+    }
+    return total;
+}
+
+template <char Operacion>
+double reducirTramo(const double* datos, size_t n, size_t salto) {
+    if (salto == 1) {
+        return reducirContiguo<Operacion>(datos, n);
+    }
+    double total = (Operacion == '+') ? 0.0 : 1.0;
+    for (size_t i = 0; i < n; ++i, datos += salto) {
+        if constexpr (Operacion == '+') {
+            total += *datos;
+        } else {
+            total *= *datos;
+        }
+    }
+    return total;
+}
+
+// El cociente se divide de a un valor, en orden: multiplicar por el producto
+// de los reciprocos se va a 0 o a infinito antes que la division sucesiva.
+double dividirTramo(double total, const double* datos, size_t n, size_t salto) {
+    for (size_t i = 0; i < n; ++i, datos += salto) {
+        if (*datos == 0) throw std::invalid_argument("Error: Division por cero.");
+        total /= *datos;
+    }
+    return total;
+}
+
+// Aplica la operacion a n valores separados por 'salto' posiciones:
+// el primero es el valor inicial y los demas se suman, restan, multiplican o dividen.
+double reducir(const double* datos, size_t n, size_t salto, char operacion) {
+    double primero = datos[0];
+    const double* resto = datos + salto;
+    switch (operacion) {
+        case '+': return primero + reducirTramo<'+'>(resto, n - 1, salto);
+        case '-': return primero - reducirTramo<'+'>(resto, n - 1, salto);
+        case '*': return primero * reducirTramo<'*'>(resto, n - 1, salto);
+        case '/': return dividirTramo(primero, resto, n - 1, salto);
+        default: throw std::invalid_argument("Error: Operacion no valida.");
+    }
+}
 
 class HojaCalculo {
 private:
-    std::vector<std::vector<double>> celdas;
+    // Todas las celdas viven en un unico bloque contiguo. Por defecto se
+    // ordena por filas: la celda (fila, columna) esta en celdas[fila * paso + columna].
+    // En la disposicion por columnas el bloque guarda columnas enteras seguidas
+    // y la celda esta en celdas[columna * paso + fila], de modo que operarColumna
+    // recorre memoria contigua.
+    // Cada "linea" (fila o columna segun la disposicion) ocupa 'paso' posiciones;
+    // las de holgura siempre valen 0.0 para poder crecer sin mover datos.
+    std::vector<double> celdas;
+    size_t numFilas = 0;
+    size_t numColumnas = 0;
+    size_t paso = 0;
+    Disposicion disposicion = Disposicion::PorFilas;
+    // Ventana que dibuja mostrar(): primera fila y columna visibles y tamano
+    size_t vistaFila = 0;
+    size_t vistaColumna = 0;
+    size_t vistaFilas = 20;
+    size_t vistaColumnas = 8;
+
+    size_t posicion(size_t fila, size_t columna) const {
+        return disposicion == Disposicion::PorFilas ? fila * paso + columna : columna * paso + fila;
+    }
+
+    size_t lineas() const {
+        return disposicion == Disposicion::PorFilas ? numFilas : numColumnas;
+    }
+
+    size_t largoLinea() const {
+        return disposicion == Disposicion::PorFilas ? numColumnas : numFilas;
+    }
+
+    void cambiarPaso(size_t nuevoPaso) {
+        std::vector<double> nuevas(lineas() * nuevoPaso, 0.0);
+        size_t copiar = std::min(largoLinea(), nuevoPaso);
+        for (size_t linea = 0; linea < lineas(); ++linea) {
+            std::copy_n(celdas.begin() + linea * paso, copiar, nuevas.begin() + linea * nuevoPaso);
+        }
+        celdas.swap(nuevas);
+        paso = nuevoPaso;
+    }
+
+    // Agrega una linea completa al final del bloque
+    void agregarLinea() {
+        celdas.resize((lineas() + 1) * paso, 0.0);
+    }
+
+    void eliminarLinea(size_t index) {
+        celdas.erase(celdas.begin() + index * paso, celdas.begin() + (index + 1) * paso);
+    }
+
+    // Agrega una posicion al final de cada linea, usando la holgura si la hay
+    void agregarPosicion() {
+        if (largoLinea() == paso) {
+            cambiarPaso(paso + paso / 2 + 1);
+        }
+    }
+
+    void eliminarPosicion(size_t index) {
+        size_t largo = largoLinea();
+        for (size_t linea = 0; linea < lineas(); ++linea) {
+            auto inicio = celdas.begin() + linea * paso;
+            std::copy(inicio + index + 1, inicio + largo, inicio + index);
+            inicio[largo - 1] = 0.0;
+        }
+    }
 
 public:
+    void establecerDisposicion(Disposicion nueva) {
+        if (nueva == disposicion) {
+            return;
+        }
+        // Transposicion por bloques para no saltar por toda la memoria
+        const size_t bloque = 64;
+        size_t nuevoPaso = (nueva == Disposicion::PorFilas) ? numColumnas : numFilas;
+        size_t nuevasLineas = (nueva == Disposicion::PorFilas) ? numFilas : numColumnas;
+        std::vector<double> nuevas(nuevasLineas * nuevoPaso, 0.0);
+        for (size_t f0 = 0; f0 < numFilas; f0 += bloque) {
+            for (size_t c0 = 0; c0 < numColumnas; c0 += bloque) {
+                size_t f1 = std::min(f0 + bloque, numFilas);
+                size_t c1 = std::min(c0 + bloque, numColumnas);
+                for (size_t fila = f0; fila < f1; ++fila) {
+                    for (size_t col = c0; col < c1; ++col) {
+                        size_t destino = (nueva == Disposicion::PorFilas) ? fila * nuevoPaso + col : col * nuevoPaso + fila;
+                        nuevas[destino] = celdas[posicion(fila, col)];
+                    }
+                }
+            }
+        }
+        celdas.swap(nuevas);
+        paso = nuevoPaso;
+        disposicion = nueva;
+    }
+
+    Disposicion obtenerDisposicion() const {
+        return disposicion;
+    }
+
     void agregarFila() {
-        std::vector<double> nuevaFila(celdas.empty() ? 1 : celdas[0].size(), 0.0);
-        celdas.push_back(nuevaFila);
+        if (numFilas == 0) {
+            numFilas = 1;
+            numColumnas = 1;
+            paso = 1;
+            celdas.assign(1, 0.0);
+            return;
+        }
+        if (disposicion == Disposicion::PorFilas) {
+            agregarLinea();
+        } else {
+            agregarPosicion();
+        }
+        ++numFilas;
     }
 
     void eliminarFila(size_t index) {
-        if (index < celdas.size()) {
-            celdas.erase(celdas.begin() + index);
+        if (index < numFilas) {
+            if (disposicion == Disposicion::PorFilas) {
+                eliminarLinea(index);
+            } else {
+                eliminarPosicion(index);
+            }
+            --numFilas;
+            if (numFilas == 0) {
+                numColumnas = 0;
+                paso = 0;
+                celdas.clear();
+            }
         } else {
             throw std::out_of_range("Indice de fila fuera de rango");
         }
     }
 
     void agregarColumna() {
-        for (auto& fila : celdas) {
-            fila.push_back(0.0);
+        if (numFilas == 0) {
+            return;
+        }
+        if (disposicion == Disposicion::PorFilas) {
+            agregarPosicion();
+        } else {
+            agregarLinea();
         }
+        ++numColumnas;
     }
 
     void eliminarColumna(size_t index) {
-        if (!celdas.empty() && index < celdas[0].size()) {
-            for (auto& fila : celdas) {
-                fila.erase(fila.begin() + index);
+        if (numFilas > 0 && index < numColumnas) {
+            if (disposicion == Disposicion::PorFilas) {
+                eliminarPosicion(index);
+            } else {
+                eliminarLinea(index);
             }
+            --numColumnas;
         } else {
             throw std::out_of_range("Indice de columna fuera de rango");
         }
     }
 
     void actualizarCelda(size_t fila, size_t columna, double valor) {
-        if (fila < celdas.size() && columna < celdas[fila].size()) {
-            celdas[fila][columna] = valor;
+        if (fila < numFilas && columna < numColumnas) {
+            celdas[posicion(fila, columna)] = valor;
         } else {
             throw std::out_of_range("Indice de celda fuera de rango");
         }
     }
 
     double obtenerCelda(size_t fila, size_t columna) const {
-        if (fila < celdas.size() && columna < celdas[fila].size()) {
-            return celdas[fila][columna];
+        if (fila < numFilas && columna < numColumnas) {
+            return celdas[posicion(fila, columna)];
         } else {
             throw std::out_of_range("Indice de celda fuera de rango");
         }
@@ -73,75 +306,112 @@ public:
     }
 
     double operarFila(size_t fila, char operacion) const {
-        if (fila >= celdas.size()) {
+        if (fila >= numFilas || numColumnas == 0) {
             throw std::out_of_range("Indice de fila fuera de rango");
         }
-
-        double resultado = celdas[fila][0];
-        for (size_t col = 1; col < celdas[fila].size(); ++col) {
-            switch (operacion) {
-                case '+': resultado += celdas[fila][col]; break;
-                case '-': resultado -= celdas[fila][col]; break;
-                case '*': resultado *= celdas[fila][col]; break;
-                case '/':
-                    if (celdas[fila][col] != 0) resultado /= celdas[fila][col];
-                    else throw std::invalid_argument("Error: Division por cero.");
-                default: throw std::invalid_argument("Error: Operacion no valida.");
-            }
-        }
-        return resultado;
+        size_t salto = (disposicion == Disposicion::PorFilas) ? 1 : paso;
+        return reducir(celdas.data() + posicion(fila, 0), numColumnas, salto, operacion);
     }
 
     double operarColumna(size_t columna, char operacion) const {
-        if (columna >= celdas[0].size()) {
+        if (columna >= numColumnas || numFilas == 0) {
             throw std::out_of_range("Indice de columna fuera de rango");
         }
-
-        double resultado = celdas[0][columna];
-        for (size_t fila = 1; fila < celdas.size(); ++fila) {
-            switch (operacion) {
-                case '+': resultado += celdas[fila][columna]; break;
-                case '-': resultado -= celdas[fila][columna]; break;
-                case '*': resultado *= celdas[fila][columna]; break;
-                case '/':
-                    if (celdas[fila][columna] != 0) resultado /= celdas[fila][columna];
-                    else throw std::invalid_argument("Error: Division por cero.");
-                default: throw std::invalid_argument("Error: Operacion no valida.");
-            }
-        }
-        return resultado;
+        size_t salto = (disposicion == Disposicion::PorColumnas) ? 1 : paso;
+        return reducir(celdas.data() + posicion(0, columna), numFilas, salto, operacion);
     }
 
-    void mostrar() const {
-        std::cout << "Hoja de Clculo:\n";
-
-        for (size_t i = 0; i < celdas[0].size(); ++i) {
-            std::cout << "-------";
+    // Dibuja solo la ventana visible. Todo se arma en un texto y se escribe
+    // de una vez, asi que el costo depende de las celdas visibles y no del
+    // tamano de la hoja. Si la hoja se achico, la ventana se corre hasta el final.
+    void mostrar(std::ostream& salida = std::cout) const {
+        const size_t ancho = 12;
+        std::string texto = "Hoja de Clculo";
+        if (numFilas == 0 || numColumnas == 0) {
+            texto += " (vacia)\n";
+            salida << texto << std::flush;
+            return;
         }
-        std::cout << std::endl;
+        size_t filas = std::min(vistaFilas, numFilas);
+        size_t columnas = std::min(vistaColumnas, numColumnas);
+        size_t fila0 = std::min(vistaFila, numFilas - filas);
+        size_t columna0 = std::min(vistaColumna, numColumnas - columnas);
 
-        for (const auto& fila : celdas) {
-            std::cout << "|";
-            for (const auto& celda : fila) {
-                std::cout << " " << celda << " |";
+        char numero[32];
+        auto agregar = [&](char prefijo, const char* inicio, const char* fin, size_t relleno) {
+            size_t largo = (fin - inicio) + (prefijo ? 1 : 0);
+            if (largo < relleno) {
+                texto.append(relleno - largo, ' ');
+            }
+            if (prefijo) {
+                texto += prefijo;
             }
-            std::cout << std::endl;
+            texto.append(inicio, fin);
+        };
+        auto agregarIndice = [&](char prefijo, size_t indice, size_t relleno) {
+            agregar(prefijo, numero, std::to_chars(numero, numero + sizeof(numero), indice).ptr, relleno);
+        };
+        size_t anchoFila = std::to_string(fila0 + filas - 1).size() + 1;
 
-            for (size_t i = 0; i < celdas[0].size(); ++i) {
-                std::cout << "-------";
+        texto += ": filas " + std::to_string(fila0) + "-" + std::to_string(fila0 + filas - 1) + " de " + std::to_string(numFilas) +
+                 ", columnas " + std::to_string(columna0) + "-" + std::to_string(columna0 + columnas - 1) + " de " + std::to_string(numColumnas) + "\n";
+        texto.reserve(texto.size() + (filas + 2) * (anchoFila + 2 + columnas * (ancho + 2)));
+        texto.append(anchoFila, ' ');
+        texto += " |";
+        for (size_t col = columna0; col < columna0 + columnas; ++col) {
+            agregarIndice('C', col, ancho + 1);
+            texto += " |";
+        }
+        texto += '\n';
+        texto.append(anchoFila + 1, '-');
+        texto += '+';
+        for (size_t col = 0; col < columnas; ++col) {
+            texto.append(ancho + 2, '-');
+            texto += '+';
+        }
+        texto += '\n';
+        for (size_t fila = fila0; fila < fila0 + filas; ++fila) {
+            agregarIndice('F', fila, anchoFila);
+            texto += " |";
+            for (size_t col = columna0; col < columna0 + columnas; ++col) {
+                char* fin = std::to_chars(numero, numero + sizeof(numero), celdas[posicion(fila, col)], std::chars_format::general, 6).ptr;
+                agregar('\0', numero, fin, ancho + 1);
+                texto += " |";
             }
-            std::cout << std::endl;
+            texto += '\n';
+        }
+        salida << texto << std::flush;
+    }
+
+    // Mueve la ventana de mostrar() a partir de (fila, columna)
+    void irA(size_t fila, size_t columna) {
+        vistaFila = fila;
+        vistaColumna = columna;
+    }
+
+    // Corre la ventana; los desplazamientos negativos se detienen en 0
+    void desplazarVista(long long filas, long long columnas) {
+        size_t fila0 = std::min(vistaFila, numFilas - std::min(vistaFilas, numFilas));
+        size_t columna0 = std::min(vistaColumna, numColumnas - std::min(vistaColumnas, numColumnas));
+        vistaFila = filas < 0 ? fila0 - std::min<size_t>(fila0, -static_cast<unsigned long long>(filas)) : fila0 + filas;
+        vistaColumna = columnas < 0 ? columna0 - std::min<size_t>(columna0, -static_cast<unsigned long long>(columnas)) : columna0 + columnas;
+    }
+
+    void establecerTamanoVista(size_t filas, size_t columnas) {
+        if (filas == 0 || columnas == 0) {
+            throw std::invalid_argument("La vista debe tener al menos una fila y una columna");
         }
-        std::cout << std::endl;
+        vistaFilas = filas;
+        vistaColumnas = columnas;
     }
 
     void guardarCSV(const std::string& nombreArchivo) const {
         std::ofstream archivo(nombreArchivo);
         if (archivo.is_open()) {
-            for (const auto& fila : celdas) {
-                for (size_t i = 0; i < fila.size(); ++i) {
-                    archivo << fila[i];
-                    if (i < fila.size() - 1) {
+            for (size_t fila = 0; fila < numFilas; ++fila) {
+                for (size_t i = 0; i < numColumnas; ++i) {
+                    archivo << celdas[posicion(fila, i)];
+                    if (i < numColumnas - 1) {
                         archivo << ",";
                     }
                 }
@@ -208,6 +478,10 @@ void menu(HojaCalculo& hoja) {
         std::cout << "8. Operar Todos los Elementos de una Fila\n";
         std::cout << "9. Operar Todos los Elementos de una Columna\n";
         std::cout << "10. Guardar en CSV\n";
+        std::cout << "11. Cambiar Disposicion (por filas / por columnas)\n";
+        std::cout << "12. Desplazar la Vista\n";
+        std::cout << "13. Ir a una Celda\n";
+        std::cout << "14. Cambiar el Tamano de la Vista\n";
         std::cout << "0. Salir\n";
         std::cout << "Ingrese su opcion: ";
         std::cin >> opcion;
@@ -297,6 +571,38 @@ void menu(HojaCalculo& hoja) {
                     std::cout << "Datos guardados en " << nombreArchivo << std::endl;
                     break;
                 }
+                case 11:
+                    if (hoja.obtenerDisposicion() == Disposicion::PorFilas) {
+                        hoja.establecerDisposicion(Disposicion::PorColumnas);
+                        std::cout << "Hoja almacenada por columnas.\n";
+                    } else {
+                        hoja.establecerDisposicion(Disposicion::PorFilas);
+                        std::cout << "Hoja almacenada por filas.\n";
+                    }
+                    break;
+                case 12: {
+                    std::cout << "Filas a desplazar (negativo hacia arriba): ";
+                    double filas = leerNumero();
+                    std::cout << "Columnas a desplazar (negativo hacia la izquierda): ";
+                    double columnas = leerNumero();
+                    hoja.desplazarVista(static_cast<long long>(filas), static_cast<long long>(columnas));
+                    hoja.mostrar();
+                    break;
+                }
+                case 13: {
+                    size_t fila = leerTamano("Ingrese el indice de la fila: ");
+                    size_t columna = leerTamano("Ingrese el indice de la columna: ");
+                    hoja.irA(fila, columna);
+                    hoja.mostrar();
+                    break;
+                }
+                case 14: {
+                    size_t filas = leerTamano("Filas visibles: ");
+                    size_t columnas = leerTamano("Columnas visibles: ");
+                    hoja.establecerTamanoVista(filas, columnas);
+                    hoja.mostrar();
+                    break;
+                }
                 case 0:
                     std::cout << "Saliendo del programa...\n";
                     break;
@@ -313,8 +619,12 @@ void menu(HojaCalculo& hoja) {
     } while (opcion != 0);
 }
 
+#ifndef HOJA_SIN_MAIN
+// Con HOJA_SIN_MAIN definido el archivo se puede incluir desde otro
+// programa (el de rendimiento).
 int main() {
     HojaCalculo hoja;
     menu(hoja);
     return 0;
 }
+#endif
@@ -4,52 +4,97 @@
 #include <stdexcept>
 #include <limits>
 #include <cstdlib>
+#include <algorithm>
+#include <charconv>
+#include <string>
 
 class HojaCalculo {
 private:
-    std::vector<std::vector<double>> celdas;
+    // Todas las celdas viven en un unico bloque contiguo ordenado por filas:
+    // la celda (fila, columna) esta en celdas[fila * paso + columna].
+    // El paso puede ser mayor que numColumnas; esas posiciones de holgura
+    // siempre valen 0.0 para que agregarColumna no tenga que mover datos.
+    std::vector<double> celdas;
+    size_t numFilas = 0;
+    size_t numColumnas = 0;
+    size_t paso = 0;
+    // Ventana que dibuja mostrar(): primera fila y columna visibles y tamano
+    size_t vistaFila = 0;
+    size_t vistaColumna = 0;
+    size_t vistaFilas = 20;
+    size_t vistaColumnas = 8;
+
+    size_t posicion(size_t fila, size_t columna) const {
+        return fila * paso + columna;
+    }
+
+    void cambiarPaso(size_t nuevoPaso) {
+        std::vector<double> nuevas(numFilas * nuevoPaso, 0.0);
+        size_t copiar = std::min(numColumnas, nuevoPaso);
+        for (size_t fila = 0; fila < numFilas; ++fila) {
+            std::copy_n(celdas.begin() + posicion(fila, 0), copiar, nuevas.begin() + fila * nuevoPaso);
+        }
+        celdas.swap(nuevas);
+        paso = nuevoPaso;
+    }
 
 public:
     void agregarFila() {
-        std::vector<double> nuevaFila(celdas.empty() ? 1 : celdas[0].size(), 0.0);
-        celdas.push_back(nuevaFila);
+        if (numFilas == 0) {
+            numColumnas = 1;
+            paso = 1;
+        }
+        celdas.resize((numFilas + 1) * paso, 0.0);
+        ++numFilas;
     }
 
     void eliminarFila(size_t index) {
-        if (index < celdas.size()) {
-            celdas.erase(celdas.begin() + index);
+        if (index < numFilas) {
+            celdas.erase(celdas.begin() + posicion(index, 0), celdas.begin() + posicion(index + 1, 0));
+            --numFilas;
+            if (numFilas == 0) {
+                numColumnas = 0;
+                paso = 0;
+            }
         } else {
             throw std::out_of_range("Indice de fila fuera de rango");
         }
     }
 
     void agregarColumna() {
-        for (auto& fila : celdas) {
-            fila.push_back(0.0);
+        if (numFilas == 0) {
+            return;
+        }
+        if (numColumnas == paso) {
+            cambiarPaso(paso + paso / 2 + 1);
         }
+        ++numColumnas;
     }
 
     void eliminarColumna(size_t index) {
-        if (!celdas.empty() && index < celdas[0].size()) {
-            for (auto& fila : celdas) {
-                fila.erase(fila.begin() + index);
+        if (numFilas > 0 && index < numColumnas) {
+            for (size_t fila = 0; fila < numFilas; ++fila) {
+                auto inicio = celdas.begin() + posicion(fila, 0);
+                std::copy(inicio + index + 1, inicio + numColumnas, inicio + index);
+                inicio[numColumnas - 1] = 0.0;
             }
+            --numColumnas;
         } else {
             throw std::out_of_range("Indice de columna fuera de rango");
         }
     }
 
     void actualizarCelda(size_t fila, size_t columna, double valor) {
-        if (fila < celdas.size() && columna < celdas[fila].size()) {
-            celdas[fila][columna] = valor;
+        if (fila < numFilas && columna < numColumnas) {
+            celdas[posicion(fila, columna)] = valor;
         } else {
             throw std::out_of_range("Indice de celda fuera de rango");
         }
     }
 
     double obtenerCelda(size_t fila, size_t columna) const {
-        if (fila < celdas.size() && columna < celdas[fila].size()) {
-            return celdas[fila][columna];
+        if (fila < numFilas && columna < numColumnas) {
+            return celdas[posicion(fila, columna)];
         } else {
             throw std::out_of_range("Indice de celda fuera de rango");
         }
@@ -71,36 +116,97 @@ public:
         }
     }
 
-    void mostrar() const {
-        std::cout << "Hoja de Clculo:\n";
-
-        for (size_t i = 0; i < celdas[0].size(); ++i) {
-            std::cout << "-------";
+    // Dibuja solo la ventana visible. Todo se arma en un texto y se escribe
+    // de una vez, asi que el costo depende de las celdas visibles y no del
+    // tamano de la hoja. Si la hoja se achico, la ventana se corre hasta el final.
+    void mostrar(std::ostream& salida = std::cout) const {
+        const size_t ancho = 12;
+        std::string texto = "Hoja de Clculo";
+        if (numFilas == 0 || numColumnas == 0) {
+            texto += " (vacia)\n";
+            salida << texto << std::flush;
+            return;
         }
-        std::cout << std::endl;
+        size_t filas = std::min(vistaFilas, numFilas);
+        size_t columnas = std::min(vistaColumnas, numColumnas);
+        size_t fila0 = std::min(vistaFila, numFilas - filas);
+        size_t columna0 = std::min(vistaColumna, numColumnas - columnas);
 
-        for (const auto& fila : celdas) {
-            std::cout << "|";
-            for (const auto& celda : fila) {
-                std::cout << " " << celda << " |";
+        char numero[32];
+        auto agregar = [&](char prefijo, const char* inicio, const char* fin, size_t relleno) {
+            size_t largo = (fin - inicio) + (prefijo ? 1 : 0);
+            if (largo < relleno) {
+                texto.append(relleno - largo, ' ');
+            }
+            if (prefijo) {
+                texto += prefijo;
             }
-            std::cout << std::endl;
+            texto.append(inicio, fin);
+        };
+        auto agregarIndice = [&](char prefijo, size_t indice, size_t relleno) {
+            agregar(prefijo, numero, std::to_chars(numero, numero + sizeof(numero), indice).ptr, relleno);
+        };
+        size_t anchoFila = std::to_string(fila0 + filas - 1).size() + 1;
 
-            for (size_t i = 0; i < celdas[0].size(); ++i) {
-                std::cout << "-------";
+        texto += ": filas " + std::to_string(fila0) + "-" + std::to_string(fila0 + filas - 1) + " de " + std::to_string(numFilas) +
+                 ", columnas " + std::to_string(columna0) + "-" + std::to_string(columna0 + columnas - 1) + " de " + std::to_string(numColumnas) + "\n";
+        texto.reserve(texto.size() + (filas + 2) * (anchoFila + 2 + columnas * (ancho + 2)));
+        texto.append(anchoFila, ' ');
+        texto += " |";
+        for (size_t col = columna0; col < columna0 + columnas; ++col) {
+            agregarIndice('C', col, ancho + 1);
+            texto += " |";
+        }
+        texto += '\n';
+        texto.append(anchoFila + 1, '-');
+        texto += '+';
+        for (size_t col = 0; col < columnas; ++col) {
+            texto.append(ancho + 2, '-');
+            texto += '+';
+        }
+        texto += '\n';
+        for (size_t fila = fila0; fila < fila0 + filas; ++fila) {
+            agregarIndice('F', fila, anchoFila);
+            texto += " |";
+            for (size_t col = columna0; col < columna0 + columnas; ++col) {
+                char* fin = std::to_chars(numero, numero + sizeof(numero), celdas[posicion(fila, col)], std::chars_format::general, 6).ptr;
+                agregar('\0', numero, fin, ancho + 1);
+                texto += " |";
             }
-            std::cout << std::endl;
+            texto += '\n';
         }
-        std::cout << std::endl;
+        salida << texto << std::flush;
+    }
+
+    // Mueve la ventana de mostrar() a partir de (fila, columna)
+    void irA(size_t fila, size_t columna) {
+        vistaFila = fila;
+        vistaColumna = columna;
+    }
+
+    // Corre la ventana; los desplazamientos negativos se detienen en 0
+    void desplazarVista(long long filas, long long columnas) {
+        size_t fila0 = std::min(vistaFila, numFilas - std::min(vistaFilas, numFilas));
+        size_t columna0 = std::min(vistaColumna, numColumnas - std::min(vistaColumnas, numColumnas));
+        vistaFila = filas < 0 ? fila0 - std::min<size_t>(fila0, -static_cast<unsigned long long>(filas)) : fila0 + filas;
+        vistaColumna = columnas < 0 ? columna0 - std::min<size_t>(columna0, -static_cast<unsigned long long>(columnas)) : columna0 + columnas;
+    }
+
+    void establecerTamanoVista(size_t filas, size_t columnas) {
+        if (filas == 0 || columnas == 0) {
+            throw std::invalid_argument("La vista debe tener al menos una fila y una columna");
+        }
+        vistaFilas = filas;
+        vistaColumnas = columnas;
     }
 
     void guardarCSV(const std::string& nombreArchivo) const {
         std::ofstream archivo(nombreArchivo);
         if (archivo.is_open()) {
-            for (const auto& fila : celdas) {
-                for (size_t i = 0; i < fila.size(); ++i) {
-                    archivo << fila[i];
-                    if (i < fila.size() - 1) {
+            for (size_t fila = 0; fila < numFilas; ++fila) {
+                for (size_t i = 0; i < numColumnas; ++i) {
+                    archivo << celdas[posicion(fila, i)];
+                    if (i < numColumnas - 1) {
                         archivo << ",";
                     }
                 }
@@ -165,6 +271,9 @@ void menu(HojaCalculo& hoja) {
         std::cout << "6. Agregar Valor a Celda Especifica\n";
         std::cout << "7. Realizar Operacion Aritmetica\n";
         std::cout << "9. Guardar en CSV\n";
+        std::cout << "10. Desplazar la Vista\n";
+        std::cout << "11. Ir a una Celda\n";
+        std::cout << "12. Cambiar el Tamano de la Vista\n";
         std::cout << "0. Salir\n";
         std::cout << "Ingrese su opcion: ";
         std::cin >> opcion;
@@ -238,6 +347,29 @@ void menu(HojaCalculo& hoja) {
                     std::cout << "Datos guardados en " << nombreArchivo << std::endl;
                     break;
                 }
+                case 10: {
+                    std::cout << "Filas a desplazar (negativo hacia arriba): ";
+                    double filas = leerNumero();
+                    std::cout << "Columnas a desplazar (negativo hacia la izquierda): ";
+                    double columnas = leerNumero();
+                    hoja.desplazarVista(static_cast<long long>(filas), static_cast<long long>(columnas));
+                    hoja.mostrar();
+                    break;
+                }
+                case 11: {
+                    size_t fila = leerTamano("Ingrese el indice de la fila: ");
+                    size_t columna = leerTamano("Ingrese el indice de la columna: ");
+                    hoja.irA(fila, columna);
+                    hoja.mostrar();
+                    break;
+                }
+                case 12: {
+                    size_t filas = leerTamano("Filas visibles: ");
+                    size_t columnas = leerTamano("Columnas visibles: ");
+                    hoja.establecerTamanoVista(filas, columnas);
+                    hoja.mostrar();
+                    break;
+                }
                 case 0:
                     std::cout << "Saliendo...\n";
                     break;
@@ -255,8 +387,12 @@ void menu(HojaCalculo& hoja) {
     } while (opcion != 0);
 }
 
+#ifndef HOJA_SIN_MAIN
+// Con HOJA_SIN_MAIN definido el archivo se puede incluir desde otro
+// programa (el de rendimiento).
 int main() {
     HojaCalculo hoja;
     menu(hoja);
     return 0;
 }
+#endif
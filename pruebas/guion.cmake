@@ -0,0 +1,46 @@
+# Corre un guion con "cargaCSV --script" y compara lo que imprime con el
+# archivo .esperado del mismo nombre. Lo usa add_test en CMakeLists.txt.
+# Cada guion corre en su propio directorio dentro de DIRECTORIO, con una
+# copia de los .csv de pruebas/, asi los archivos que escribe no se pisan.
+# Si existe <nombre>.argumentos, su contenido se pasa como opciones extra
+# (por ejemplo "--registro base"); si existe <nombre>.previo, se corre
+# antes en el mismo directorio y con las mismas opciones, sin comparar su
+# salida, para probar lo que queda de una ejecucion anterior.
+get_filename_component(nombre ${GUION} NAME_WE)
+get_filename_component(fuentes ${GUION} DIRECTORY)
+set(trabajo ${DIRECTORIO}/${nombre})
+file(REMOVE_RECURSE ${trabajo})
+file(MAKE_DIRECTORY ${trabajo})
+file(GLOB datos ${fuentes}/*.csv)
+if(datos)
+    file(COPY ${datos} DESTINATION ${trabajo})
+endif()
+string(REGEX REPLACE "\\.txt$" "" base ${GUION})
+set(argumentos)
+if(EXISTS ${base}.argumentos)
+    file(READ ${base}.argumentos argumentos)
+    string(STRIP "${argumentos}" argumentos)
+    separate_arguments(argumentos)
+endif()
+if(EXISTS ${base}.previo)
+    execute_process(
+        COMMAND ${PROGRAMA} ${argumentos} --script ${base}.previo
+        WORKING_DIRECTORY ${trabajo}
+        OUTPUT_QUIET
+        RESULT_VARIABLE resultado)
+    if(NOT resultado EQUAL 0)
+        message(FATAL_ERROR "El guion ${base}.previo termino con errores")
+    endif()
+endif()
+execute_process(
+    COMMAND ${PROGRAMA} ${argumentos} --script ${GUION}
+    WORKING_DIRECTORY ${trabajo}
+    OUTPUT_VARIABLE salida
+    RESULT_VARIABLE resultado)
+file(READ ${base}.esperado esperado)
+if(NOT resultado EQUAL 0)
+    message(FATAL_ERROR "El guion ${GUION} termino con errores")
+endif()
+if(NOT salida STREQUAL esperado)
+    message(FATAL_ERROR "Salida de ${GUION}:\n${salida}\nSe esperaba:\n${esperado}")
+endif()
@@ -0,0 +1,501 @@
+// Mediciones de rendimiento de HojaCalculo sobre hojas sinteticas.
+//
+// Para cada combinacion de tamano (celdas) y forma (columnas) genera un CSV
+// con la densidad pedida (fraccion de celdas distintas de 0), lo carga y mide
+// las operaciones principales. Cada medicion es una linea JSON en la salida
+// estandar, con el mejor tiempo de las repeticiones:
+//
+//   {"programa":"cargaCSV","operacion":"cargarCSV","celdas":1000000,
+//    "filas":100000,"columnas":10,"densidad":1,"dispersa":false,"hilos":1,
+//    "operaciones":1,"ns_op":...,"mb_s":...,"rss_pico_kb":...}
+//
+// mb_s es 0 en las operaciones que no recorren datos. rss_pico_kb es el
+// maximo del proceso hasta ese momento.
+//
+//   rendimiento [--celdas 1e4,1e5,1e6] [--columnas 10] [--densidad 1]
+//               [--repeticiones 3] [--hilos 1] [--dispersa]
+//               [--directorio /tmp]
+//
+// Con --celdas 1e8 la hoja ocupa 800 MB y el CSV alrededor de 1 GB.
+//
+// El mismo archivo mide la hoja de cada programa: sin definir nada la de
+// cargaCSV.cpp; con RENDIMIENTO_HOJA_BASICA la de main.cpp y con
+// RENDIMIENTO_HOJA_EXTENDIDA la de extencion.cpp. Esas dos no cargan CSV ni
+// tienen hilos ni modo disperso: la hoja se arma con agregarFila,
+// agregarColumna y actualizarCelda, y se miden las operaciones que tienen.
+#define HOJA_SIN_MAIN
+#if defined(RENDIMIENTO_HOJA_BASICA)
+#include "main.cpp"
+#define RENDIMIENTO_PROGRAMA "hojaCalculo"
+#elif defined(RENDIMIENTO_HOJA_EXTENDIDA)
+#include "extencion.cpp"
+#define RENDIMIENTO_PROGRAMA "hojaExtendida"
+#else
+#include "cargaCSV.cpp"
+#define RENDIMIENTO_PROGRAMA "cargaCSV"
+#define RENDIMIENTO_HOJA_COMPLETA
+#endif
+
+#include <charconv>
+#include <chrono>
+#include <functional>
+#include <random>
+#include <sstream>
+#include <string>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+namespace {
+
+struct Configuracion {
+    std::vector<size_t> celdas = {10000, 100000, 1000000};
+    std::vector<size_t> columnas = {10};
+    double densidad = 1.0;
+    size_t repeticiones = 3;
+    size_t hilos = 1;
+    bool dispersa = false;
+    std::string directorio = "/tmp";
+};
+
+struct Forma {
+    size_t celdas;
+    size_t filas;
+    size_t columnas;
+};
+
+size_t rssPico() {
+#ifndef _WIN32
+    struct rusage uso;
+    if (getrusage(RUSAGE_SELF, &uso) == 0) {
+        return static_cast<size_t>(uso.ru_maxrss);
+    }
+#endif
+    return 0;
+}
+
+size_t tamanoArchivo(const std::string& nombre) {
+    std::ifstream archivo(nombre, std::ios::binary | std::ios::ate);
+    return archivo.is_open() ? static_cast<size_t>(archivo.tellg()) : 0;
+}
+
+std::vector<size_t> leerLista(const std::string& texto) {
+    std::vector<size_t> valores;
+    std::stringstream partes(texto);
+    std::string parte;
+    while (std::getline(partes, parte, ',')) {
+        double valor = std::stod(parte);
+        if (!(valor >= 1)) {
+            throw std::invalid_argument("Los tamanos deben ser mayores que 0: " + parte);
+        }
+        valores.push_back(static_cast<size_t>(valor));
+    }
+    return valores;
+}
+
+#ifdef RENDIMIENTO_HOJA_COMPLETA
+// Escribe un CSV de filas x columnas. Los valores distintos de 0 salen de
+// una distribucion uniforme con semilla fija, asi dos corridas miden lo mismo.
+bool generarCSV(const std::string& nombre, const Forma& forma, double densidad) {
+    std::ofstream archivo(nombre, std::ios::binary);
+    if (!archivo.is_open()) {
+        return false;
+    }
+    std::mt19937_64 generador(42);
+    std::uniform_real_distribution<double> valor(-1000.0, 1000.0);
+    std::uniform_real_distribution<double> sorteo(0.0, 1.0);
+    std::string buffer;
+    buffer.reserve(1 << 20);
+    char numero[32];
+    for (size_t fila = 0; fila < forma.filas; ++fila) {
+        for (size_t col = 0; col < forma.columnas; ++col) {
+            double celda = sorteo(generador) < densidad ? valor(generador) : 0.0;
+            buffer.append(numero, std::to_chars(numero, numero + sizeof(numero), celda).ptr);
+            buffer += (col + 1 < forma.columnas) ? ',' : '\n';
+        }
+        if (buffer.size() > (1 << 20) - 4096) {
+            archivo.write(buffer.data(), buffer.size());
+            buffer.clear();
+        }
+    }
+    archivo.write(buffer.data(), buffer.size());
+    return static_cast<bool>(archivo);
+}
+#endif
+
+class Informe {
+public:
+    Informe(const Configuracion& configuracion, const Forma& forma)
+        : configuracion(configuracion), forma(forma) {}
+
+    // Repite 'medir' y publica el mejor tiempo. 'preparar' corre antes de
+    // cada repeticion y no se cuenta.
+    void medir(const char* operacion, size_t operaciones, size_t bytes,
+               const std::function<void()>& preparar, const std::function<void()>& medida) {
+        double mejor = std::numeric_limits<double>::infinity();
+        for (size_t r = 0; r < configuracion.repeticiones; ++r) {
+            preparar();
+            auto inicio = std::chrono::steady_clock::now();
+            medida();
+            mejor = std::min(mejor, std::chrono::duration<double>(std::chrono::steady_clock::now() - inicio).count());
+        }
+        publicar(operacion, operaciones, bytes, mejor);
+    }
+
+    void publicar(const char* operacion, size_t operaciones, size_t bytes, double segundos) const {
+        double nsOp = operaciones ? segundos * 1e9 / operaciones : 0.0;
+        double megas = (bytes && segundos > 0) ? bytes / (1024.0 * 1024.0) / segundos : 0.0;
+        std::cout << "{\"programa\":\"" RENDIMIENTO_PROGRAMA "\",\"operacion\":\"" << operacion
+                  << "\",\"celdas\":" << forma.celdas
+                  << ",\"filas\":" << forma.filas << ",\"columnas\":" << forma.columnas
+                  << ",\"densidad\":" << configuracion.densidad
+                  << ",\"dispersa\":" << (configuracion.dispersa ? "true" : "false")
+                  << ",\"hilos\":" << configuracion.hilos << ",\"operaciones\":" << operaciones
+                  << ",\"ns_op\":" << nsOp << ",\"mb_s\":" << megas << ",\"rss_pico_kb\":" << rssPico() << "}" << std::endl;
+    }
+
+private:
+    const Configuracion& configuracion;
+    Forma forma;
+};
+
+#ifdef RENDIMIENTO_HOJA_COMPLETA
+void medirForma(const Configuracion& configuracion, const Forma& forma) {
+    std::string entrada = configuracion.directorio + "/rendimiento_entrada.csv";
+    std::string salida = configuracion.directorio + "/rendimiento_salida.csv";
+    if (!generarCSV(entrada, forma, configuracion.densidad)) {
+        throw std::runtime_error("No se pudo escribir " + entrada);
+    }
+    Informe informe(configuracion, forma);
+    auto nada = [] {};
+
+    HojaCalculo hoja;
+    hoja.establecerAvisos(false);
+    hoja.establecerHilos(configuracion.hilos);
+    hoja.establecerDispersa(configuracion.dispersa);
+
+    size_t bytesEntrada = tamanoArchivo(entrada);
+    informe.medir("cargarCSV", 1, bytesEntrada, nada, [&] { hoja.cargarCSV(entrada); });
+
+    // El tamano del CSV guardado se conoce despues de guardar; el tiempo no
+    // depende de ello, asi que se mide con la primera escritura
+    hoja.guardarCSV(salida);
+    size_t bytesSalida = tamanoArchivo(salida);
+    informe.medir("guardarCSV", 1, bytesSalida, nada, [&] { hoja.guardarCSV(salida); });
+    std::remove(salida.c_str());
+
+    std::mt19937_64 generador(7);
+    size_t cambios = std::min<size_t>(forma.celdas, 1000000);
+    std::vector<Actualizacion> posiciones(cambios);
+    for (auto& posicion : posiciones) {
+        posicion = {generador() % forma.filas, generador() % forma.columnas, static_cast<double>(generador() % 1000)};
+    }
+    informe.medir("actualizarCelda", cambios, 0, nada, [&] {
+        for (const auto& posicion : posiciones) {
+            hoja.actualizarCelda(posicion.fila, posicion.columna, posicion.valor);
+        }
+    });
+
+    // Lo mismo con el registro de cambios activo; incluye los puntos de
+    // control que se hagan por el camino
+    std::string registro = configuracion.directorio + "/rendimiento_registro";
+    if (hoja.abrirRegistro(registro)) {
+        informe.medir("actualizarCelda(registro)", cambios, 0, nada, [&] {
+            for (const auto& posicion : posiciones) {
+                hoja.actualizarCelda(posicion.fila, posicion.columna, posicion.valor);
+            }
+            hoja.sincronizarRegistro();
+        });
+        hoja.cerrarRegistro();
+        std::remove((registro + ".hoja").c_str());
+        std::remove((registro + ".registro").c_str());
+    }
+
+    // Las reducciones se miden en frio: la cache se vacia antes de cada repeticion
+    size_t filasOperadas = std::min<size_t>(forma.filas, 100000);
+    double resultado = 0.0;
+    informe.medir("operarFila", filasOperadas, filasOperadas * forma.columnas * sizeof(double),
+                  [&] { hoja.vaciarCacheReducciones(); }, [&] {
+        for (size_t fila = 0; fila < filasOperadas; ++fila) {
+            resultado += hoja.operarFila(fila, '+');
+        }
+    });
+    size_t columnasOperadas = std::min<size_t>(forma.columnas, 1000);
+    informe.medir("operarColumna", columnasOperadas, columnasOperadas * forma.filas * sizeof(double),
+                  [&] { hoja.vaciarCacheReducciones(); }, [&] {
+        for (size_t col = 0; col < columnasOperadas; ++col) {
+            resultado += hoja.operarColumna(col, '+');
+        }
+    });
+    // Con la cache caliente; se queda bajo el tope de resultados guardados
+    size_t filasCache = std::min<size_t>(filasOperadas, 50000);
+    informe.medir("operarFila(cache)", filasCache, 0, [&] {
+        hoja.vaciarCacheReducciones();
+        for (size_t fila = 0; fila < filasCache; ++fila) {
+            resultado += hoja.operarFila(fila, '+');
+        }
+    }, [&] {
+        for (size_t fila = 0; fila < filasCache; ++fila) {
+            resultado += hoja.operarFila(fila, '+');
+        }
+    });
+
+    // Cada repeticion ordena al reves que la anterior, asi siempre hay que mover las filas
+    bool descendente = false;
+    informe.medir("ordenar", forma.filas, forma.filas * forma.columnas * sizeof(double),
+                  [&] { descendente = !descendente; }, [&] { hoja.ordenar({{0, descendente}}); });
+
+    // Busqueda de un valor de la columna 0: recorriendola y con cada tipo de
+    // indice. Los indices se quitan despues para no cambiar lo que sigue.
+    const size_t busquedas = 100;
+    std::vector<double> buscados(busquedas);
+    for (auto& buscado : buscados) {
+        buscado = hoja.obtenerCelda(generador() % forma.filas, 0);
+    }
+    size_t encontradas = 0;
+    auto buscarTodos = [&] {
+        for (double buscado : buscados) {
+            encontradas += hoja.buscar(0, buscado).filas.size();
+        }
+    };
+    informe.medir("buscar", busquedas, busquedas * forma.filas * sizeof(double), nada, buscarTodos);
+    for (TipoIndiceColumna tipo : {TipoIndiceColumna::Hash, TipoIndiceColumna::Ordenado}) {
+        bool hash = tipo == TipoIndiceColumna::Hash;
+        informe.medir(hash ? "crearIndiceColumna(hash)" : "crearIndiceColumna(ordenado)", forma.filas, 0, nada,
+                      [&] { hoja.crearIndiceColumna(0, tipo); });
+        informe.medir(hash ? "buscar(hash)" : "buscar(ordenado)", busquedas, 0, nada, buscarTodos);
+    }
+    informe.medir("filtrar(ordenado)", busquedas, 0, nada, [&] {
+        for (double buscado : buscados) {
+            encontradas += hoja.filtrar(0, buscado, buscado + 1.0).filas.size();
+        }
+    });
+    hoja.eliminarIndiceColumna(0);
+    resultado += static_cast<double>(encontradas);
+
+    // Agrupacion por una columna agregada con 1000 claves distintas, sumando
+    // y promediando la columna 0; la columna se quita despues
+    HojaCalculo grupos;
+    grupos.establecerAvisos(false);
+    hoja.agregarColumna();
+    std::vector<double> claves(forma.filas);
+    for (size_t fila = 0; fila < forma.filas; ++fila) {
+        claves[fila] = static_cast<double>(fila % 1000);
+    }
+    hoja.actualizarBloque(0, forma.columnas, forma.filas, 1, claves);
+    informe.medir("agrupar", forma.filas, forma.filas * 2 * sizeof(double), nada, [&] {
+        hoja.agrupar({forma.columnas}, {{0, FuncionRango::Suma}, {0, FuncionRango::Promedio}}, grupos);
+    });
+    hoja.eliminarColumna(forma.columnas);
+
+    // Las filas se eliminan desde la mitad, que es lo que mas mueve
+    const size_t estructurales = 1000;
+    informe.medir("agregarFila", estructurales, 0, nada, [&] {
+        for (size_t i = 0; i < estructurales; ++i) {
+            hoja.agregarFila();
+        }
+    });
+    informe.medir("eliminarFila", estructurales, 0, [&] {
+        for (size_t i = 0; i < estructurales; ++i) {
+            hoja.agregarFila();
+        }
+    }, [&] {
+        for (size_t i = 0; i < estructurales; ++i) {
+            hoja.eliminarFila(forma.filas / 2);
+        }
+    });
+    const size_t columnasNuevas = 20;
+    informe.medir("agregarColumna", columnasNuevas, 0, nada, [&] {
+        for (size_t i = 0; i < columnasNuevas; ++i) {
+            hoja.agregarColumna();
+        }
+    });
+    informe.medir("eliminarColumna", columnasNuevas, 0, [&] {
+        for (size_t i = 0; i < columnasNuevas; ++i) {
+            hoja.agregarColumna();
+        }
+    }, [&] {
+        for (size_t i = 0; i < columnasNuevas; ++i) {
+            hoja.eliminarColumna(forma.columnas / 2);
+        }
+    });
+
+    // Carga con las columnas comprimidas y estadisticas de toda la hoja,
+    // comprimida y sin comprimir. Los valores al azar de la entrada casi no
+    // se comprimen: es el peor caso para la carga.
+    if (!configuracion.dispersa) {
+        HojaCalculo comprimida;
+        comprimida.establecerAvisos(false);
+        comprimida.establecerHilos(configuracion.hilos);
+        comprimida.establecerCompresion(true);
+        informe.medir("cargarCSV(comprimida)", 1, bytesEntrada, nada, [&] { comprimida.cargarCSV(entrada); });
+        auto estadisticas = [&] {
+            resultado += comprimida.estadisticasRango(0, 0, forma.filas - 1, forma.columnas - 1).suma;
+        };
+        informe.medir("estadisticasRango(comprimida)", 1, 0, nada, estadisticas);
+        comprimida.establecerCompresion(false);
+        informe.medir("estadisticasRango", 1, forma.filas * forma.columnas * sizeof(double), nada, estadisticas);
+    }
+
+    std::remove(entrada.c_str());
+    // Evita que el compilador descarte las reducciones
+    if (resultado == 0.123456789) {
+        std::cerr << resultado << std::endl;
+    }
+}
+#else
+// Las hojas de main.cpp y extencion.cpp se arman celda por celda con los
+// mismos valores que tendria el CSV generado
+void medirForma(const Configuracion& configuracion, const Forma& forma) {
+    Informe informe(configuracion, forma);
+    auto nada = [] {};
+
+    HojaCalculo hoja;
+    std::mt19937_64 valores(42);
+    std::uniform_real_distribution<double> valor(-1000.0, 1000.0);
+    std::uniform_real_distribution<double> sorteo(0.0, 1.0);
+    auto construir = [&] {
+        hoja.agregarFila();
+        for (size_t col = 1; col < forma.columnas; ++col) {
+            hoja.agregarColumna();
+        }
+        for (size_t fila = 1; fila < forma.filas; ++fila) {
+            hoja.agregarFila();
+        }
+        for (size_t fila = 0; fila < forma.filas; ++fila) {
+            for (size_t col = 0; col < forma.columnas; ++col) {
+                if (sorteo(valores) < configuracion.densidad) {
+                    hoja.actualizarCelda(fila, col, valor(valores));
+                }
+            }
+        }
+    };
+    auto inicio = std::chrono::steady_clock::now();
+    construir();
+    informe.publicar("construir", forma.celdas, forma.celdas * sizeof(double),
+                     std::chrono::duration<double>(std::chrono::steady_clock::now() - inicio).count());
+
+    std::string salida = configuracion.directorio + "/rendimiento_salida.csv";
+    hoja.guardarCSV(salida);
+    size_t bytesSalida = tamanoArchivo(salida);
+    informe.medir("guardarCSV", 1, bytesSalida, nada, [&] { hoja.guardarCSV(salida); });
+    std::remove(salida.c_str());
+
+    std::mt19937_64 generador(7);
+    size_t cambios = std::min<size_t>(forma.celdas, 1000000);
+    std::vector<std::pair<size_t, size_t>> posiciones(cambios);
+    for (auto& posicion : posiciones) {
+        posicion = {generador() % forma.filas, generador() % forma.columnas};
+    }
+    informe.medir("actualizarCelda", cambios, 0, nada, [&] {
+        double nuevo = 0.0;
+        for (const auto& posicion : posiciones) {
+            hoja.actualizarCelda(posicion.first, posicion.second, nuevo);
+            nuevo += 1.0;
+        }
+    });
+
+    double resultado = 0.0;
+#ifdef RENDIMIENTO_HOJA_EXTENDIDA
+    size_t filasOperadas = std::min<size_t>(forma.filas, 100000);
+    informe.medir("operarFila", filasOperadas, filasOperadas * forma.columnas * sizeof(double), nada, [&] {
+        for (size_t fila = 0; fila < filasOperadas; ++fila) {
+            resultado += hoja.operarFila(fila, '+');
+        }
+    });
+    size_t columnasOperadas = std::min<size_t>(forma.columnas, 1000);
+    informe.medir("operarColumna", columnasOperadas, columnasOperadas * forma.filas * sizeof(double), nada, [&] {
+        for (size_t col = 0; col < columnasOperadas; ++col) {
+            resultado += hoja.operarColumna(col, '+');
+        }
+    });
+#endif
+
+    // Las filas se eliminan desde la mitad, que es lo que mas mueve
+    const size_t estructurales = 1000;
+    informe.medir("agregarFila", estructurales, 0, nada, [&] {
+        for (size_t i = 0; i < estructurales; ++i) {
+            hoja.agregarFila();
+        }
+    });
+    informe.medir("eliminarFila", estructurales, 0, [&] {
+        for (size_t i = 0; i < estructurales; ++i) {
+            hoja.agregarFila();
+        }
+    }, [&] {
+        for (size_t i = 0; i < estructurales; ++i) {
+            hoja.eliminarFila(forma.filas / 2);
+        }
+    });
+    const size_t columnasNuevas = 20;
+    informe.medir("agregarColumna", columnasNuevas, 0, nada, [&] {
+        for (size_t i = 0; i < columnasNuevas; ++i) {
+            hoja.agregarColumna();
+        }
+    });
+    informe.medir("eliminarColumna", columnasNuevas, 0, [&] {
+        for (size_t i = 0; i < columnasNuevas; ++i) {
+            hoja.agregarColumna();
+        }
+    }, [&] {
+        for (size_t i = 0; i < columnasNuevas; ++i) {
+            hoja.eliminarColumna(forma.columnas / 2);
+        }
+    });
+
+    // Evita que el compilador descarte las reducciones
+    if (resultado == 0.123456789) {
+        std::cerr << resultado << std::endl;
+    }
+}
+#endif
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Configuracion configuracion;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string opcion = argv[i];
+            if (opcion == "--dispersa") {
+#ifndef RENDIMIENTO_HOJA_COMPLETA
+                throw std::invalid_argument("La hoja de " RENDIMIENTO_PROGRAMA " no tiene modo disperso");
+#endif
+                configuracion.dispersa = true;
+                continue;
+            }
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("Falta el valor de " + opcion);
+            }
+            std::string valor = argv[++i];
+            if (opcion == "--celdas") {
+                configuracion.celdas = leerLista(valor);
+            } else if (opcion == "--columnas") {
+                configuracion.columnas = leerLista(valor);
+            } else if (opcion == "--densidad") {
+                configuracion.densidad = std::stod(valor);
+            } else if (opcion == "--repeticiones") {
+                configuracion.repeticiones = std::max<size_t>(1, std::stoul(valor));
+            } else if (opcion == "--hilos") {
+#ifndef RENDIMIENTO_HOJA_COMPLETA
+                throw std::invalid_argument("La hoja de " RENDIMIENTO_PROGRAMA " no usa hilos");
+#endif
+                configuracion.hilos = std::max<size_t>(1, std::stoul(valor));
+            } else if (opcion == "--directorio") {
+                configuracion.directorio = valor;
+            } else {
+                throw std::invalid_argument("Opcion desconocida: " + opcion);
+            }
+        }
+        for (size_t celdas : configuracion.celdas) {
+            for (size_t columnas : configuracion.columnas) {
+                Forma forma = {celdas, std::max<size_t>(1, celdas / columnas), columnas};
+                medirForma(configuracion, forma);
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}